@@ -0,0 +1,304 @@
+#pragma once
+
+#include "unevaluated.hpp"
+#include <concepts>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <span>
+#include <string>
+#include <type_traits>
+#include <fmt/core.h>
+
+// an expression_arena provides storage for expressions too large to store within an any_expression
+//
+// an arena acquires its storage once, when it is created, and hands it out in order. the objects
+// an arena creates are destroyed, most recent first, and their storage released only when the
+// arena is destroyed, so destroying an any_expression which lives in an arena does nothing.
+// expressions stored in an arena must not outlive it.
+class expression_arena
+{
+  public:
+    // allocates capacity bytes of storage
+    explicit expression_arena(std::size_t capacity)
+      : owned_{new std::byte[capacity]},
+        buffer_{owned_.get(), capacity}
+    {}
+
+    // uses buffer as storage, without allocating
+    explicit expression_arena(std::span<std::byte> buffer)
+      : buffer_{buffer}
+    {}
+
+    expression_arena(const expression_arena&) = delete;
+
+    ~expression_arena()
+    {
+      for(cleanup* c = cleanups_; c; c = c->next)
+      {
+        c->destroy(c->object);
+      }
+    }
+
+    // copies value into the arena, or throws std::bad_alloc if the arena is full
+    template<class T>
+    const T* create(const T& value)
+    {
+      if constexpr (std::is_trivially_destructible_v<T>)
+      {
+        return new(allocate(sizeof(T), alignof(T))) T(value);
+      }
+      else
+      {
+        // allocate both the object and the record of its destructor before constructing either
+        void* record = allocate(sizeof(cleanup), alignof(cleanup));
+        T* result = new(allocate(sizeof(T), alignof(T))) T(value);
+
+        cleanups_ = new(record) cleanup{[](void* object) { static_cast<T*>(object)->~T(); }, result, cleanups_};
+        return result;
+      }
+    }
+
+    // returns storage for size bytes aligned to alignment, or throws std::bad_alloc if the arena is full
+    void* allocate(std::size_t size, std::size_t alignment)
+    {
+      void* result = buffer_.data() + used_;
+      std::size_t space = buffer_.size() - used_;
+
+      if(not std::align(alignment, size, result, space)) throw std::bad_alloc();
+
+      used_ = static_cast<std::byte*>(result) - buffer_.data() + size;
+      return result;
+    }
+
+    // the number of bytes handed out so far
+    std::size_t size() const
+    {
+      return used_;
+    }
+
+    std::size_t capacity() const
+    {
+      return buffer_.size();
+    }
+
+  private:
+    struct cleanup
+    {
+      void (*destroy)(void*);
+      void* object;
+      cleanup* next;
+    };
+
+    std::unique_ptr<std::byte[]> owned_;
+    std::span<std::byte> buffer_;
+    std::size_t used_ = 0;
+    cleanup* cleanups_ = nullptr;
+};
+
+
+namespace detail
+{
+
+// the operations of an any_expression<T> which depend on the type of the expression it holds
+template<class T>
+struct expression_vtable
+{
+  T (*evaluate)(const void* expr, const environment& env);
+  T (*evaluate_slots)(const void* expr, const slot_environment& env);
+  std::string (*to_string)(const void* expr);
+  bool (*is_operation)(const void* expr);
+
+  // copies the storage of one any_expression into another, which holds nothing
+  void (*copy)(const void* from, void* to);
+  void (*destroy)(void* storage);
+};
+
+// the vtable of an any_expression holding an E, stored either within the any_expression itself
+// or in an arena, in which case the any_expression stores a pointer to it
+template<class T, class E, bool is_stored_inline>
+struct expression_vtable_for
+{
+  static const E& object(const void* storage)
+  {
+    if constexpr (is_stored_inline)
+    {
+      return *std::launder(static_cast<const E*>(storage));
+    }
+    else
+    {
+      return **static_cast<const E* const*>(storage);
+    }
+  }
+
+  constexpr static expression_vtable<T> value =
+  {
+    [](const void* expr, const environment& env) -> T
+    {
+      return evaluate(object(expr), env);
+    },
+
+    [](const void* expr, const slot_environment& env) -> T
+    {
+      return evaluate(object(expr), env);
+    },
+
+    [](const void* expr) -> std::string
+    {
+      if constexpr (fmt::is_formattable<E>::value)
+      {
+        return fmt::format("{}", object(expr));
+      }
+      else
+      {
+        return "?";
+      }
+    },
+
+    [](const void* expr)
+    {
+      return detail::is_operation(object(expr));
+    },
+
+    [](const void* from, void* to)
+    {
+      if constexpr (is_stored_inline)
+      {
+        new(to) E(object(from));
+      }
+      else
+      {
+        // expressions in an arena are never modified, so copies may share them
+        *static_cast<const E**>(to) = &object(from);
+      }
+    },
+
+    [](void* storage)
+    {
+      if constexpr (is_stored_inline)
+      {
+        static_cast<E*>(storage)->~E();
+      }
+    }
+  };
+};
+
+} // end detail
+
+
+// an any_expression<T> holds any expression whose value is a T
+//
+// expressions small enough to fit in buffer_size bytes are stored within the any_expression
+// itself, so that a container of any_expressions is contiguous and creating or destroying one
+// does not allocate. larger expressions are stored in an expression_arena.
+//
+// an any_expression is itself an expression, and may be combined with others by the operators. it
+// may be evaluated in an environment or a slot_environment, but the variables it holds are hidden,
+// so compile and evaluate_batch reject expressions which contain one
+template<class T>
+class any_expression
+{
+  public:
+    using value_type = T;
+
+    // chosen so that an any_expression occupies a cache line
+    constexpr static std::size_t buffer_size = 48;
+
+    template<class E>
+    constexpr static bool fits_inline =
+      sizeof(E) <= buffer_size
+      and alignof(E) <= alignof(std::max_align_t)
+      and std::is_nothrow_copy_constructible_v<E>
+    ;
+
+    // construction is explicit because overload resolution would otherwise consider converting
+    // any expression containing an any_expression to one while deciding whether it is unevaluated
+    template<class E>
+      requires (not std::same_as<E,any_expression> and unevaluated<E> and std::same_as<evaluated_t<E>,T> and fits_inline<E>)
+    explicit any_expression(const E& expr)
+      : vtable_{&detail::expression_vtable_for<T,E,true>::value}
+    {
+      new(storage_) E(expr);
+    }
+
+    // stores expr in arena if it does not fit within the any_expression
+    template<unevaluated E>
+      requires std::same_as<evaluated_t<E>,T>
+    explicit any_expression(const E& expr, expression_arena& arena)
+    {
+      if constexpr (fits_inline<E>)
+      {
+        vtable_ = &detail::expression_vtable_for<T,E,true>::value;
+        new(storage_) E(expr);
+      }
+      else
+      {
+        vtable_ = &detail::expression_vtable_for<T,E,false>::value;
+        *reinterpret_cast<const E**>(storage_) = arena.create(expr);
+      }
+    }
+
+    any_expression(const any_expression& other) noexcept
+      : vtable_{other.vtable_}
+    {
+      vtable_->copy(other.storage_, storage_);
+    }
+
+    any_expression& operator=(const any_expression& other)
+    {
+      if(this != &other)
+      {
+        vtable_->destroy(storage_);
+        vtable_ = other.vtable_;
+        vtable_->copy(other.storage_, storage_);
+      }
+
+      return *this;
+    }
+
+    ~any_expression()
+    {
+      vtable_->destroy(storage_);
+    }
+
+    friend T evaluate(const any_expression& self, const environment& env)
+    {
+      return self.vtable_->evaluate(self.storage_, env);
+    }
+
+    friend T evaluate(const any_expression& self, const slot_environment& env)
+    {
+      return self.vtable_->evaluate_slots(self.storage_, env);
+    }
+
+    // the held expression is only reachable through environment and slot_environment. any other
+    // environment, such as compile's, would otherwise evaluate an any_expression to itself
+    template<class Env>
+    friend T evaluate(const any_expression& self, const Env& env) = delete;
+
+    // formats the held expression
+    std::string to_string() const
+    {
+      return vtable_->to_string(storage_);
+    }
+
+    // true when the held expression is an operation, so that formatting parenthesizes it
+    bool is_operation() const
+    {
+      return vtable_->is_operation(storage_);
+    }
+
+  private:
+    const detail::expression_vtable<T>* vtable_;
+    alignas(std::max_align_t) std::byte storage_[buffer_size];
+};
+
+template<class T>
+struct fmt::formatter<any_expression<T>> : fmt::formatter<std::string>
+{
+  template<class FormatContext>
+  auto format(const any_expression<T>& expr, FormatContext& ctx)
+  {
+    return fmt::formatter<std::string>::format(expr.to_string(), ctx);
+  }
+};
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <fmt/format.h>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#ifndef BENCHMARK_REVISION
+#define BENCHMARK_REVISION "unknown"
+#endif
+
+// makes the compiler assume that value is read, so that the work which computed it is not removed
+template<class T>
+void keep(const T& value)
+{
+  asm volatile("" : : "m"(value) : "memory");
+}
+
+// makes the compiler assume that value may have changed, so that work on it is not folded or hoisted
+template<class T>
+void clobber(T& value)
+{
+  asm volatile("" : "+m"(value) : : "memory");
+}
+
+
+// a benchmark_suite times small functions and prints their costs as JSON
+//
+// each benchmark is run for enough iterations that one sample takes at least min_time, and
+// num_samples samples are taken; the median and fastest time per iteration are reported. a
+// benchmark whose name does not contain filter is skipped.
+class benchmark_suite
+{
+  public:
+    explicit benchmark_suite(std::string_view engine, std::string_view filter = "", std::chrono::nanoseconds min_time = std::chrono::milliseconds(20), std::size_t num_samples = 7)
+      : engine_{engine},
+        filter_{filter},
+        min_time_{min_time},
+        num_samples_{std::max<std::size_t>(1, num_samples)}
+    {}
+
+    // times f(), which returns the value computed by one iteration
+    //
+    // if bytes_per_iteration is nonzero, the throughput of f is also reported
+    template<class F>
+    void run(std::string_view name, F f, std::size_t bytes_per_iteration = 0)
+    {
+      if(name.find(filter_) == std::string_view::npos) return;
+
+      // double the number of iterations until a sample is long enough
+      std::uint64_t iterations = 1;
+      while(time(f, iterations) < min_time_)
+      {
+        iterations *= 2;
+      }
+
+      std::vector<double> samples(num_samples_);
+      for(double& sample : samples)
+      {
+        sample = double(time(f, iterations).count()) / iterations;
+      }
+
+      std::sort(samples.begin(), samples.end());
+      results_.push_back({std::string(name), iterations, samples[samples.size() / 2], samples.front(), bytes_per_iteration});
+    }
+
+    // prints the results as a JSON object
+    void print(std::FILE* out = stdout) const
+    {
+      fmt::print(out, "{{\n");
+      fmt::print(out, "  \"engine\": \"{}\",\n", escaped(engine_));
+      fmt::print(out, "  \"revision\": \"{}\",\n", escaped(BENCHMARK_REVISION));
+      fmt::print(out, "  \"compiler\": \"{}\",\n", escaped(__VERSION__));
+      fmt::print(out, "  \"benchmarks\": [");
+
+      for(std::size_t i = 0; i < results_.size(); ++i)
+      {
+        const result& r = results_[i];
+
+        fmt::print(out, "{}\n    {{\"name\": \"{}\", \"iterations\": {}, \"samples\": {}, \"ns_per_iteration\": {:.3f}, \"min_ns_per_iteration\": {:.3f}", i == 0 ? "" : ",", escaped(r.name), r.iterations, num_samples_, r.ns_per_iteration, r.min_ns_per_iteration);
+
+        if(r.bytes_per_iteration != 0)
+        {
+          fmt::print(out, ", \"bytes_per_second\": {:.0f}", r.bytes_per_iteration * 1e9 / r.ns_per_iteration);
+        }
+
+        fmt::print(out, "}}");
+      }
+
+      fmt::print(out, "\n  ]\n}}\n");
+    }
+
+  private:
+    struct result
+    {
+      std::string name;
+      std::uint64_t iterations;
+      double ns_per_iteration;
+      double min_ns_per_iteration;
+      std::size_t bytes_per_iteration;
+    };
+
+    template<class F>
+    static std::chrono::nanoseconds time(F& f, std::uint64_t iterations)
+    {
+      auto start = std::chrono::steady_clock::now();
+      for(std::uint64_t i = 0; i < iterations; ++i)
+      {
+        keep(f());
+      }
+
+      return std::chrono::steady_clock::now() - start;
+    }
+
+    static std::string escaped(std::string_view s)
+    {
+      std::string result;
+      for(char c : s)
+      {
+        if(c == '"' or c == '\\') result += '\\';
+        result += c;
+      }
+
+      return result;
+    }
+
+    std::string engine_;
+    std::string filter_;
+    std::chrono::nanoseconds min_time_;
+    std::size_t num_samples_;
+    std::vector<result> results_;
+};
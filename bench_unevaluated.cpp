@@ -0,0 +1,173 @@
+// times the operations of unevaluated.hpp; bench_variable.cpp times the same operations of
+// variable.hpp under the same names, so that their results may be compared side by side
+#include "bench.hpp"
+#include "unevaluated.hpp"
+#include <cstddef>
+#include <fmt/core.h>
+#include <string>
+#include <tuple>
+#include <utility>
+
+template<class N, class D>
+constexpr auto ceil_div(N n, D d)
+{
+  return (n + d - 1) / d;
+}
+
+// x * y + x, nested depth times
+template<int depth, class X, class Y>
+constexpr auto chain(X x, Y y)
+{
+  if constexpr (depth == 1)
+  {
+    return x * y + x;
+  }
+  else
+  {
+    return chain<depth-1>(x, y) * y + x;
+  }
+}
+
+constexpr std::tuple variables{"a"_v, "b"_v, "c"_v, "d"_v, "e"_v, "f"_v, "g"_v, "h"_v};
+
+// the sum of the first n variables
+template<std::size_t n>
+constexpr auto sum_of_variables()
+{
+  return []<std::size_t... i>(std::index_sequence<i...>)
+  {
+    return (std::get<i>(variables) + ...);
+  }(std::make_index_sequence<n>());
+}
+
+int main(int argc, char** argv)
+{
+  benchmark_suite suite("unevaluated", argc > 1 ? argv[1] : "");
+
+  environment env{{"a", 1}, {"b", 2}, {"c", 3}, {"d", 4}, {"e", 5}, {"f", 6}, {"g", 7}, {"h", 8}};
+
+  auto x = "x"_v;
+  auto y = "y"_v;
+  environment xy{{"x", 3}, {"y", 2}};
+
+  auto evaluate_chain = [&](auto expr)
+  {
+    return [=]() mutable
+    {
+      clobber(xy);
+      return evaluate(expr, xy);
+    };
+  };
+
+  suite.run("evaluate/depth/1", evaluate_chain(chain<1>(x, y)));
+  suite.run("evaluate/depth/4", evaluate_chain(chain<4>(x, y)));
+  suite.run("evaluate/depth/16", evaluate_chain(chain<16>(x, y)));
+
+  auto evaluate_sum = [&](auto expr)
+  {
+    return [=]() mutable
+    {
+      clobber(env);
+      return evaluate(expr, env);
+    };
+  };
+
+  suite.run("evaluate/variables/1", evaluate_sum(sum_of_variables<1>()));
+  suite.run("evaluate/variables/2", evaluate_sum(sum_of_variables<2>()));
+  suite.run("evaluate/variables/4", evaluate_sum(sum_of_variables<4>()));
+  suite.run("evaluate/variables/8", evaluate_sum(sum_of_variables<8>()));
+
+  auto n = "n"_v;
+  auto block_size = "block_size"_v;
+  environment launch{{"n", 12345}, {"block_size", 128}};
+
+  auto evaluate_tuple = [&](auto expr)
+  {
+    return [=]() mutable
+    {
+      clobber(launch);
+      return evaluate(expr, launch);
+    };
+  };
+
+  suite.run("evaluate/tuple/2", evaluate_tuple(std::tuple(ceil_div(n, block_size), block_size)));
+  suite.run("evaluate/tuple/4", evaluate_tuple(std::tuple(ceil_div(n, block_size), block_size, n % block_size, ceil_div(n, block_size) * block_size)));
+
+  int i = 0;
+
+  suite.run("environment/construct/1", [&]
+  {
+    ++i;
+    return environment{{"a", i}};
+  });
+
+  suite.run("environment/construct/4", [&]
+  {
+    ++i;
+    return environment{{"a", i}, {"b", i}, {"c", i}, {"d", i}};
+  });
+
+  suite.run("environment/construct/8", [&]
+  {
+    ++i;
+    return environment{{"a", i}, {"b", i}, {"c", i}, {"d", i}, {"e", i}, {"f", i}, {"g", i}, {"h", i}};
+  });
+
+  // as variable.hpp's set does, this returns a new environment with one name rebound
+  suite.run("environment/set", [&]
+  {
+    environment result = env;
+    result["d"] = ++i;
+    return result;
+  });
+
+  suite.run("environment/assign", [&]
+  {
+    env.find("d")->second = ++i;
+    clobber(env);
+    return 0;
+  });
+
+  suite.run("lookup/find", [&]
+  {
+    clobber(env);
+    return &env.find("h")->second;
+  });
+
+  const scalar& h = env.find("h")->second;
+
+  suite.run("lookup/cast", [&]
+  {
+    clobber(env);
+    return scalar_cast<int>(h);
+  });
+
+  suite.run("lookup/find_and_cast", [&]
+  {
+    clobber(env);
+    return scalar_cast<int>(env.find("h")->second);
+  });
+
+  auto format_chain = [](auto expr)
+  {
+    std::size_t size = fmt::formatted_size("{}", expr);
+
+    return std::pair([=]
+    {
+      return fmt::format("{}", expr);
+    },
+    size);
+  };
+
+  auto [format_1, size_1] = format_chain(chain<1>(x, y));
+  auto [format_4, size_4] = format_chain(chain<4>(x, y));
+  auto [format_16, size_16] = format_chain(chain<16>(x, y));
+
+  suite.run("format/depth/1", format_1, size_1);
+  suite.run("format/depth/4", format_4, size_4);
+  suite.run("format/depth/16", format_16, size_16);
+
+  suite.print();
+
+  return 0;
+}
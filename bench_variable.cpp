@@ -0,0 +1,159 @@
+// times the operations of variable.hpp; bench_unevaluated.cpp times the same operations of
+// unevaluated.hpp under the same names, so that their results may be compared side by side
+#include "bench.hpp"
+#include "variable.hpp"
+#include <cstddef>
+#include <fmt/core.h>
+#include <string>
+#include <tuple>
+#include <utility>
+
+template<class N, class D>
+constexpr auto ceil_div(N n, D d)
+{
+  return (n + d - 1) / d;
+}
+
+// x * y + x, nested depth times
+template<int depth, class X, class Y>
+constexpr auto chain(X x, Y y)
+{
+  if constexpr (depth == 1)
+  {
+    return x * y + x;
+  }
+  else
+  {
+    return chain<depth-1>(x, y) * y + x;
+  }
+}
+
+constexpr std::tuple variables{variable<"a">(), variable<"b">(), variable<"c">(), variable<"d">(), variable<"e">(), variable<"f">(), variable<"g">(), variable<"h">()};
+
+// the sum of the first n variables
+template<std::size_t n>
+constexpr auto sum_of_variables()
+{
+  return []<std::size_t... i>(std::index_sequence<i...>)
+  {
+    return (std::get<i>(variables) + ...);
+  }(std::make_index_sequence<n>());
+}
+
+int main(int argc, char** argv)
+{
+  benchmark_suite suite("variable", argc > 1 ? argv[1] : "");
+
+  environment env(binding<"a">{1}, binding<"b">{2}, binding<"c">{3}, binding<"d">{4}, binding<"e">{5}, binding<"f">{6}, binding<"g">{7}, binding<"h">{8});
+
+  variable<"x"> x;
+  variable<"y"> y;
+  environment xy(binding<"x">{3}, binding<"y">{2});
+
+  auto evaluate_chain = [&](auto expr)
+  {
+    return [=]() mutable
+    {
+      clobber(xy);
+      return evaluate(expr, xy);
+    };
+  };
+
+  suite.run("evaluate/depth/1", evaluate_chain(chain<1>(x, y)));
+  suite.run("evaluate/depth/4", evaluate_chain(chain<4>(x, y)));
+  suite.run("evaluate/depth/16", evaluate_chain(chain<16>(x, y)));
+
+  auto evaluate_sum = [&](auto expr)
+  {
+    return [=]() mutable
+    {
+      clobber(env);
+      return evaluate(expr, env);
+    };
+  };
+
+  suite.run("evaluate/variables/1", evaluate_sum(sum_of_variables<1>()));
+  suite.run("evaluate/variables/2", evaluate_sum(sum_of_variables<2>()));
+  suite.run("evaluate/variables/4", evaluate_sum(sum_of_variables<4>()));
+  suite.run("evaluate/variables/8", evaluate_sum(sum_of_variables<8>()));
+
+  variable<"n"> n;
+  variable<"block_size"> block_size;
+  environment launch(binding<"n">{12345}, binding<"block_size">{128});
+
+  auto evaluate_tuple = [&](auto expr)
+  {
+    return [=]() mutable
+    {
+      clobber(launch);
+      return evaluate(expr, launch);
+    };
+  };
+
+  suite.run("evaluate/tuple/2", evaluate_tuple(std::tuple(ceil_div(n, block_size), block_size)));
+  suite.run("evaluate/tuple/4", evaluate_tuple(std::tuple(ceil_div(n, block_size), block_size, n % block_size, ceil_div(n, block_size) * block_size)));
+
+  int i = 0;
+
+  suite.run("environment/construct/1", [&]
+  {
+    ++i;
+    return environment(binding<"a">{i});
+  });
+
+  suite.run("environment/construct/4", [&]
+  {
+    ++i;
+    return environment(binding<"a">{i}, binding<"b">{i}, binding<"c">{i}, binding<"d">{i});
+  });
+
+  suite.run("environment/construct/8", [&]
+  {
+    ++i;
+    return environment(binding<"a">{i}, binding<"b">{i}, binding<"c">{i}, binding<"d">{i}, binding<"e">{i}, binding<"f">{i}, binding<"g">{i}, binding<"h">{i});
+  });
+
+  // set returns a new environment with one name rebound
+  suite.run("environment/set", [&]
+  {
+    clobber(env);
+    return set<"d">(env, ++i);
+  });
+
+  suite.run("environment/assign", [&]
+  {
+    env.get<"d">() = ++i;
+    clobber(env);
+    return 0;
+  });
+
+  // names are resolved when the program is compiled, so a lookup only loads the value
+  suite.run("lookup/find", [&]
+  {
+    clobber(env);
+    return get<"h">(env);
+  });
+
+  auto format_chain = [](auto expr)
+  {
+    std::size_t size = fmt::formatted_size("{}", expr);
+
+    return std::pair([=]
+    {
+      return fmt::format("{}", expr);
+    },
+    size);
+  };
+
+  auto [format_1, size_1] = format_chain(chain<1>(x, y));
+  auto [format_4, size_4] = format_chain(chain<4>(x, y));
+  auto [format_16, size_16] = format_chain(chain<16>(x, y));
+
+  suite.run("format/depth/1", format_1, size_1);
+  suite.run("format/depth/4", format_4, size_4);
+  suite.run("format/depth/16", format_16, size_16);
+
+  suite.print();
+
+  return 0;
+}
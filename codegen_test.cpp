@@ -0,0 +1,67 @@
+// compiled expressions should compile to the same instructions as the arithmetic written by hand
+//
+// codegen_test.sh compiles this file and compares the disassembly of each compiled_* function
+// with that of the hand_written_* function of the same suffix
+
+#include "variable.hpp"
+
+template<class N, class D>
+constexpr auto ceil_div(N n, D d)
+{
+  return (n + d - 1) / d;
+}
+
+constexpr variable<"n"> n;
+constexpr variable<"block_size"> block_size;
+constexpr variable<"tile"> tile;
+
+extern "C"
+{
+
+int compiled_ceil_div(int n_, int block_size_)
+{
+  constexpr auto f = compile<"n","block_size">(ceil_div(n, block_size));
+  return f(n_, block_size_);
+}
+
+int hand_written_ceil_div(int n, int block_size)
+{
+  return (n + block_size - 1) / block_size;
+}
+
+int compiled_shared_memory(int block_size_, int tile_)
+{
+  constexpr auto f = compile<"block_size","tile">((block_size + 1_c) * tile * 4_c);
+  return f(block_size_, tile_);
+}
+
+int hand_written_shared_memory(int block_size, int tile)
+{
+  return (block_size + 1) * tile * 4;
+}
+
+long compiled_cost(long n_, long block_size_, long tile_)
+{
+  // literals which are not constants are stored in the compiled expression
+  static const auto f = compile<"n","block_size","tile">(ceil_div(n, block_size) * (block_size + tile * 3));
+  return f(n_, block_size_, tile_);
+}
+
+long hand_written_cost(long n, long block_size, long tile)
+{
+  return (n + block_size - 1) / block_size * (block_size + tile * 3);
+}
+
+// evaluation which is not instrumented records nothing
+int compiled_not_instrumented(int n_, int block_size_)
+{
+  environment env(binding<"n">{n_}, binding<"block_size">{block_size_});
+  return evaluate(ceil_div(n, block_size), env, not_instrumented());
+}
+
+int hand_written_not_instrumented(int n, int block_size)
+{
+  return (n + block_size - 1) / block_size;
+}
+
+}
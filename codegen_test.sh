@@ -0,0 +1,31 @@
+#!/bin/bash
+# compares the disassembly of each compiled_* function in codegen_test.cpp with that of the
+# corresponding hand_written_* function, and fails if any differ
+set -e
+cd "$(dirname "$0")"
+
+CXX=${CXX:-g++}
+CXXFLAGS=${CXXFLAGS:--O2}
+object=$(mktemp --suffix=.o)
+trap 'rm -f "$object"' EXIT
+
+$CXX -std=c++20 $CXXFLAGS -c codegen_test.cpp -o "$object"
+
+# prints the instructions of function $1, without addresses or encodings
+disassemble()
+{
+  objdump -d --no-show-raw-insn --no-addresses "$object" --disassemble="$1" | sed -n '/^<'"$1"'>:/,/^$/p' | tail -n +2
+}
+
+status=0
+for function in $(nm "$object" | awk '$2 == "T" && $3 ~ /^compiled_/ { sub(/^compiled_/, "", $3); print $3 }'); do
+  if diff <(disassemble "compiled_$function") <(disassemble "hand_written_$function") > /dev/null; then
+    echo "$function: same"
+  else
+    echo "$function: differs"
+    diff <(disassemble "compiled_$function") <(disassemble "hand_written_$function") || true
+    status=1
+  fi
+done
+
+exit $status
@@ -0,0 +1,387 @@
+// measures how the compile time of variable.hpp scales
+//
+// compile_bench generates translation units which exercise one part of variable.hpp at a time, at
+// several sizes, compiles each with $CXX $CXXFLAGS, and reports the compiler's wall time, peak
+// memory, time spent instantiating templates, and object size. with clang, the number of template
+// instantiations is counted from -ftime-trace; gcc reports no count, only the time from -ftime-report.
+//
+// the report is printed, and the measurements are written as JSON to the file named by -o.
+//
+//   usage: compile_bench [-o compile_bench.json] [-r repeats] [series...]
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fmt/core.h>
+#include <fmt/os.h>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#ifndef SOURCE_DIR
+#define SOURCE_DIR "."
+#endif
+
+extern char** environ;
+
+namespace fs = std::filesystem;
+
+// a series generates translation units of increasing size which exercise one part of variable.hpp
+struct series
+{
+  std::string_view name;
+  std::string_view description;
+  std::vector<std::size_t> sizes;
+  std::function<std::string(std::size_t)> generate;
+};
+
+struct measurement
+{
+  std::string_view series;
+  std::size_t size;
+  double wall_seconds;
+  long peak_rss_kb;
+  std::optional<double> instantiation_seconds;
+  std::optional<long> instantiations;
+  std::uintmax_t object_bytes;
+};
+
+
+// "environment env(binding<"v0">{x}, ..., binding<"v{n-1}">{x});"
+std::string environment_of(std::size_t n)
+{
+  std::string result = "  environment env(";
+  for(std::size_t i = 0; i < n; ++i)
+  {
+    result += fmt::format("{}binding<\"v{}\">{{x}}", i == 0 ? "" : ", ", i);
+  }
+
+  return result + ");\n";
+}
+
+// a function of x, whose body is body, in a translation unit which includes variable.hpp
+std::string translation_unit(std::string_view body)
+{
+  return fmt::format("#include \"variable.hpp\"\n\nint bench(int x)\n{{\n{}}}\n", body);
+}
+
+std::vector<series> all_series()
+{
+  return {
+    {"baseline", "a translation unit which includes variable.hpp and evaluates one variable", {0}, [](std::size_t)
+    {
+      return translation_unit(environment_of(1) + "  return evaluate(variable<\"v0\">(), env);\n");
+    }},
+
+    // each lookup of a distinct name instantiates environment::find for that name
+    {"find", "n bindings, each of which is looked up once", {8, 32, 64, 128}, [](std::size_t n)
+    {
+      std::string body = environment_of(n) + "  int result = 0;\n";
+      for(std::size_t i = 0; i < n; ++i)
+      {
+        body += fmt::format("  result += evaluate(variable<\"v{}\">(), env);\n", i);
+      }
+
+      return translation_unit(body + "  return result;\n");
+    }},
+
+    // references to names already looked up reuse their instantiations
+    {"references", "m references to 16 bindings", {16, 64, 256, 1024}, [](std::size_t m)
+    {
+      std::string body = environment_of(16) + "  int result = 0;\n";
+      for(std::size_t i = 0; i < m; ++i)
+      {
+        body += fmt::format("  result += evaluate(variable<\"v{}\">() * {}, env);\n", i % 16, i);
+      }
+
+      return translation_unit(body + "  return result;\n");
+    }},
+
+    // each set instantiates remove_tuple_element and tuple_cat for a new environment type
+    {"set", "n bindings, each of which is set in turn", {4, 8, 16, 32}, [](std::size_t n)
+    {
+      std::string body = environment_of(n) + "  auto env0 = env;\n";
+      for(std::size_t i = 0; i < n; ++i)
+      {
+        body += fmt::format("  auto env{} = set<\"v{}\">(env{}, x + {});\n", i + 1, i, i, i);
+      }
+
+      return translation_unit(body + fmt::format("  return get<\"v0\">(env{});\n", n));
+    }},
+
+    {"erase", "n bindings, each of which is erased in turn", {4, 8, 16, 32}, [](std::size_t n)
+    {
+      std::string body = environment_of(n + 1) + "  auto env0 = env;\n";
+      for(std::size_t i = 0; i < n; ++i)
+      {
+        body += fmt::format("  auto env{} = env{}.erase<\"v{}\">();\n", i + 1, i, i);
+      }
+
+      return translation_unit(body + fmt::format("  return get<\"v{}\">(env{});\n", n, n));
+    }},
+
+    // an op2 tree of depth d: ((v0 * v1 + v0) * v1 + v0) ...
+    {"depth", "an op2 tree of depth d over two variables", {8, 32, 64, 128}, [](std::size_t d)
+    {
+      std::string expr = "variable<\"v0\">()";
+      for(std::size_t i = 0; i < d / 2; ++i)
+      {
+        expr = fmt::format("({} * variable<\"v1\">() + variable<\"v0\">())", expr);
+      }
+
+      return translation_unit(environment_of(2) + fmt::format("  return evaluate({}, env);\n", expr));
+    }},
+  };
+}
+
+
+std::vector<std::string> split(std::string_view s)
+{
+  std::istringstream stream{std::string(s)};
+  return {std::istream_iterator<std::string>(stream), std::istream_iterator<std::string>()};
+}
+
+std::string read_file(const fs::path& path)
+{
+  std::ifstream in(path);
+  return {std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()};
+}
+
+// counts the occurrences of needle in haystack
+std::size_t count(std::string_view haystack, std::string_view needle)
+{
+  std::size_t result = 0;
+  for(std::size_t i = haystack.find(needle); i != std::string_view::npos; i = haystack.find(needle, i + needle.size()))
+  {
+    ++result;
+  }
+
+  return result;
+}
+
+// returns the wall time of the "template instantiation" line of gcc's -ftime-report
+std::optional<double> instantiation_seconds(std::string_view report)
+{
+  std::size_t line = report.find(" template instantiation");
+  if(line == std::string_view::npos) return std::nullopt;
+
+  std::size_t colon = report.find(':', line);
+  double user, system, wall;
+  if(std::sscanf(report.data() + colon + 1, " %lf ( %*d%%) %lf ( %*d%%) %lf", &user, &system, &wall) != 3) return std::nullopt;
+
+  return wall;
+}
+
+class compiler
+{
+  public:
+    compiler(std::string_view cxx, std::string_view flags, const fs::path& work_directory)
+      : cxx_{cxx},
+        flags_{split(flags)},
+        is_clang_{cxx.find("clang") != std::string_view::npos},
+        work_directory_{work_directory}
+    {}
+
+    // compiles source once, measuring the compiler's wall time and peak memory
+    measurement compile(std::string_view series, std::size_t size, const std::string& source) const
+    {
+      fs::path source_path = work_directory_ / fmt::format("{}_{}.cpp", series, size);
+      fs::path object_path = fs::path(source_path).replace_extension(".o");
+      fs::path log_path = fs::path(source_path).replace_extension(".log");
+
+      {
+        std::ofstream out(source_path);
+        out << source;
+      }
+
+      std::vector<std::string> args{cxx_, "-std=c++20"};
+      args.insert(args.end(), flags_.begin(), flags_.end());
+      args.insert(args.end(), {fmt::format("-I{}", SOURCE_DIR), is_clang_ ? "-ftime-trace" : "-ftime-report", "-c", source_path.string(), "-o", object_path.string()});
+
+      auto start = std::chrono::steady_clock::now();
+      rusage usage = run(args, log_path);
+      std::chrono::duration<double> wall = std::chrono::steady_clock::now() - start;
+
+      measurement result{series, size, wall.count(), usage.ru_maxrss, std::nullopt, std::nullopt, fs::file_size(object_path)};
+
+      if(is_clang_)
+      {
+        std::string trace = read_file(fs::path(object_path).replace_extension(".json"));
+        result.instantiations = count(trace, "\"name\":\"InstantiateClass\"") + count(trace, "\"name\":\"InstantiateFunction\"");
+      }
+      else
+      {
+        result.instantiation_seconds = instantiation_seconds(read_file(log_path));
+      }
+
+      return result;
+    }
+
+  private:
+    // runs args with its output sent to log_path, and returns the resources it and its children used
+    //
+    // throws std::runtime_error if it fails
+    static rusage run(const std::vector<std::string>& args, const fs::path& log_path)
+    {
+      std::vector<char*> argv;
+      for(const std::string& arg : args)
+      {
+        argv.push_back(const_cast<char*>(arg.c_str()));
+      }
+      argv.push_back(nullptr);
+
+      posix_spawn_file_actions_t actions;
+      posix_spawn_file_actions_init(&actions);
+      posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, log_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      posix_spawn_file_actions_adddup2(&actions, STDOUT_FILENO, STDERR_FILENO);
+
+      pid_t pid;
+      int error = posix_spawnp(&pid, argv[0], &actions, nullptr, argv.data(), environ);
+      posix_spawn_file_actions_destroy(&actions);
+      if(error != 0) throw std::system_error(error, std::generic_category(), fmt::format("compile_bench: could not run {}", args[0]));
+
+      // the usage of a child which has been waited for includes that of its own children, such as cc1plus
+      int status;
+      rusage usage;
+      while(::wait4(pid, &status, 0, &usage) < 0)
+      {
+        if(errno != EINTR) throw std::system_error(errno, std::generic_category(), "compile_bench: wait4");
+      }
+
+      if(not WIFEXITED(status) or WEXITSTATUS(status) != 0)
+      {
+        throw std::runtime_error(fmt::format("compile_bench: compilation failed; see {}", log_path.string()));
+      }
+
+      return usage;
+    }
+
+    std::string cxx_;
+    std::vector<std::string> flags_;
+    bool is_clang_;
+    fs::path work_directory_;
+};
+
+
+// the exponent k of time ~ size^k between the two largest sizes, with the baseline subtracted
+//
+// the smaller sizes are too near the baseline for their differences to be measured reliably
+std::optional<double> growth(const std::vector<measurement>& ms, double baseline)
+{
+  if(ms.size() < 2) return std::nullopt;
+
+  const measurement& smaller = ms[ms.size() - 2];
+  const measurement& larger = ms.back();
+
+  double t0 = smaller.wall_seconds - baseline;
+  double t1 = larger.wall_seconds - baseline;
+  if(t0 <= 0 or t1 <= 0) return std::nullopt;
+
+  return std::log(t1 / t0) / std::log(double(larger.size) / smaller.size);
+}
+
+template<class T>
+std::string json(const std::optional<T>& value)
+{
+  return value ? fmt::format("{}", *value) : "null";
+}
+
+int main(int argc, char** argv)
+{
+  fs::path output = "compile_bench.json";
+  int repeats = 3;
+  std::vector<std::string_view> selected;
+
+  for(int i = 1; i < argc; ++i)
+  {
+    std::string_view arg = argv[i];
+    if(arg == "-o" and i + 1 < argc) output = argv[++i];
+    else if(arg == "-r" and i + 1 < argc) repeats = std::max(1, std::atoi(argv[++i]));
+    else selected.push_back(arg);
+  }
+
+  const char* cxx = std::getenv("CXX");
+  const char* flags = std::getenv("CXXFLAGS");
+  std::string_view cxx_name = cxx ? cxx : "g++";
+  std::string_view flag_string = flags ? flags : "-O2";
+
+  char work_template[] = "/tmp/compile_bench.XXXXXX";
+  if(not ::mkdtemp(work_template)) throw std::system_error(errno, std::generic_category(), "compile_bench: mkdtemp");
+  fs::path work_directory = work_template;
+
+  compiler cc(cxx_name, flag_string, work_directory);
+
+  fmt::print("{} {}, best of {}\n\n", cxx_name, flag_string, repeats);
+  fmt::print("{:<12} {:>6} {:>10} {:>10} {:>10} {:>12} {:>10} {:>14}\n", "series", "size", "wall s", "- baseline", "peak MB", "templates s", "object KB", "instantiations");
+
+  std::vector<measurement> results;
+  double baseline = 0;
+
+  for(const series& s : all_series())
+  {
+    if(s.name != "baseline" and not selected.empty() and std::find(selected.begin(), selected.end(), s.name) == selected.end()) continue;
+
+    std::vector<measurement> ms;
+    for(std::size_t size : s.sizes)
+    {
+      std::string source = s.generate(size);
+
+      // the fastest of several compilations is the least disturbed by the rest of the machine
+      measurement best = cc.compile(s.name, size, source);
+      for(int r = 1; r < repeats; ++r)
+      {
+        measurement m = cc.compile(s.name, size, source);
+        if(m.wall_seconds < best.wall_seconds) best = m;
+      }
+
+      if(s.name == "baseline") baseline = best.wall_seconds;
+
+      fmt::print("{:<12} {:>6} {:>10.3f} {:>10.3f} {:>10.1f} {:>12} {:>10.1f} {:>14}\n",
+        best.series, best.size, best.wall_seconds, best.wall_seconds - baseline, best.peak_rss_kb / 1024.,
+        best.instantiation_seconds ? fmt::format("{:.3f}", *best.instantiation_seconds) : "-",
+        best.object_bytes / 1024.,
+        best.instantiations ? fmt::format("{}", *best.instantiations) : "-");
+      std::fflush(stdout);
+
+      ms.push_back(best);
+    }
+
+    if(auto k = growth(ms, baseline))
+    {
+      fmt::print("{:<12} grows as size^{:.2f} with {}\n", s.name, *k, s.description);
+    }
+
+    fmt::print("\n");
+    results.insert(results.end(), ms.begin(), ms.end());
+  }
+
+  auto out = fmt::output_file(output.string());
+  out.print("{{\n  \"compiler\": \"{}\",\n  \"flags\": \"{}\",\n  \"repeats\": {},\n  \"measurements\": [", cxx_name, flag_string, repeats);
+  for(std::size_t i = 0; i < results.size(); ++i)
+  {
+    const measurement& m = results[i];
+    out.print("{}\n    {{\"series\": \"{}\", \"size\": {}, \"wall_seconds\": {:.4f}, \"peak_rss_kb\": {}, \"instantiation_seconds\": {}, \"instantiations\": {}, \"object_bytes\": {}}}",
+      i == 0 ? "" : ",", m.series, m.size, m.wall_seconds, m.peak_rss_kb, json(m.instantiation_seconds), json(m.instantiations), m.object_bytes);
+  }
+  out.print("\n  ]\n}}\n");
+
+  fs::remove_all(work_directory);
+
+  return 0;
+}
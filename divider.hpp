@@ -0,0 +1,106 @@
+#pragma once
+
+#include <bit>
+#include <concepts>
+#include <cstdint>
+#include <stdexcept>
+#include <type_traits>
+
+// a divider divides by a fixed integer with a multiply and shifts instead of a division instruction
+//
+// the constants are those of Granlund and Montgomery's "Division by Invariant Integers using
+// Multiplication" (1994), Figure 4.1, which are exact for every dividend. Signed division divides
+// magnitudes and restores the sign, so results truncate toward zero exactly as the built-in / and %
+// do, including for negative operands.
+//
+// a divider converts to its divisor, so it may be bound wherever a value of type T is expected.
+template<std::integral T>
+class divider
+{
+  public:
+    using value_type = T;
+
+    constexpr divider(T divisor)
+      : divisor_{divisor}
+    {
+      if(divisor == 0) throw std::domain_error("divider: division by zero.");
+
+      unsigned_type d = magnitude(divisor);
+
+      // l = ceil(log2(d))
+      int l = std::bit_width(unsigned_type(d - 1));
+
+      // m = floor(2^N * (2^l - d) / d) + 1, where N is the width of unsigned_type
+      wide_type numerator = ((wide_type(1) << l) - d) << bits;
+      multiplier_ = unsigned_type(numerator / d + 1);
+
+      shift1_ = l < 1 ? l : 1;
+      shift2_ = l > 1 ? l - 1 : 0;
+    }
+
+    constexpr T divisor() const
+    {
+      return divisor_;
+    }
+
+    constexpr operator T() const
+    {
+      return divisor_;
+    }
+
+    friend constexpr T operator/(T n, const divider& d)
+    {
+      if constexpr (std::is_signed_v<T>)
+      {
+        // all ones when the quotient is negative
+        unsigned_type sign = unsigned_type(0) - unsigned_type((n < 0) != (d.divisor_ < 0));
+
+        unsigned_type q = d.divide(magnitude(n));
+        return T((q ^ sign) - sign);
+      }
+      else
+      {
+        return T(d.divide(n));
+      }
+    }
+
+    friend constexpr T operator%(T n, const divider& d)
+    {
+      return T(n - (n / d) * d.divisor_);
+    }
+
+    friend constexpr bool operator==(const divider& a, const divider& b)
+    {
+      return a.divisor_ == b.divisor_;
+    }
+
+  private:
+    // narrow types are divided in 32 bits, as they are promoted by the built-in operators anyway
+    using unsigned_type = std::conditional_t<(sizeof(T) <= 4), std::uint32_t, std::uint64_t>;
+    using wide_type = std::conditional_t<(sizeof(T) <= 4), std::uint64_t, unsigned __int128>;
+    constexpr static int bits = 8 * sizeof(unsigned_type);
+
+    constexpr static unsigned_type magnitude(T x)
+    {
+      if constexpr (std::is_signed_v<T>)
+      {
+        // negate in unsigned arithmetic, which is exact even for the most negative value
+        return x < 0 ? unsigned_type(0) - unsigned_type(x) : unsigned_type(x);
+      }
+      else
+      {
+        return unsigned_type(x);
+      }
+    }
+
+    constexpr unsigned_type divide(unsigned_type n) const
+    {
+      unsigned_type t = unsigned_type((wide_type(multiplier_) * n) >> bits);
+      return (t + ((n - t) >> shift1_)) >> shift2_;
+    }
+
+    T divisor_;
+    unsigned_type multiplier_;
+    int shift1_;
+    int shift2_;
+};
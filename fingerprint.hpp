@@ -0,0 +1,100 @@
+#pragma once
+
+#include <array>
+#include <bit>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <type_traits>
+
+// a fingerprint is a 64-bit FNV-1a hash of a sequence of values
+//
+// unlike std::hash, a fingerprint depends only on the values it is given, so it is the same in
+// every process, build and platform, and may be stored. numbers are hashed by value rather than by
+// representation: integers as 64-bit two's complement and floating point numbers as doubles, each
+// in little-endian byte order, so that 3 and 3L have the same fingerprint.
+class fingerprint
+{
+  public:
+    constexpr fingerprint() = default;
+
+    // a fingerprint with another offset basis and multiplier is a different hash of the same values,
+    // which need not collide where the default one does. only the basis would not do: FNV-1a with
+    // the same multiplier mixes each byte in the same way. the multiplier must be odd
+    constexpr fingerprint(std::uint64_t basis, std::uint64_t multiplier)
+      : hash_{basis},
+        multiplier_{multiplier | 1}
+    {}
+
+    // strings are prefixed with their length, so that adjacent strings hash unambiguously
+    constexpr fingerprint& add(std::string_view s)
+    {
+      add(s.size());
+      for(char c : s)
+      {
+        add(std::byte(c));
+      }
+
+      return *this;
+    }
+
+    constexpr fingerprint& add(std::byte b)
+    {
+      hash_ = (hash_ ^ std::to_integer<std::uint64_t>(b)) * multiplier_;
+      return *this;
+    }
+
+    template<std::integral T>
+    constexpr fingerprint& add(T value)
+    {
+      return add_word(std::uint64_t(value));
+    }
+
+    template<std::floating_point T>
+    constexpr fingerprint& add(T value)
+    {
+      return add_word(std::bit_cast<std::uint64_t>(double(value)));
+    }
+
+    template<class T>
+      requires std::is_enum_v<T>
+    constexpr fingerprint& add(T value)
+    {
+      return add(std::underlying_type_t<T>(value));
+    }
+
+    // other values are hashed by their object representation, so T must not have padding, and
+    // their fingerprints are only as portable as their layout
+    template<class T>
+      requires (std::has_unique_object_representations_v<T> and not std::is_scalar_v<T>)
+    constexpr fingerprint& add(const T& value)
+    {
+      auto bytes = std::bit_cast<std::array<std::byte, sizeof(T)>>(value);
+      for(std::byte b : bytes)
+      {
+        add(b);
+      }
+
+      return *this;
+    }
+
+    constexpr std::uint64_t value() const
+    {
+      return hash_;
+    }
+
+  private:
+    constexpr fingerprint& add_word(std::uint64_t word)
+    {
+      for(int i = 0; i < 8; ++i)
+      {
+        add(std::byte(word >> (8 * i)));
+      }
+
+      return *this;
+    }
+
+    std::uint64_t hash_ = 0xcbf29ce484222325;
+    std::uint64_t multiplier_ = 0x100000001b3;
+};
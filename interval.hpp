@@ -0,0 +1,232 @@
+#pragma once
+
+#include <algorithm>
+#include <concepts>
+#include <fmt/format.h>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+
+// an interval is the set of values [lo, hi] which an unknown value may take
+//
+// the arithmetic operators of intervals are conservative: the result of an operation contains the
+// result of the same operation on every pair of values within its operands. because the operators
+// of expressions call the arithmetic operators of their operands' values, evaluating an expression
+// in an environment binding its variables to intervals bounds its value everywhere in that region
+// without writing the expression again. as with the built-in operators, overflow is not checked.
+template<class T>
+struct interval
+{
+  using value_type = T;
+
+  T lo;
+  T hi;
+
+  constexpr interval(T lo, T hi)
+    : lo{lo}, hi{hi}
+  {}
+
+  // a single value, or anything which converts to one, such as a constant, is a degenerate interval
+  template<class U>
+    requires std::convertible_to<const U&, T>
+  constexpr interval(const U& value)
+    : interval{T(value), T(value)}
+  {}
+
+  constexpr bool contains(const T& value) const
+  {
+    return lo <= value and value <= hi;
+  }
+
+  friend constexpr bool operator==(const interval&, const interval&) = default;
+
+  friend constexpr interval hull(const interval& a, const interval& b)
+  {
+    return {std::min(a.lo, b.lo), std::max(a.hi, b.hi)};
+  }
+
+  friend constexpr interval operator+(const interval& a)
+  {
+    return a;
+  }
+
+  // negation reverses the order of a signed interval. an unsigned interval wraps around, so one
+  // which contains both zero and another value has every value in its hull
+  friend constexpr interval operator-(const interval& a)
+  {
+    if constexpr (std::unsigned_integral<T>)
+    {
+      if(a.lo == 0 and a.hi != 0) return {T(0), std::numeric_limits<T>::max()};
+      return {T(-a.hi), T(-a.lo)};
+    }
+    else
+    {
+      return {negate(a.hi), negate(a.lo)};
+    }
+  }
+
+  // ~x is -x - 1, so it reverses the order of its operands
+  friend constexpr interval operator~(const interval& a)
+    requires std::integral<T>
+  {
+    return {T(~a.hi), T(~a.lo)};
+  }
+
+  friend constexpr interval operator+(const interval& a, const interval& b)
+  {
+    return {a.lo + b.lo, a.hi + b.hi};
+  }
+
+  friend constexpr interval operator-(const interval& a, const interval& b)
+  {
+    return {a.lo - b.hi, a.hi - b.lo};
+  }
+
+  friend constexpr interval operator*(const interval& a, const interval& b)
+  {
+    return corners(a, b, [](T x, T y) { return T(x * y); });
+  }
+
+  // a divisor of zero is excluded from b, as dividing by it has no value to bound
+  //
+  // throws std::domain_error if b contains nothing else
+  friend constexpr interval operator/(const interval& a, const interval& b)
+  {
+    auto divide = [](T x, T y)
+    {
+      // the quotient of the least signed value and -1 does not fit, and computing it traps
+      if constexpr (std::signed_integral<T>)
+      {
+        if(x == std::numeric_limits<T>::min() and y == T(-1)) return std::numeric_limits<T>::max();
+      }
+
+      return T(x / y);
+    };
+
+    if(not b.contains(T(0))) return corners(a, b, divide);
+
+    if constexpr (std::floating_point<T>)
+    {
+      // divisors near zero make the quotient unbounded
+      return {-std::numeric_limits<T>::infinity(), std::numeric_limits<T>::infinity()};
+    }
+    else
+    {
+      if(b.lo == 0 and b.hi == 0) throw std::domain_error("interval: division by zero.");
+
+      // division is monotonic in each operand over divisors of one sign, so each part of b
+      // on either side of zero attains its extremes at its corners. b.lo is negative unless
+      // it is zero, so the negative part is only formed when -1 lies within b
+      if(b.lo == 0) return corners(a, interval{T(1), b.hi}, divide);
+
+      interval negative{b.lo, T(-1)};
+      if(b.hi == 0) return corners(a, negative, divide);
+      return hull(corners(a, negative, divide), corners(a, interval{T(1), b.hi}, divide));
+    }
+  }
+
+  // the remainder takes the sign of the dividend, is smaller in magnitude than the divisor, and is
+  // no larger in magnitude than the dividend
+  friend constexpr interval operator%(const interval& a, const interval& b)
+    requires std::integral<T>
+  {
+    if(b.lo == 0 and b.hi == 0) throw std::domain_error("interval: division by zero.");
+
+    // the largest magnitude of a nonzero divisor, less one
+    T m = std::max(magnitude_less_one(b.lo), magnitude_less_one(b.hi));
+
+    // a dividend smaller in magnitude than every divisor is its own remainder
+    if(not b.contains(T(0)))
+    {
+      T smallest = std::min(magnitude(b.lo), magnitude(b.hi));
+      if(magnitude(a.lo) < smallest and magnitude(a.hi) < smallest) return a;
+    }
+
+    T lo = a.lo < 0 ? std::max(a.lo, T(-m)) : T(0);
+    T hi = a.hi > 0 ? std::min(a.hi, m) : T(0);
+    return {lo, hi};
+  }
+
+  friend constexpr interval<bool> operator<(const interval& a, const interval& b)
+  {
+    return {a.hi < b.lo, a.lo < b.hi};
+  }
+
+  friend constexpr interval<bool> operator<=(const interval& a, const interval& b)
+  {
+    return {a.hi <= b.lo, a.lo <= b.hi};
+  }
+
+  friend constexpr interval<bool> operator>(const interval& a, const interval& b)
+  {
+    return b < a;
+  }
+
+  friend constexpr interval<bool> operator>=(const interval& a, const interval& b)
+  {
+    return b <= a;
+  }
+
+  private:
+    template<class F>
+    constexpr static interval corners(const interval& a, const interval& b, F f)
+    {
+      T values[] = {f(a.lo, b.lo), f(a.lo, b.hi), f(a.hi, b.lo), f(a.hi, b.hi)};
+      auto [lo, hi] = std::minmax_element(std::begin(values), std::end(values));
+      return {*lo, *hi};
+    }
+
+    // -x, or the greatest T when -x does not fit, so that bounds remain ordered
+    constexpr static T negate(T x)
+    {
+      if constexpr (std::signed_integral<T>)
+      {
+        if(x == std::numeric_limits<T>::min()) return std::numeric_limits<T>::max();
+      }
+
+      return T(-x);
+    }
+
+    // |x|, or the greatest T when |x| does not fit
+    constexpr static T magnitude(T x)
+    {
+      return x < 0 ? negate(x) : x;
+    }
+
+    // |x| - 1, which unlike |x| fits in T for every x but zero
+    constexpr static T magnitude_less_one(T x)
+    {
+      return x < 0 ? T(-(x + 1)) : T(x - 1);
+    }
+};
+
+template<class T>
+interval(T, T) -> interval<T>;
+
+// true when b is true for every value in its region
+constexpr bool certainly(const interval<bool>& b)
+{
+  return b.lo;
+}
+
+// true when b is true for some value in its region
+constexpr bool possibly(const interval<bool>& b)
+{
+  return b.hi;
+}
+
+template<class T>
+struct fmt::formatter<interval<T>> : fmt::formatter<T>
+{
+  template<class FormatContext>
+  auto format(const interval<T>& x, FormatContext& ctx)
+  {
+    auto out = fmt::format_to(ctx.out(), "[");
+    ctx.advance_to(out);
+    out = fmt::formatter<T>::format(x.lo, ctx);
+    out = fmt::format_to(out, ", ");
+    ctx.advance_to(out);
+    out = fmt::formatter<T>::format(x.hi, ctx);
+    return fmt::format_to(out, "]");
+  }
+};
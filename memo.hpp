@@ -0,0 +1,290 @@
+#pragma once
+
+#include "tuning_cache.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// a memo_table remembers values of type T by 128-bit key in a fixed amount of memory
+//
+// the table is divided into shards, and each shard into buckets of a few slots, each slot guarded
+// by its own sequence lock. a lookup takes no lock and writes nothing shared but a counter: it reads
+// a slot's sequence number, key and value, and retries nothing, reporting a miss if the slot changed
+// underneath it. an insert claims a slot by making its sequence number odd, so inserts into the same
+// slot never wait for one another: the one which loses simply does not store its value.
+//
+// when a bucket is full, inserting evicts one of its entries in turn.
+template<cacheable T>
+class memo_table
+{
+  public:
+    using key_type = std::array<std::uint64_t,2>;
+
+    constexpr static std::size_t ways = 4;
+
+    // capacity is rounded up so that each shard has a power of two number of buckets
+    explicit memo_table(std::size_t capacity, std::size_t num_shards = std::bit_ceil(std::max(1u, std::thread::hardware_concurrency())))
+      : num_shards_{std::bit_ceil(std::max<std::size_t>(1, num_shards))},
+        buckets_per_shard_{std::bit_ceil(std::max<std::size_t>(1, (capacity + ways * num_shards_ - 1) / (ways * num_shards_)))},
+        buckets_{new bucket[num_shards_ * buckets_per_shard_]},
+        clocks_{new shard_clock[num_shards_]},
+        counters_{new stripe_counters[num_stripes]}
+    {}
+
+    memo_table(const memo_table&) = delete;
+
+    // returns the value remembered for key, or nothing
+    std::optional<T> find(const key_type& key) const
+    {
+      const bucket& b = bucket_of(key);
+
+      for(const slot& s : b.slots)
+      {
+        std::uint64_t before = s.sequence.load(std::memory_order_acquire);
+        if(before == 0 or before % 2 == 1) continue;
+
+        key_type found{s.key[0].load(std::memory_order_relaxed), s.key[1].load(std::memory_order_relaxed)};
+        std::array<std::uint64_t, value_words> words;
+        for(std::size_t i = 0; i < value_words; ++i)
+        {
+          words[i] = s.value[i].load(std::memory_order_relaxed);
+        }
+
+        // the reads above are only valid if no insert began while they were made
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if(s.sequence.load(std::memory_order_relaxed) != before) continue;
+
+        if(found == key)
+        {
+          counters().hits.fetch_add(1, std::memory_order_relaxed);
+
+          const std::byte* in = reinterpret_cast<const std::byte*>(words.data());
+          return detail::load<T>(in);
+        }
+      }
+
+      counters().misses.fetch_add(1, std::memory_order_relaxed);
+      return std::nullopt;
+    }
+
+    // remembers value for key, unless another thread is inserting into the same slot
+    void insert(const key_type& key, const T& value)
+    {
+      std::array<std::uint64_t, value_words> words{};
+      std::byte* out = reinterpret_cast<std::byte*>(words.data());
+      detail::store(value, out);
+
+      bucket& b = bucket_of(key);
+
+      // prefer the slot already holding key, then an empty slot, then the next victim in turn
+      slot* target = nullptr;
+      for(slot& s : b.slots)
+      {
+        if(s.key[0].load(std::memory_order_relaxed) == key[0] and s.key[1].load(std::memory_order_relaxed) == key[1])
+        {
+          target = &s;
+          break;
+        }
+
+        if(not target and s.sequence.load(std::memory_order_relaxed) == 0) target = &s;
+      }
+
+      if(not target)
+      {
+        std::size_t shard = key[0] & (num_shards_ - 1);
+        target = &b.slots[clocks_[shard].hand.fetch_add(1, std::memory_order_relaxed) % ways];
+      }
+
+      std::uint64_t sequence = target->sequence.load(std::memory_order_relaxed);
+      if(sequence % 2 == 1 or not target->sequence.compare_exchange_strong(sequence, sequence + 1, std::memory_order_acquire)) return;
+      std::atomic_thread_fence(std::memory_order_release);
+
+      bool evicts = sequence != 0 and (target->key[0].load(std::memory_order_relaxed) != key[0] or target->key[1].load(std::memory_order_relaxed) != key[1]);
+
+      target->key[0].store(key[0], std::memory_order_relaxed);
+      target->key[1].store(key[1], std::memory_order_relaxed);
+      for(std::size_t i = 0; i < value_words; ++i)
+      {
+        target->value[i].store(words[i], std::memory_order_relaxed);
+      }
+
+      target->sequence.store(sequence + 2, std::memory_order_release);
+
+      if(evicts) counters().evictions.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    std::size_t capacity() const
+    {
+      return num_shards_ * buckets_per_shard_ * ways;
+    }
+
+    std::size_t num_hits() const
+    {
+      return sum(&stripe_counters::hits);
+    }
+
+    std::size_t num_misses() const
+    {
+      return sum(&stripe_counters::misses);
+    }
+
+    std::size_t num_evictions() const
+    {
+      return sum(&stripe_counters::evictions);
+    }
+
+  private:
+    constexpr static std::size_t value_words = (detail::cached_size<T>() + sizeof(std::uint64_t) - 1) / sizeof(std::uint64_t);
+
+    // sequence is 0 until the slot is first written, and odd while it is being written
+    struct slot
+    {
+      std::atomic<std::uint64_t> sequence{0};
+      std::atomic<std::uint64_t> key[2]{};
+      std::atomic<std::uint64_t> value[value_words]{};
+    };
+
+    struct alignas(64) bucket
+    {
+      std::array<slot,ways> slots;
+    };
+
+    struct alignas(64) shard_clock
+    {
+      std::atomic<std::size_t> hand{0};
+    };
+
+    // counters are striped by thread, so that counting hits does not contend
+    struct alignas(64) stripe_counters
+    {
+      std::atomic<std::size_t> hits{0};
+      std::atomic<std::size_t> misses{0};
+      std::atomic<std::size_t> evictions{0};
+    };
+
+    constexpr static std::size_t num_stripes = 64;
+
+    const bucket& bucket_of(const key_type& key) const
+    {
+      std::size_t shard = key[0] & (num_shards_ - 1);
+      std::size_t i = (key[0] >> 32) & (buckets_per_shard_ - 1);
+      return buckets_[shard * buckets_per_shard_ + i];
+    }
+
+    bucket& bucket_of(const key_type& key)
+    {
+      return const_cast<bucket&>(std::as_const(*this).bucket_of(key));
+    }
+
+    stripe_counters& counters() const
+    {
+      static std::atomic<std::size_t> next_stripe{0};
+      thread_local std::size_t stripe = next_stripe.fetch_add(1, std::memory_order_relaxed) % num_stripes;
+      return counters_[stripe];
+    }
+
+    std::size_t sum(std::atomic<std::size_t> stripe_counters::* counter) const
+    {
+      std::size_t result = 0;
+      for(std::size_t i = 0; i < num_stripes; ++i)
+      {
+        result += (counters_[i].*counter).load(std::memory_order_relaxed);
+      }
+
+      return result;
+    }
+
+    std::size_t num_shards_;
+    std::size_t buckets_per_shard_;
+    std::unique_ptr<bucket[]> buckets_;
+    std::unique_ptr<shard_clock[]> clocks_;
+    std::unique_ptr<stripe_counters[]> counters_;
+};
+
+
+// a memoized expression evaluates its expression through a memo_table
+//
+// the key of an evaluation is the fingerprint of the expression's structure, computed once, extended by
+// the values its variables are bound to, so that bindings the expression does not use do not
+// matter. the key is two fingerprints of the same structure and values by different hash functions,
+// FNV-1a with different multipliers, so that different keys collide only when both functions do.
+// memoization may be turned off, and back on, for each expression.
+//
+// expressions whose structural hash does not describe them completely, because they contain an
+// operator other than the built-in ones or a literal which cannot be fingerprinted, would share
+// keys with other expressions, and cannot be memoized.
+template<class E, class T>
+  requires (detail::is_structurally_hashable<E>())
+class memoized
+{
+  public:
+    memoized(const E& expr, memo_table<T>& table)
+      : expr_{expr},
+        table_{&table}
+    {
+      // the second function hashes the structure itself, rather than the structural hash, so that
+      // expressions whose structural hashes collide still have different keys
+      identity_[0].add(structural_hash(expr));
+      detail::add_structure(expr, identity_[1]);
+    }
+
+    memoized(const memoized& other)
+      : expr_{other.expr_},
+        table_{other.table_},
+        identity_{other.identity_},
+        enabled_{other.enabled()}
+    {}
+
+    const E& expression() const
+    {
+      return expr_;
+    }
+
+    bool enabled() const
+    {
+      return enabled_.load(std::memory_order_relaxed);
+    }
+
+    void set_enabled(bool enabled)
+    {
+      enabled_.store(enabled, std::memory_order_relaxed);
+    }
+
+    template<class Env>
+    T operator()(const Env& env) const
+    {
+      if(not enabled()) return evaluate(expr_, env);
+
+      std::array<fingerprint,2> key = identity_;
+      for_each_binding(expr_, env, [&](std::string_view, const auto& value)
+      {
+        key[0].add(value);
+        key[1].add(value);
+      });
+
+      typename memo_table<T>::key_type k{key[0].value(), key[1].value()};
+      if(auto found = table_->find(k)) return *found;
+
+      T result = evaluate(expr_, env);
+      table_->insert(k, result);
+      return result;
+    }
+
+  private:
+    E expr_;
+    memo_table<T>* table_;
+    std::array<fingerprint,2> identity_{fingerprint(), fingerprint(0x6a09e667f3bcc908, 0x9e3779b97f4a7c15)};
+    std::atomic<bool> enabled_{true};
+};
+
+template<class E, class T>
+memoized(const E&, memo_table<T>&) -> memoized<E,T>;
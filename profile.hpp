@@ -0,0 +1,314 @@
+#pragma once
+
+#include "fingerprint.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <tuple>
+#include <vector>
+
+#if defined(__x86_64__) or defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// the processor's timestamp counter, or nanoseconds where there is none
+inline std::uint64_t timestamp() noexcept
+{
+#if defined(__x86_64__) or defined(__i386__)
+  return __rdtsc();
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+
+// a profile_entry is what a profile knows about one node of one expression
+//
+// node is the node's position in a preorder walk of the expression, so node 0 describes the whole
+// expression. cycles include those of the node's operands.
+struct profile_entry
+{
+  std::uint64_t expression;
+  std::uint32_t node;
+  std::string_view label;
+  std::uint64_t calls;
+  std::uint64_t cycles;
+  std::uint64_t misses;
+  std::uint64_t mismatches;
+};
+
+
+// a profile_buffer is one thread's counts of the nodes it has evaluated
+//
+// only the thread which owns a buffer writes to it, so counting takes no lock and no atomic
+// read-modify-write; other threads may read it at any time. each node is recorded in a slot of a
+// fixed-size open-addressed table, and nodes which do not fit are counted as dropped.
+class profile_buffer
+{
+  public:
+    constexpr static std::size_t capacity = 4096;
+    constexpr static std::size_t max_label_size = 31;
+
+    enum event { miss, mismatch };
+
+    profile_buffer() = default;
+
+    profile_buffer(const profile_buffer&) = delete;
+
+    // records an evaluation of a node which took cycles
+    void record(std::uint64_t expression, std::uint32_t node, std::string_view label, std::uint64_t cycles)
+    {
+      if(slot* s = find_or_insert(expression, node, label))
+      {
+        increment(s->calls);
+        increment(s->cycles, cycles);
+      }
+    }
+
+    // records that a node's variable was not bound, or was bound to a value of the wrong type
+    void record(std::uint64_t expression, std::uint32_t node, std::string_view label, event e)
+    {
+      if(slot* s = find_or_insert(expression, node, label))
+      {
+        increment(e == miss ? s->misses : s->mismatches);
+      }
+    }
+
+    // calls f(entry) for each node recorded
+    template<class F>
+    void for_each(F&& f) const
+    {
+      for(std::size_t i = 0; i < capacity; ++i)
+      {
+        const slot& s = slots_[i];
+        if(s.key.load(std::memory_order_acquire) == 0) continue;
+
+        f(profile_entry{
+          s.expression,
+          s.node,
+          std::string_view(s.label.data()),
+          s.calls.load(std::memory_order_relaxed),
+          s.cycles.load(std::memory_order_relaxed),
+          s.misses.load(std::memory_order_relaxed),
+          s.mismatches.load(std::memory_order_relaxed)
+        });
+      }
+    }
+
+    // the number of records which were dropped because the buffer was full
+    std::uint64_t num_dropped() const
+    {
+      return num_dropped_.load(std::memory_order_relaxed);
+    }
+
+  private:
+    // key is 0 until the slot is claimed, and is stored last, so a reader which sees it sees the rest
+    struct slot
+    {
+      std::atomic<std::uint64_t> key{0};
+      std::uint64_t expression = 0;
+      std::uint32_t node = 0;
+      std::array<char, max_label_size + 1> label{};
+      std::atomic<std::uint64_t> calls{0};
+      std::atomic<std::uint64_t> cycles{0};
+      std::atomic<std::uint64_t> misses{0};
+      std::atomic<std::uint64_t> mismatches{0};
+    };
+
+    static void increment(std::atomic<std::uint64_t>& counter, std::uint64_t amount = 1)
+    {
+      counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+    }
+
+    slot* find_or_insert(std::uint64_t expression, std::uint32_t node, std::string_view label)
+    {
+      fingerprint f;
+      f.add(expression).add(node);
+      std::uint64_t key = f.value() | 1;
+
+      for(std::size_t i = 0; i < capacity; ++i)
+      {
+        slot& s = slots_[(key + i) & (capacity - 1)];
+        std::uint64_t found = s.key.load(std::memory_order_relaxed);
+
+        if(found == key and s.expression == expression and s.node == node) return &s;
+
+        if(found == 0)
+        {
+          s.expression = expression;
+          s.node = node;
+          std::size_t size = std::min(label.size(), max_label_size);
+          std::copy_n(label.data(), size, s.label.data());
+          s.label[size] = 0;
+          s.key.store(key, std::memory_order_release);
+          return &s;
+        }
+      }
+
+      increment(num_dropped_);
+      return nullptr;
+    }
+
+    std::unique_ptr<slot[]> slots_{new slot[capacity]};
+    std::atomic<std::uint64_t> num_dropped_{0};
+};
+
+
+// a profile collects the profile_buffers of every thread which records into it
+//
+// a thread registers its buffer the first time it records, which takes a lock; recording after
+// that does not. buffers outlive their threads, so the counts of threads which have exited remain.
+class profile
+{
+  public:
+    profile() = default;
+
+    profile(const profile&) = delete;
+
+    // the profile of the process, which instrumented evaluation records into by default
+    static profile& global()
+    {
+      static profile result;
+      return result;
+    }
+
+    // the calling thread's buffer
+    profile_buffer& local()
+    {
+      // remembers the buffer of the profile this thread used last, which is nearly always the only one
+      thread_local std::uint64_t owner = 0;
+      thread_local profile_buffer* buffer = nullptr;
+
+      if(owner != id_)
+      {
+        buffer = find_or_register();
+        owner = id_;
+      }
+
+      return *buffer;
+    }
+
+    // returns the counts of every thread, summed by expression and node
+    std::vector<profile_entry> snapshot() const
+    {
+      std::map<std::tuple<std::uint64_t,std::uint32_t>, profile_entry> merged;
+
+      {
+        std::lock_guard lock{mutex_};
+        for(const auto& [id, buffer] : buffers_)
+        {
+          buffer->for_each([&](const profile_entry& e)
+          {
+            auto [found, inserted] = merged.try_emplace({e.expression, e.node}, e);
+            if(not inserted)
+            {
+              found->second.calls += e.calls;
+              found->second.cycles += e.cycles;
+              found->second.misses += e.misses;
+              found->second.mismatches += e.mismatches;
+            }
+          });
+        }
+      }
+
+      std::vector<profile_entry> result;
+      for(const auto& [key, e] : merged)
+      {
+        result.push_back(e);
+      }
+
+      return result;
+    }
+
+    // the number of records dropped by every thread because its buffer was full
+    std::uint64_t num_dropped() const
+    {
+      std::lock_guard lock{mutex_};
+
+      std::uint64_t result = 0;
+      for(const auto& [id, buffer] : buffers_)
+      {
+        result += buffer->num_dropped();
+      }
+
+      return result;
+    }
+
+    // prints a table of the snapshot, with the most expensive expressions first
+    void dump(std::FILE* out = stderr) const
+    {
+      std::vector<profile_entry> entries = snapshot();
+
+      // order expressions by the cycles of their roots, and the nodes of each by position
+      std::map<std::uint64_t, std::uint64_t> expression_cycles;
+      for(const profile_entry& e : entries)
+      {
+        if(e.node == 0) expression_cycles[e.expression] = e.cycles;
+      }
+
+      std::sort(entries.begin(), entries.end(), [&](const profile_entry& a, const profile_entry& b)
+      {
+        return std::tuple(expression_cycles[b.expression], a.expression, a.node) < std::tuple(expression_cycles[a.expression], b.expression, b.node);
+      });
+
+      std::fprintf(out, "%-18s %5s %-16s %12s %14s %10s %8s %10s\n", "expression", "node", "label", "calls", "cycles", "per call", "misses", "mismatches");
+      for(const profile_entry& e : entries)
+      {
+        std::fprintf(out, "%#018" PRIx64 " %5" PRIu32 " %-16.*s %12" PRIu64 " %14" PRIu64 " %10.1f %8" PRIu64 " %10" PRIu64 "\n",
+          e.expression, e.node, int(e.label.size()), e.label.data(), e.calls, e.cycles, e.calls ? double(e.cycles) / e.calls : 0., e.misses, e.mismatches);
+      }
+
+      if(std::uint64_t dropped = num_dropped())
+      {
+        std::fprintf(out, "%" PRIu64 " records were dropped because a thread's buffer was full\n", dropped);
+      }
+    }
+
+  private:
+    profile_buffer* find_or_register()
+    {
+      std::lock_guard lock{mutex_};
+
+      // a thread is identified by the address of a thread_local, which is distinct among live
+      // threads; a new thread which reuses the address of one which has exited continues its buffer
+      thread_local char identity;
+
+      auto& buffer = buffers_[&identity];
+      if(not buffer) buffer = std::make_unique<profile_buffer>();
+      return buffer.get();
+    }
+
+    // distinguishes this profile from any other, even one later made at the same address
+    std::uint64_t id_ = []
+    {
+      static std::atomic<std::uint64_t> next_id{1};
+      return next_id.fetch_add(1, std::memory_order_relaxed);
+    }();
+
+    mutable std::mutex mutex_;
+    std::map<const void*, std::unique_ptr<profile_buffer>> buffers_;
+};
+
+
+// not_instrumented evaluates an expression exactly as evaluate(expr, env) does
+struct not_instrumented
+{
+  constexpr static bool enabled = false;
+};
+
+// instrumented evaluation records the calls and cycles of each node of an expression in a profile
+struct instrumented
+{
+  constexpr static bool enabled = true;
+
+  profile* target = &profile::global();
+};
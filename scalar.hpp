@@ -0,0 +1,283 @@
+#pragma once
+
+#include <any>
+#include <concepts>
+#include <cstddef>
+#include <new>
+#include <tuple>
+#include <type_traits>
+#include <typeinfo>
+#include <utility>
+
+// bad_scalar_cast is thrown when a scalar is read as a type other than the one it holds
+//
+// it derives from std::bad_any_cast so that code written against std::any catches it unchanged
+class bad_scalar_cast : public std::bad_any_cast
+{
+  public:
+    const char* what() const noexcept override
+    {
+      return "bad scalar cast";
+    }
+};
+
+
+// is_inline_scalar is the extension point for user types
+//
+// specializing it as std::true_type for a trivially copyable type no larger than
+// scalar::inline_size stores that type within a scalar rather than boxed in a std::any
+template<class T>
+struct is_inline_scalar : std::false_type {};
+
+
+namespace detail
+{
+
+// the types a scalar stores inline without being told to
+using builtin_scalar_types = std::tuple<
+  bool,
+  char, signed char, unsigned char,
+  short, unsigned short,
+  int, unsigned int,
+  long, unsigned long,
+  long long, unsigned long long,
+  float, double
+>;
+
+template<class T, class Tuple>
+struct index_of_type;
+
+template<class T>
+struct index_of_type<T, std::tuple<>>
+{
+  constexpr static std::size_t value = -1;
+};
+
+template<class T, class U, class... Us>
+struct index_of_type<T, std::tuple<U,Us...>>
+{
+  constexpr static std::size_t value =
+    std::same_as<T,U> ? 0 :
+    index_of_type<T, std::tuple<Us...>>::value == std::size_t(-1) ? -1 :
+    1 + index_of_type<T, std::tuple<Us...>>::value
+  ;
+};
+
+// identifies a user type stored inline without comparing std::type_info
+struct inline_scalar_type
+{
+  const std::type_info* type;
+};
+
+template<class T>
+inline constexpr inline_scalar_type inline_scalar_type_of{&typeid(T)};
+
+} // end detail
+
+
+// a scalar is a value bound by an environment
+//
+// the built-in arithmetic types, and user types opted in by is_inline_scalar, are stored inline
+// behind a one-byte tag, so that binding one never allocates and reading one back compares the tag
+// rather than std::type_info. any other type is boxed in a std::any, as before.
+class scalar
+{
+  public:
+    constexpr static std::size_t inline_size = 24;
+
+    template<class T>
+    constexpr static bool is_builtin = detail::index_of_type<T, detail::builtin_scalar_types>::value != std::size_t(-1);
+
+    template<class T>
+    constexpr static bool is_stored_inline =
+      is_builtin<T>
+      or (is_inline_scalar<T>::value and std::is_trivially_copyable_v<T> and sizeof(T) <= inline_size and alignof(T) <= alignof(std::max_align_t))
+    ;
+
+    scalar() noexcept
+      : tag_{empty}
+    {}
+
+    template<class T>
+      requires (not std::same_as<std::decay_t<T>, scalar>)
+    scalar(T&& value)
+    {
+      emplace(std::forward<T>(value));
+    }
+
+    scalar(const scalar& other)
+    {
+      copy_from(other);
+    }
+
+    scalar(scalar&& other) noexcept
+    {
+      move_from(other);
+    }
+
+    scalar& operator=(const scalar& other)
+    {
+      if(this != &other)
+      {
+        reset();
+        copy_from(other);
+      }
+
+      return *this;
+    }
+
+    scalar& operator=(scalar&& other) noexcept
+    {
+      if(this != &other)
+      {
+        reset();
+        move_from(other);
+      }
+
+      return *this;
+    }
+
+    ~scalar()
+    {
+      reset();
+    }
+
+    bool has_value() const noexcept
+    {
+      return tag_ != empty;
+    }
+
+    // the type of the held value, or typeid(void) if there is none
+    const std::type_info& type() const noexcept
+    {
+      switch(tag_)
+      {
+        case empty: return typeid(void);
+        case user: return *inline_.user_type->type;
+        case boxed: return boxed_.type();
+        default: return builtin_type(tag_ - first_builtin, std::make_index_sequence<std::tuple_size_v<detail::builtin_scalar_types>>());
+      }
+    }
+
+    // returns the held T, or nullptr if this scalar does not hold a T
+    template<class T>
+    const T* get_if() const noexcept
+    {
+      if constexpr (is_builtin<T>)
+      {
+        return tag_ == tag_of<T> ? std::launder(reinterpret_cast<const T*>(inline_.bytes)) : nullptr;
+      }
+      else if constexpr (is_stored_inline<T>)
+      {
+        return tag_ == user and inline_.user_type == &detail::inline_scalar_type_of<T> ? std::launder(reinterpret_cast<const T*>(inline_.bytes)) : nullptr;
+      }
+      else
+      {
+        return tag_ == boxed ? std::any_cast<T>(&boxed_) : nullptr;
+      }
+    }
+
+  private:
+    void copy_from(const scalar& other)
+    {
+      if(other.tag_ == boxed)
+      {
+        new(&boxed_) std::any(other.boxed_);
+      }
+      else
+      {
+        // inline values are trivially copyable
+        inline_ = other.inline_;
+      }
+
+      tag_ = other.tag_;
+    }
+
+    void move_from(scalar& other) noexcept
+    {
+      if(other.tag_ == boxed)
+      {
+        new(&boxed_) std::any(std::move(other.boxed_));
+      }
+      else
+      {
+        inline_ = other.inline_;
+      }
+
+      tag_ = other.tag_;
+    }
+
+    template<class T>
+    void emplace(T&& value)
+    {
+      using type = std::decay_t<T>;
+
+      if constexpr (is_stored_inline<type>)
+      {
+        if constexpr (is_builtin<type>)
+        {
+          tag_ = tag_of<type>;
+        }
+        else
+        {
+          tag_ = user;
+          inline_.user_type = &detail::inline_scalar_type_of<type>;
+        }
+
+        new(inline_.bytes) type(std::forward<T>(value));
+      }
+      else
+      {
+        tag_ = boxed;
+        new(&boxed_) std::any(std::forward<T>(value));
+      }
+    }
+
+    void reset() noexcept
+    {
+      if(tag_ == boxed) boxed_.~any();
+      tag_ = empty;
+    }
+
+    template<std::size_t... I>
+    static const std::type_info& builtin_type(std::size_t i, std::index_sequence<I...>) noexcept
+    {
+      constexpr const std::type_info* types[] = {&typeid(std::tuple_element_t<I, detail::builtin_scalar_types>)...};
+      return *types[i];
+    }
+
+    enum : unsigned char { empty, user, boxed, first_builtin };
+
+    template<class T>
+    constexpr static unsigned char tag_of = first_builtin + detail::index_of_type<T, detail::builtin_scalar_types>::value;
+
+    struct inline_storage
+    {
+      alignas(std::max_align_t) std::byte bytes[inline_size];
+      const detail::inline_scalar_type* user_type;
+    };
+
+    union
+    {
+      inline_storage inline_;
+      std::any boxed_;
+    };
+
+    unsigned char tag_;
+};
+
+
+// returns the T held by value, or nullptr if it does not hold a T
+template<class T>
+const T* scalar_cast(const scalar* value) noexcept
+{
+  return value->template get_if<T>();
+}
+
+// returns the T held by value, or throws bad_scalar_cast if it does not hold a T
+template<class T>
+T scalar_cast(const scalar& value)
+{
+  if(auto result = value.template get_if<T>()) return *result;
+  throw bad_scalar_cast();
+}
@@ -0,0 +1,211 @@
+#pragma once
+
+#include "unevaluated.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// a shared_environment is an environment which many threads read while another updates it
+//
+// each update builds a new version of the environment and publishes it with a single store, so a
+// batch of changes is seen all at once or not at all. a reader takes a snapshot, which holds one
+// version for as long as it lives, and evaluates against it without locking. taking a snapshot is
+// lock-free while fewer than max_readers snapshots are held, and releasing one is wait-free. updates
+// are serialized by a mutex which readers never take.
+//
+// versions are reclaimed by epoch: each update advances the epoch, and a snapshot announces the
+// epoch at which it began in a slot of its own. a version replaced at epoch e is destroyed once no
+// slot announces an epoch before e, as any snapshot which began later cannot have seen it. there are
+// max_readers slots; a snapshot taken while every slot is in use waits for one to be released.
+class shared_environment
+{
+  private:
+    struct versioned_environment
+    {
+      environment env;
+      std::uint64_t number;
+    };
+
+    // a slot holds 0 when free, and one more than the announced epoch while a snapshot holds it
+    struct alignas(64) reader_slot
+    {
+      std::atomic<std::uint64_t> epoch{0};
+    };
+
+  public:
+    // a snapshot is one version of a shared_environment
+    //
+    // a snapshot must not outlive the shared_environment it was taken from
+    class snapshot
+    {
+      public:
+        snapshot(snapshot&& other) noexcept
+          : version_{std::exchange(other.version_, nullptr)},
+            slot_{std::exchange(other.slot_, nullptr)}
+        {}
+
+        snapshot(const snapshot&) = delete;
+
+        ~snapshot()
+        {
+          if(slot_) slot_->epoch.store(0, std::memory_order_release);
+        }
+
+        const environment& operator*() const
+        {
+          return version_->env;
+        }
+
+        const environment* operator->() const
+        {
+          return &version_->env;
+        }
+
+        // the version number of this snapshot, which each update increases by one
+        std::uint64_t version() const
+        {
+          return version_->number;
+        }
+
+      private:
+        friend class shared_environment;
+
+        snapshot(const versioned_environment* v, reader_slot* slot)
+          : version_{v},
+            slot_{slot}
+        {}
+
+        const versioned_environment* version_;
+        reader_slot* slot_;
+    };
+
+    explicit shared_environment(environment initial = {}, std::size_t max_readers = 4 * std::max(1u, std::thread::hardware_concurrency()))
+      : num_slots_{std::max<std::size_t>(1, max_readers)},
+        slots_{new reader_slot[num_slots_]},
+        current_{new versioned_environment{std::move(initial), 0}}
+    {}
+
+    shared_environment(const shared_environment&) = delete;
+
+    ~shared_environment()
+    {
+      delete current_.load(std::memory_order_relaxed);
+    }
+
+    // returns the current version
+    snapshot read() const
+    {
+      // threads start their search for a free slot at different places, so that it nearly always
+      // succeeds at once
+      static std::atomic<std::size_t> next_hint{0};
+      thread_local std::size_t hint = next_hint.fetch_add(1, std::memory_order_relaxed);
+
+      for(std::size_t i = hint;; ++i)
+      {
+        reader_slot& slot = slots_[i % num_slots_];
+
+        std::uint64_t expected = 0;
+        if(slot.epoch.load(std::memory_order_relaxed) == 0 and slot.epoch.compare_exchange_strong(expected, epoch_.load(std::memory_order_acquire) + 1, std::memory_order_seq_cst))
+        {
+          // the announcement precedes the load, so an update which replaces the version loaded
+          // also sees the announcement
+          return {current_.load(std::memory_order_seq_cst), &slot};
+        }
+      }
+    }
+
+    // the number of the current version
+    //
+    // this is kept apart from the version itself, which an update may destroy once it is replaced
+    // unless a snapshot holds it
+    std::uint64_t version() const
+    {
+      return version_.load(std::memory_order_acquire);
+    }
+
+    // applies f to a copy of the current environment, and publishes the result as the next version
+    //
+    // returns the number of the new version
+    template<class F>
+    std::uint64_t update(F&& f)
+    {
+      std::lock_guard lock{writer_mutex_};
+
+      const versioned_environment* old = current_.load(std::memory_order_relaxed);
+      auto next = std::make_unique<versioned_environment>(versioned_environment{old->env, old->number + 1});
+      f(next->env);
+
+      std::uint64_t number = next->number;
+      current_.store(next.release(), std::memory_order_seq_cst);
+      version_.store(number, std::memory_order_release);
+
+      // a snapshot which announces this epoch or later began after old was replaced
+      std::uint64_t retired_at = epoch_.fetch_add(1, std::memory_order_seq_cst) + 1;
+      retired_.emplace_back(std::unique_ptr<const versioned_environment>(old), retired_at);
+
+      reclaim_locked();
+      return number;
+    }
+
+    // binds each name of changes to its value, all in one version
+    //
+    // returns the number of the new version
+    std::uint64_t assign(const environment& changes)
+    {
+      return update([&](environment& env)
+      {
+        for(const auto& [name, value] : changes)
+        {
+          env.insert_or_assign(name, value);
+        }
+      });
+    }
+
+    // the number of replaced versions which a snapshot may still hold
+    std::size_t num_retired() const
+    {
+      std::lock_guard lock{writer_mutex_};
+      return retired_.size();
+    }
+
+    // destroys the replaced versions which no snapshot holds
+    //
+    // update does this itself, so this is only needed to release versions sooner
+    void reclaim()
+    {
+      std::lock_guard lock{writer_mutex_};
+      reclaim_locked();
+    }
+
+  private:
+    void reclaim_locked()
+    {
+      // the earliest epoch announced by a snapshot
+      std::uint64_t oldest = std::uint64_t(-1);
+      for(std::size_t i = 0; i < num_slots_; ++i)
+      {
+        std::uint64_t announced = slots_[i].epoch.load(std::memory_order_seq_cst);
+        if(announced != 0) oldest = std::min(oldest, announced - 1);
+      }
+
+      std::erase_if(retired_, [&](const auto& retired)
+      {
+        return retired.second <= oldest;
+      });
+    }
+
+    std::size_t num_slots_;
+    std::unique_ptr<reader_slot[]> slots_;
+    std::atomic<const versioned_environment*> current_;
+    std::atomic<std::uint64_t> epoch_{0};
+    std::atomic<std::uint64_t> version_{0};
+
+    mutable std::mutex writer_mutex_;
+    std::vector<std::pair<std::unique_ptr<const versioned_environment>, std::uint64_t>> retired_;
+};
@@ -0,0 +1,319 @@
+#pragma once
+
+#include <algorithm>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <type_traits>
+#include "divider.hpp"
+
+#if defined(__AVX2__) or defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+// element-wise kernels used to evaluate expressions over columns of values
+//
+// kernels use AVX-512 or AVX2 when the compiler targets them and the operation maps onto
+// a single vector instruction, and fall back to a scalar loop otherwise
+
+namespace detail
+{
+
+// the number of elements evaluated at once by batch evaluation
+constexpr std::size_t chunk_size = 256;
+
+// an operand of an element-wise kernel is either a column of values or a single value broadcast
+// to every element
+template<class T>
+struct operand
+{
+  using value_type = T;
+
+  // null when value is broadcast
+  const T* column;
+  T value;
+
+  constexpr T operator[](std::size_t i) const
+  {
+    return column ? column[i] : value;
+  }
+};
+
+template<class T>
+constexpr operand<T> broadcast(const T& value)
+{
+  return {nullptr, value};
+}
+
+template<class T>
+constexpr operand<T> column(const T* data)
+{
+  return {data, T{}};
+}
+
+
+// each vector_isa describes one register type: its width and the operations it supports
+#if defined(__AVX512F__)
+
+struct avx512_i32
+{
+  using reg = __m512i;
+  constexpr static std::size_t width = 16;
+  static reg load(const void* p) { return _mm512_loadu_si512(p); }
+  static void store(void* p, reg r) { _mm512_storeu_si512(p, r); }
+  static reg broadcast(std::int32_t x) { return _mm512_set1_epi32(x); }
+  static reg add(reg a, reg b) { return _mm512_add_epi32(a, b); }
+  static reg sub(reg a, reg b) { return _mm512_sub_epi32(a, b); }
+  static reg mul(reg a, reg b) { return _mm512_mullo_epi32(a, b); }
+};
+
+struct avx512_i64
+{
+  using reg = __m512i;
+  constexpr static std::size_t width = 8;
+  static reg load(const void* p) { return _mm512_loadu_si512(p); }
+  static void store(void* p, reg r) { _mm512_storeu_si512(p, r); }
+  static reg broadcast(std::int64_t x) { return _mm512_set1_epi64(x); }
+  static reg add(reg a, reg b) { return _mm512_add_epi64(a, b); }
+  static reg sub(reg a, reg b) { return _mm512_sub_epi64(a, b); }
+#if defined(__AVX512DQ__)
+  static reg mul(reg a, reg b) { return _mm512_mullo_epi64(a, b); }
+#endif
+};
+
+struct avx512_f32
+{
+  using reg = __m512;
+  constexpr static std::size_t width = 16;
+  static reg load(const float* p) { return _mm512_loadu_ps(p); }
+  static void store(float* p, reg r) { _mm512_storeu_ps(p, r); }
+  static reg broadcast(float x) { return _mm512_set1_ps(x); }
+  static reg add(reg a, reg b) { return _mm512_add_ps(a, b); }
+  static reg sub(reg a, reg b) { return _mm512_sub_ps(a, b); }
+  static reg mul(reg a, reg b) { return _mm512_mul_ps(a, b); }
+  static reg div(reg a, reg b) { return _mm512_div_ps(a, b); }
+};
+
+struct avx512_f64
+{
+  using reg = __m512d;
+  constexpr static std::size_t width = 8;
+  static reg load(const double* p) { return _mm512_loadu_pd(p); }
+  static void store(double* p, reg r) { _mm512_storeu_pd(p, r); }
+  static reg broadcast(double x) { return _mm512_set1_pd(x); }
+  static reg add(reg a, reg b) { return _mm512_add_pd(a, b); }
+  static reg sub(reg a, reg b) { return _mm512_sub_pd(a, b); }
+  static reg mul(reg a, reg b) { return _mm512_mul_pd(a, b); }
+  static reg div(reg a, reg b) { return _mm512_div_pd(a, b); }
+};
+
+#elif defined(__AVX2__)
+
+struct avx2_i32
+{
+  using reg = __m256i;
+  constexpr static std::size_t width = 8;
+  static reg load(const void* p) { return _mm256_loadu_si256(static_cast<const reg*>(p)); }
+  static void store(void* p, reg r) { _mm256_storeu_si256(static_cast<reg*>(p), r); }
+  static reg broadcast(std::int32_t x) { return _mm256_set1_epi32(x); }
+  static reg add(reg a, reg b) { return _mm256_add_epi32(a, b); }
+  static reg sub(reg a, reg b) { return _mm256_sub_epi32(a, b); }
+  static reg mul(reg a, reg b) { return _mm256_mullo_epi32(a, b); }
+};
+
+struct avx2_i64
+{
+  using reg = __m256i;
+  constexpr static std::size_t width = 4;
+  static reg load(const void* p) { return _mm256_loadu_si256(static_cast<const reg*>(p)); }
+  static void store(void* p, reg r) { _mm256_storeu_si256(static_cast<reg*>(p), r); }
+  static reg broadcast(std::int64_t x) { return _mm256_set1_epi64x(x); }
+  static reg add(reg a, reg b) { return _mm256_add_epi64(a, b); }
+  static reg sub(reg a, reg b) { return _mm256_sub_epi64(a, b); }
+};
+
+struct avx2_f32
+{
+  using reg = __m256;
+  constexpr static std::size_t width = 8;
+  static reg load(const float* p) { return _mm256_loadu_ps(p); }
+  static void store(float* p, reg r) { _mm256_storeu_ps(p, r); }
+  static reg broadcast(float x) { return _mm256_set1_ps(x); }
+  static reg add(reg a, reg b) { return _mm256_add_ps(a, b); }
+  static reg sub(reg a, reg b) { return _mm256_sub_ps(a, b); }
+  static reg mul(reg a, reg b) { return _mm256_mul_ps(a, b); }
+  static reg div(reg a, reg b) { return _mm256_div_ps(a, b); }
+};
+
+struct avx2_f64
+{
+  using reg = __m256d;
+  constexpr static std::size_t width = 4;
+  static reg load(const double* p) { return _mm256_loadu_pd(p); }
+  static void store(double* p, reg r) { _mm256_storeu_pd(p, r); }
+  static reg broadcast(double x) { return _mm256_set1_pd(x); }
+  static reg add(reg a, reg b) { return _mm256_add_pd(a, b); }
+  static reg sub(reg a, reg b) { return _mm256_sub_pd(a, b); }
+  static reg mul(reg a, reg b) { return _mm256_mul_pd(a, b); }
+  static reg div(reg a, reg b) { return _mm256_div_pd(a, b); }
+};
+
+#endif
+
+// vector_isa_for<T> names the vector_isa for elements of type T, or void when there is none
+template<class T>
+struct vector_isa_for
+{
+  using type = void;
+};
+
+#if defined(__AVX512F__)
+template<class T> requires (std::integral<T> and sizeof(T) == 4) struct vector_isa_for<T> { using type = avx512_i32; };
+template<class T> requires (std::integral<T> and sizeof(T) == 8) struct vector_isa_for<T> { using type = avx512_i64; };
+template<> struct vector_isa_for<float> { using type = avx512_f32; };
+template<> struct vector_isa_for<double> { using type = avx512_f64; };
+#elif defined(__AVX2__)
+template<class T> requires (std::integral<T> and sizeof(T) == 4) struct vector_isa_for<T> { using type = avx2_i32; };
+template<class T> requires (std::integral<T> and sizeof(T) == 8) struct vector_isa_for<T> { using type = avx2_i64; };
+template<> struct vector_isa_for<float> { using type = avx2_f32; };
+template<> struct vector_isa_for<double> { using type = avx2_f64; };
+#endif
+
+// vector_op<V,F> applies F to two registers of V, if V has an instruction for F
+template<class V, class F>
+struct vector_op
+{
+  constexpr static bool enabled = false;
+};
+
+template<class V> requires requires(typename V::reg r) { V::add(r,r); }
+struct vector_op<V,std::plus<>>
+{
+  constexpr static bool enabled = true;
+  static auto apply(auto a, auto b) { return V::add(a, b); }
+};
+
+template<class V> requires requires(typename V::reg r) { V::sub(r,r); }
+struct vector_op<V,std::minus<>>
+{
+  constexpr static bool enabled = true;
+  static auto apply(auto a, auto b) { return V::sub(a, b); }
+};
+
+template<class V> requires requires(typename V::reg r) { V::mul(r,r); }
+struct vector_op<V,std::multiplies<>>
+{
+  constexpr static bool enabled = true;
+  static auto apply(auto a, auto b) { return V::mul(a, b); }
+};
+
+template<class V> requires requires(typename V::reg r) { V::div(r,r); }
+struct vector_op<V,std::divides<>>
+{
+  constexpr static bool enabled = true;
+  static auto apply(auto a, auto b) { return V::div(a, b); }
+};
+
+template<class T, class F>
+concept vectorizable =
+  not std::is_void_v<typename vector_isa_for<T>::type>
+  and vector_op<typename vector_isa_for<T>::type, F>::enabled
+;
+
+
+template<class F>
+concept divides_or_modulus = std::same_as<F,std::divides<>> or std::same_as<F,std::modulus<>>;
+
+
+template<class V>
+auto load_or_broadcast(const auto& x, std::size_t i)
+{
+  return x.column ? V::load(x.column + i) : V::broadcast(x.value);
+}
+
+// out[i] = f(lhs[i], rhs[i]) for i in [0, n)
+template<class F, class A, class B, class R>
+void transform(const F& f, const operand<A>& lhs, const operand<B>& rhs, R* out, std::size_t n)
+{
+  std::size_t i = 0;
+
+  if constexpr (std::same_as<A,R> and std::same_as<B,R> and std::integral<R> and divides_or_modulus<F>)
+  {
+    // dividing by a single value: compute its divider once rather than dividing n times
+    if(not rhs.column and rhs.value != 0)
+    {
+      divider<R> d{rhs.value};
+
+      if(lhs.column)
+      {
+        for(; i < n; ++i)
+        {
+          out[i] = f(lhs.column[i], d);
+        }
+      }
+      else
+      {
+        std::fill_n(out, n, f(lhs.value, d));
+        i = n;
+      }
+    }
+  }
+  else if constexpr (std::same_as<A,R> and std::same_as<B,R> and vectorizable<R,F>)
+  {
+    using V = typename vector_isa_for<R>::type;
+
+    for(; i + V::width <= n; i += V::width)
+    {
+      V::store(out + i, vector_op<V,F>::apply(load_or_broadcast<V>(lhs, i), load_or_broadcast<V>(rhs, i)));
+    }
+  }
+
+  for(; i < n; ++i)
+  {
+    out[i] = f(lhs[i], rhs[i]);
+  }
+}
+
+// out[i] = f(x[i]) for i in [0, n)
+template<class F, class A, class R>
+void transform(const F& f, const operand<A>& x, R* out, std::size_t n)
+{
+  if(x.column)
+  {
+    for(std::size_t i = 0; i < n; ++i)
+    {
+      out[i] = f(x.column[i]);
+    }
+  }
+  else
+  {
+    std::fill_n(out, n, f(x.value));
+  }
+}
+
+// out[i] = f(a[i], b[i], c[i]) for i in [0, n)
+template<class F, class A, class B, class C, class R>
+void transform(const F& f, const operand<A>& a, const operand<B>& b, const operand<C>& c, R* out, std::size_t n)
+{
+  for(std::size_t i = 0; i < n; ++i)
+  {
+    out[i] = f(a[i], b[i], c[i]);
+  }
+}
+
+// out[i] = x[i] for i in [0, n)
+template<class A, class R>
+void copy(const operand<A>& x, R* out, std::size_t n)
+{
+  if(x.column)
+  {
+    std::copy_n(x.column, n, out);
+  }
+  else
+  {
+    std::fill_n(out, n, x.value);
+  }
+}
+
+} // end detail
@@ -0,0 +1,360 @@
+#pragma once
+
+#include "thread_pool.hpp"
+#include "variable.hpp"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <concepts>
+#include <cstddef>
+#include <limits>
+#include <memory>
+#include <span>
+#include <tuple>
+#include <vector>
+
+// an axis is a named list of the values a variable takes in a parameter_space
+//
+// the bindings of an annotated axis carry its annotations, so that the space may bind variables
+// with the same annotations
+template<detail::sl n, class T = int, class... Annotations>
+struct axis
+{
+  constexpr static std::string_view name = n;
+  using value_type = T;
+  using annotations = std::tuple<Annotations...>;
+  using binding_type = binding<n,T,Annotations...>;
+  using column_binding_type = binding<n,std::span<const T>,Annotations...>;
+
+  std::vector<T> values;
+};
+
+
+// a parameter_space is the cartesian product of its axes
+//
+// points are numbered in row-major order: the last axis varies fastest
+template<class... Axes>
+class parameter_space
+{
+  public:
+    using environment_type = environment<typename Axes::binding_type...>;
+
+    constexpr parameter_space(const Axes&... axes)
+      : axes_{axes...}
+    {}
+
+    constexpr std::size_t size() const
+    {
+      return std::apply([](const auto&... axes)
+      {
+        return (std::size_t(1) * ... * axes.values.size());
+      },
+      axes_);
+    }
+
+    // returns the environment binding each axis's name to its value at point i
+    constexpr environment_type operator[](std::size_t i) const
+    {
+      std::array coordinates = this->coordinates(i);
+
+      return [&]<std::size_t... Is>(std::index_sequence<Is...>)
+      {
+        return environment_type{typename Axes::binding_type{std::get<Is>(axes_).values[coordinates[Is]]}...};
+      }(std::index_sequence_for<Axes...>{});
+    }
+
+    // returns the index of point i's value along each axis
+    constexpr std::array<std::size_t, sizeof...(Axes)> coordinates(std::size_t i) const
+    {
+      std::array<std::size_t, sizeof...(Axes)> result{};
+
+      [&]<std::size_t... Is>(std::index_sequence<Is...>)
+      {
+        // peel coordinates off i beginning with the last axis
+        ((result[sizeof...(Axes) - 1 - Is] = i % std::get<sizeof...(Axes) - 1 - Is>(axes_).values.size(),
+          i /= std::get<sizeof...(Axes) - 1 - Is>(axes_).values.size()), ...);
+      }(std::index_sequence_for<Axes...>{});
+
+      return result;
+    }
+
+    // returns the number of the point whose index along each axis is given by coordinates
+    constexpr std::size_t point(const std::array<std::size_t, sizeof...(Axes)>& coordinates) const
+    {
+      std::size_t result = 0;
+      for(std::size_t k = 0; k < sizeof...(Axes); ++k)
+      {
+        result = result * axis_size(k) + coordinates[k];
+      }
+
+      return result;
+    }
+
+    constexpr const std::tuple<Axes...>& axes() const
+    {
+      return axes_;
+    }
+
+    // writes the values of points [first, first + n) along each axis to columns
+    void fill(std::size_t first, std::size_t n, std::tuple<std::vector<typename Axes::value_type>...>& columns) const
+    {
+      std::array coordinates = this->coordinates(first);
+
+      [&]<std::size_t... Is>(std::index_sequence<Is...>)
+      {
+        for(std::size_t j = 0; j < n; ++j)
+        {
+          ((std::get<Is>(columns)[j] = std::get<Is>(axes_).values[coordinates[Is]]), ...);
+
+          // advance coordinates like an odometer
+          for(std::size_t k = sizeof...(Axes); k-- > 0;)
+          {
+            if(++coordinates[k] < axis_size(k)) break;
+            coordinates[k] = 0;
+          }
+        }
+      }(std::index_sequence_for<Axes...>{});
+    }
+
+  private:
+    constexpr std::size_t axis_size(std::size_t k) const
+    {
+      std::array sizes = std::apply([](const auto&... axes)
+      {
+        return std::array<std::size_t, sizeof...(Axes)>{axes.values.size()...};
+      },
+      axes_);
+
+      return sizes[k];
+    }
+
+    std::tuple<Axes...> axes_;
+};
+
+
+// a reduction combines the values of an expression over the points of a parameter_space
+//
+// each participant in a sweep accumulates the values of the points it evaluates into its own
+// accumulator, beginning from identity. accumulators are combined at the end of the sweep.
+template<class R, class T>
+concept reduction = requires(const R& r, std::span<const T> values, std::size_t first_point)
+{
+  r.template identity<T>();
+  r.accumulate(std::declval<decltype(r.template identity<T>())&>(), first_point, values);
+  r.combine(std::declval<decltype(r.template identity<T>())&>(), r.template identity<T>());
+};
+
+// the smallest value of an expression
+struct minimum
+{
+  template<class T>
+  constexpr T identity() const
+  {
+    return std::numeric_limits<T>::max();
+  }
+
+  template<class T>
+  constexpr void accumulate(T& result, std::size_t, std::span<const T> values) const
+  {
+    for(const T& value : values)
+    {
+      result = std::min(result, value);
+    }
+  }
+
+  template<class T>
+  constexpr void combine(T& result, const T& other) const
+  {
+    result = std::min(result, other);
+  }
+};
+
+// the smallest value of an expression, and the first point at which it occurs
+struct argmin
+{
+  template<class T>
+  struct result_type
+  {
+    T value;
+    std::size_t point;
+  };
+
+  template<class T>
+  constexpr result_type<T> identity() const
+  {
+    return {std::numeric_limits<T>::max(), std::numeric_limits<std::size_t>::max()};
+  }
+
+  template<class T>
+  constexpr void accumulate(result_type<T>& result, std::size_t first_point, std::span<const T> values) const
+  {
+    for(std::size_t i = 0; i < values.size(); ++i)
+    {
+      combine(result, result_type<T>{values[i], first_point + i});
+    }
+  }
+
+  template<class T>
+  constexpr void combine(result_type<T>& result, const result_type<T>& other) const
+  {
+    if(other.value < result.value or (other.value == result.value and other.point < result.point))
+    {
+      result = other;
+    }
+  }
+};
+
+// the number of values of an expression in each of bins equal divisions of [lo, hi)
+//
+// values below lo are counted in the first bin and values at or above hi in the last. a NaN value
+// is not counted in any bin
+struct histogram
+{
+  double lo;
+  double hi;
+  std::size_t bins;
+
+  template<class T>
+  std::vector<std::size_t> identity() const
+  {
+    return std::vector<std::size_t>(bins);
+  }
+
+  template<class T>
+  void accumulate(std::vector<std::size_t>& counts, std::size_t, std::span<const T> values) const
+  {
+    double scale = bins / (hi - lo);
+
+    for(const T& value : values)
+    {
+      double bin = (value - lo) * scale;
+      if(std::isnan(bin)) continue;
+
+      // compared as doubles, so that a value too large for std::size_t is not converted to one
+      ++counts[bin < 0 ? 0 : bin < bins - 1 ? std::size_t(bin) : bins - 1];
+    }
+  }
+
+  void combine(std::vector<std::size_t>& counts, const std::vector<std::size_t>& other) const
+  {
+    std::transform(counts.begin(), counts.end(), other.begin(), counts.begin(), std::plus());
+  }
+};
+
+
+namespace detail
+{
+
+// the state kept by each participant in a sweep
+template<class T, class... Axes>
+struct alignas(64) sweep_workspace
+{
+  std::tuple<std::vector<typename Axes::value_type>...> columns{std::vector<typename Axes::value_type>(chunk_size)...};
+  // not a std::vector, so that bool values are contiguous as well
+  std::unique_ptr<T[]> values = std::make_unique<T[]>(chunk_size);
+};
+
+// returns an environment binding each axis's name to the first n values of its column
+template<class... Axes>
+auto column_environment(const parameter_space<Axes...>&, const std::tuple<std::vector<typename Axes::value_type>...>& columns, std::size_t n)
+{
+  return [&]<std::size_t... Is>(std::index_sequence<Is...>)
+  {
+    return environment{typename Axes::column_binding_type{std::span<const typename Axes::value_type>(std::get<Is>(columns).data(), n)}...};
+  }(std::index_sequence_for<Axes...>{});
+}
+
+// evaluates expr over points [first, first + n) of space, writing the results to out
+template<class E, class... Axes, class T>
+void sweep_chunk(const E& expr, const parameter_space<Axes...>& space, std::size_t first, sweep_workspace<T,Axes...>& workspace, std::span<T> out)
+{
+  space.fill(first, out.size(), workspace.columns);
+  evaluate_batch(expr, column_environment(space, workspace.columns, out.size()), out);
+}
+
+template<class E, class... Axes>
+using sweep_value_t = decltype(evaluate(std::declval<E>(), std::declval<typename parameter_space<Axes...>::environment_type>()));
+
+// evaluates expr at each point of space in parallel, writing the results to out in point order
+template<class E, class... Axes, class T>
+void sweep_into(const E& expr, const parameter_space<Axes...>& space, std::span<T> out, thread_pool& pool)
+{
+  std::vector<sweep_workspace<T,Axes...>> workspaces(pool.size());
+
+  std::size_t num_chunks = (out.size() + chunk_size - 1) / chunk_size;
+
+  pool.for_each(num_chunks, [&](std::size_t participant, std::size_t chunk)
+  {
+    std::size_t first = chunk * chunk_size;
+    std::size_t n = std::min(chunk_size, out.size() - first);
+
+    sweep_chunk(expr, space, first, workspaces[participant], out.subspan(first, n));
+  });
+}
+
+} // end detail
+
+
+// evaluates expr at each point of space in parallel, returning the results in point order
+template<unevaluated E, class... Axes>
+std::vector<detail::sweep_value_t<E,Axes...>> sweep(const E& expr, const parameter_space<Axes...>& space, thread_pool& pool = thread_pool::default_pool())
+{
+  using T = detail::sweep_value_t<E,Axes...>;
+
+  if constexpr (std::same_as<T,bool>)
+  {
+    // std::vector<bool> has no contiguous storage to write to, so its values are copied from a buffer
+    std::unique_ptr<bool[]> values = std::make_unique<bool[]>(space.size());
+    detail::sweep_into(expr, space, std::span(values.get(), space.size()), pool);
+    return std::vector<bool>(values.get(), values.get() + space.size());
+  }
+  else
+  {
+    std::vector<T> result(space.size());
+    detail::sweep_into(expr, space, std::span(result), pool);
+    return result;
+  }
+}
+
+// reduces the values of expr at each point of space with r, in parallel
+template<unevaluated E, class... Axes, reduction<detail::sweep_value_t<E,Axes...>> R>
+auto sweep(const E& expr, const parameter_space<Axes...>& space, const R& r, thread_pool& pool = thread_pool::default_pool())
+{
+  using T = detail::sweep_value_t<E,Axes...>;
+  using accumulator_type = decltype(r.template identity<T>());
+
+  struct alignas(64) participant_state
+  {
+    detail::sweep_workspace<T,Axes...> workspace;
+    accumulator_type accumulator;
+  };
+
+  std::vector<participant_state> states;
+  states.reserve(pool.size());
+  for(std::size_t i = 0; i < pool.size(); ++i)
+  {
+    states.push_back({{}, r.template identity<T>()});
+  }
+
+  std::size_t size = space.size();
+  std::size_t num_chunks = (size + detail::chunk_size - 1) / detail::chunk_size;
+
+  pool.for_each(num_chunks, [&](std::size_t participant, std::size_t chunk)
+  {
+    auto& state = states[participant];
+
+    std::size_t first = chunk * detail::chunk_size;
+    std::span values(state.workspace.values.get(), std::min(detail::chunk_size, size - first));
+
+    detail::sweep_chunk(expr, space, first, state.workspace, values);
+    r.accumulate(state.accumulator, first, std::span<const T>(values));
+  });
+
+  accumulator_type result = std::move(states[0].accumulator);
+  for(std::size_t i = 1; i < states.size(); ++i)
+  {
+    r.combine(result, states[i].accumulator);
+  }
+
+  return result;
+}
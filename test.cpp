@@ -1,7 +1,16 @@
+#include "sweep.hpp"
+#include "tune.hpp"
 #include "variable.hpp"
 #include <cassert>
+#include <cmath>
+#include <filesystem>
 #include <fmt/core.h>
 #include <iostream>
+#include <numeric>
+#include <span>
+#include <thread>
+#include <vector>
+#include <unistd.h>
 
 template<class N, class D>
 constexpr auto ceil_div(N n, D d)
@@ -9,6 +18,30 @@ constexpr auto ceil_div(N n, D d)
   return (n + d - 1) / d;
 }
 
+// counts the number of times it is called
+struct count_calls
+{
+  int* calls;
+
+  constexpr int operator()(int x) const
+  {
+    ++*calls;
+    return x;
+  }
+
+  bool operator==(const count_calls&) const = default;
+};
+
+// a user rewrite rule: -(-x) is x
+template<class E>
+struct rewrite_rule<op1<op1<E,std::negate<>>,std::negate<>>>
+{
+  constexpr static E apply(const op1<op1<E,std::negate<>>,std::negate<>>& expr)
+  {
+    return expr.expr.expr;
+  }
+};
+
 int main()
 {
   using namespace fmt;
@@ -156,6 +189,801 @@ int main()
       assert("((12345+block_size)-1)/block_size" == format("{}", expr));
       assert(((12345+128-1)/128) == evaluate(expr, new_env));
     }
+
+    {
+      // constants are folded together as expressions are built
+      auto expr = ((foo + 7_c) - 10_c) * 3_c * 2_c;
+      assert("(foo+-3)*6" == format("{}", expr));
+      assert(((13 + 7 - 10) * 3 * 2) == evaluate(expr, env));
+
+      auto flipped = (7_c - foo) + 10_c;
+      assert("17-foo" == format("{}", flipped));
+      assert((7 - 13 + 10) == evaluate(flipped, env));
+
+      // the value of a constant is part of its type, so identities cost nothing
+      static_assert(std::same_as<decltype(foo), decltype(foo * 1_c)>);
+      static_assert(std::same_as<decltype(foo), decltype(0_c + foo)>);
+      static_assert(std::same_as<decltype(foo), decltype(foo / 1_c - 0_c)>);
+      static_assert(std::same_as<decltype(foo), decltype((foo + 2_c) - 2_c)>);
+      static_assert(std::same_as<decltype(foo + 5_c), decltype((foo + 2_c) + 3_c)>);
+      assert("foo*1" == format("{}", foo * 1));
+      assert("1-foo" == format("{}", 1_c - foo));
+
+      // constants may be spelled in any base an integer literal may
+      static_assert(std::same_as<constant<16>, decltype(0x10_c)>);
+      static_assert(std::same_as<constant<8>, decltype(010_c)>);
+      static_assert(std::same_as<constant<3>, decltype(0b11_c)>);
+      static_assert(std::same_as<constant<1000>, decltype(1'000_c)>);
+      static_assert(std::same_as<constant<0xffffffffu>, decltype(0xffffffff_c)>);
+      static_assert(std::same_as<constant<4294967295l>, decltype(4294967295_c)>);
+
+      // literals of different types are not reassociated
+      assert("(foo+1)-2.5" == format("{}", (foo + 1) - 2.5));
+
+      // signed literals whose values are not part of their types cannot be checked for overflow
+      // as the expression is built, so they are not reassociated
+      assert("(foo+7)-10" == format("{}", (foo + 7) - 10));
+
+      // nor are constants whose folded value would overflow
+      assert("(foo+2147483647)--1" == format("{}", (foo + constant<std::numeric_limits<int>::max()>()) - constant<-1>()));
+
+      // unsigned literals are folded modulo 2^N, which reassociates them exactly
+      variable<"n", unsigned> n;
+      auto wrapped = (n + 1u) - 2u;
+      assert("n+4294967295" == format("{}", wrapped));
+      assert(12u == evaluate(wrapped, environment(binding<"n", unsigned>{13})));
+    }
+  }
+
+  {
+    std::vector<int> n(1000);
+    std::vector<int> block_size(n.size());
+    std::iota(n.begin(), n.end(), 12000);
+    for(std::size_t i = 0; i < block_size.size(); ++i) block_size[i] = 32 << (i % 6);
+
+    environment env(binding<"n", std::span<const int>>{n}, binding<"block_size", std::span<const int>>{block_size});
+
+    auto expr = -ceil_div(variable<"n">(), variable<"block_size">()) * 2;
+
+    std::vector<int> result(n.size());
+    evaluate_batch(expr, env, std::span(result));
+
+    for(std::size_t i = 0; i < result.size(); ++i)
+    {
+      assert(-((n[i] + block_size[i] - 1) / block_size[i]) * 2 == result[i]);
+    }
+
+    // a binding may also be a single value shared by every element
+    auto shared = set<"block_size">(env, 128);
+    evaluate_batch(expr, shared, std::span(result));
+
+    for(std::size_t i = 0; i < result.size(); ++i)
+    {
+      assert(-((n[i] + 128 - 1) / 128) * 2 == result[i]);
+    }
+
+    std::vector<double> x(n.begin(), n.end());
+    std::vector<double> y(n.size());
+    evaluate_batch(variable<"x", double>() * 0.5 + 1.0, environment(binding<"x", std::span<const double>>{x}), std::span(y));
+
+    for(std::size_t i = 0; i < y.size(); ++i)
+    {
+      assert(x[i] * 0.5 + 1.0 == y[i]);
+    }
+  }
+
+  {
+    axis<"tile"> tiles{std::vector<int>(100)};
+    std::iota(tiles.values.begin(), tiles.values.end(), 1);
+
+    parameter_space space(
+      axis<"block_size">{{32, 64, 128, 256, 512, 1024}},
+      axis<"items_per_thread">{{1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16}},
+      tiles
+    );
+
+    variable<"block_size"> block_size;
+    variable<"items_per_thread"> items_per_thread;
+    variable<"tile"> tile;
+
+    // the number of blocks plus a penalty for tiles which do not evenly divide the work
+    auto cost = ceil_div(1 << 20, block_size * items_per_thread) + (1000 % tile) * 7;
+
+    thread_pool pool(4);
+
+    std::vector<int> costs = sweep(cost, space, pool);
+    assert(space.size() == costs.size());
+
+    for(std::size_t i = 0; i < space.size(); ++i)
+    {
+      assert(evaluate(cost, space[i]) == costs[i]);
+    }
+
+    auto best = sweep(cost, space, argmin(), pool);
+    assert(*std::min_element(costs.begin(), costs.end()) == best.value);
+    assert(std::size_t(std::min_element(costs.begin(), costs.end()) - costs.begin()) == best.point);
+    assert(best.value == evaluate(cost, space[best.point]));
+
+    assert(best.value == sweep(cost, space, minimum(), pool));
+
+    std::vector<std::size_t> counts = sweep(cost, space, histogram{0, 1000, 10}, pool);
+    assert(space.size() == std::accumulate(counts.begin(), counts.end(), std::size_t(0)));
+
+    // a bool expression is swept into a std::vector<bool>
+    std::vector<bool> fits = sweep(tile * 4 <= block_size, space, pool);
+    assert(space.size() == fits.size());
+    for(std::size_t i = 0; i < space.size(); ++i)
+    {
+      assert(evaluate(tile * 4 <= block_size, space[i]) == fits[i]);
+    }
+
+    // NaN is counted in no bin, and infinities in the first and last
+    histogram h{0, 10, 5};
+    std::vector<double> samples{-1, 3, NAN, INFINITY, -INFINITY, 9.5};
+    std::vector<std::size_t> sample_counts = h.identity<double>();
+    h.accumulate(sample_counts, 0, std::span<const double>(samples));
+    assert((std::vector<std::size_t>{2, 1, 0, 0, 2}) == sample_counts);
+  }
+
+  {
+    environment env(binding<"m">{0}, binding<"c">{1}, binding<"x">{2}, binding<"a">{3}, binding<"q">{4}, binding<"b">{5}, binding<"z">{6});
+
+    static_assert(env.contains<"a">());
+    static_assert(env.contains<"z">());
+    static_assert(not env.contains<"n">());
+    static_assert(not env.contains<"">());
+
+    assert(0 == get<"m">(env));
+    assert(3 == get<"a">(env));
+    assert(6 == get<"z">(env));
+    assert(5 == get<"b">(set<"b">(env, 5)));
+    assert(7 == get<"q">(set<"q">(env, 7)));
+    static_assert(not decltype(env.erase<"x">())::contains<"x">());
+
+    // of several bindings of the same name, the first is found
+    environment duplicates(
+      binding<"b">{0}, binding<"a">{1}, binding<"b">{2}, binding<"a">{3}, binding<"b">{4}, binding<"a">{5},
+      binding<"b">{6}, binding<"a">{7}, binding<"b">{8}, binding<"a">{9}, binding<"b">{10}, binding<"a">{11},
+      binding<"b">{12}, binding<"a">{13}, binding<"b">{14}, binding<"a">{15}, binding<"b">{16}, binding<"a">{17},
+      binding<"b">{18}, binding<"a">{19}
+    );
+
+    assert(1 == get<"a">(duplicates));
+    assert(0 == get<"b">(duplicates));
+  }
+
+  {
+    variable<"block_size"> block_size;
+    environment env(binding<"block_size">{128}, binding<"n">{12345});
+
+    auto num_blocks = ceil_div(variable<"n">(), block_size);
+    std::tuple shape(num_blocks, block_size, num_blocks * 4);
+
+    assert(std::tuple((12345 + 127) / 128, 128, (12345 + 127) / 128 * 4) == evaluate(shape, env));
+    assert(evaluate(shape, env) == evaluate(common_subexpressions(shape), env));
+
+    // each distinct subexpression is computed once per evaluation
+    int calls = 0;
+    op1<decltype(num_blocks), count_calls> counted{num_blocks, {&calls}};
+
+    evaluate(std::tuple(counted, counted + 1, 2 * counted), env);
+    assert(3 == calls);
+
+    calls = 0;
+    auto shared = evaluate(common_subexpressions(counted, counted + 1, 2 * counted), env);
+    assert(1 == calls);
+    assert(std::tuple(97, 98, 194) == shared);
+
+    // subexpressions of the same type are compared by value
+    calls = 0;
+    op1<decltype(num_blocks), count_calls> other{(variable<"n">() + block_size - 1000) / block_size, {&calls}};
+    assert(std::tuple(97, 89) == evaluate(common_subexpressions(counted, other), env));
+    assert(2 == calls);
+
+    // subexpressions of variables and constants are identified by their type alone
+    constexpr auto sum = variable<"n">() + 1_c;
+    static_assert(::detail::is_identified_by_type<decltype(variable<"n">() + 1_c)>());
+    static_assert(not ::detail::is_identified_by_type<decltype(variable<"n">() + 1)>());
+    static_assert(std::tuple(5, 10) == evaluate(common_subexpressions(sum, sum * 2_c), environment(binding<"n">{4})));
+  }
+
+  {
+    // dividing by a divider agrees with the built-in operators, including for negative operands
+    for(long d : {1L, -1L, 3L, -7L, 128L, 1000L, std::numeric_limits<long>::max(), std::numeric_limits<long>::min()})
+    {
+      divider<long> divisor{d};
+
+      for(long n : {0L, 1L, -1L, 12345L, -12345L, std::numeric_limits<long>::max(), std::numeric_limits<long>::min() + 1})
+      {
+        assert(n / d == n / divisor);
+        assert(n % d == n % divisor);
+      }
+    }
+
+    static_assert(12345u / divider<unsigned>{128} == 12345u / 128);
+
+    // a variable bound to a divider divides by multiplication
+    variable<"block_size"> block_size;
+    auto expr = ceil_div(variable<"n">(), block_size) + variable<"n">() % block_size;
+
+    environment env(binding<"block_size", divider<int>>{128}, binding<"n">{12345});
+    assert(ceil_div(12345, 128) + 12345 % 128 == evaluate(expr, env));
+
+    // dividing a column by a single value computes its divider once per chunk
+    std::vector<int> n(1000);
+    std::iota(n.begin(), n.end(), -500);
+
+    std::vector<int> result(n.size());
+    evaluate_batch(expr, environment(binding<"block_size">{-7}, binding<"n", std::span<const int>>{n}), std::span(result));
+
+    for(std::size_t i = 0; i < result.size(); ++i)
+    {
+      assert(ceil_div(n[i], -7) + n[i] % -7 == result[i]);
+    }
+  }
+
+  {
+    // binding only n leaves a residual which depends on block_size alone
+    variable<"block_size"> block_size;
+    auto expr = ceil_div(variable<"n">(), block_size);
+
+    auto specialized = partially_evaluate(expr, environment(binding<"n">{12345}));
+
+    // n is replaced by its value
+    static_assert(std::same_as<op2<op2<op2<int,decltype(block_size),std::plus<>>,int,std::minus<>>, decltype(block_size), std::divides<>>, decltype(specialized)>);
+    assert(12345 == specialized.lhs.lhs.lhs);
+    assert(97 == evaluate(specialized, environment(binding<"block_size">{128})));
+
+    // binding every variable folds the expression to its value
+    assert(97 == partially_evaluate(expr, environment(binding<"n">{12345}, binding<"block_size">{128})));
+
+    // binding none of them leaves the expression unchanged
+    static_assert(std::same_as<decltype(expr), decltype(partially_evaluate(expr, environment(binding<"m">{0})))>);
+  }
+
+  {
+    // changing one binding recomputes only the subexpressions which depend on it
+    variable<"block_size"> block_size;
+    variable<"m"> m;
+
+    environment env(binding<"block_size">{128}, binding<"n">{12345}, binding<"m">{100});
+    evaluation_session session(env, ceil_div(variable<"n">(), block_size), m * 2 + 1);
+
+    assert(std::tuple(97, 201) == evaluate(session));
+    assert(5 == session.num_recomputed());
+    assert(0 == session.num_reused());
+
+    // the first expression is reused whole, from its root
+    session.set<"m">(50);
+    assert(std::tuple(97, 101) == evaluate(session));
+    assert(7 == session.num_recomputed());
+    assert(1 == session.num_reused());
+
+    session.set<"block_size">(256);
+    assert(std::tuple(49, 101) == evaluate(session));
+    assert(10 == session.num_recomputed());
+    assert(2 == session.num_reused());
+  }
+
+  {
+    variable<"n"> n;
+    variable<"block_size"> block_size;
+
+    // evaluating an expression over intervals bounds its value at every point within them
+    environment region(binding<"n",interval<int>>{{1000, 2000}}, binding<"block_size",interval<int>>{{-64, 128}});
+    assert(interval(1000 - 128, 2000 + 64) == evaluate(n - block_size, region));
+    assert(interval(-64 * 2000, 128 * 2000) == evaluate(n * block_size, region));
+    assert(interval(-2000, 2000) == evaluate(n / block_size, region));
+    assert(interval(0, 127) == evaluate(n % block_size, region));
+    assert(interval(-128, 64) == evaluate(-block_size, region));
+    assert(interval(~128, ~-64) == evaluate(~block_size, region));
+    assert(interval(1127 / 128, 2127 / 128) == evaluate(ceil_div(n, 128), region));
+    assert(interval(1000 % 3000, 2000 % 3000) == evaluate(n % 3000, region));
+
+    // negating an unsigned interval which contains zero wraps around to every value
+    assert(interval<unsigned>(0, std::numeric_limits<unsigned>::max()) == -interval<unsigned>(0, 2));
+    assert(interval<unsigned>(-2u, -1u) == -interval<unsigned>(1, 2));
+    assert(interval<unsigned>(0, 0) == -interval<unsigned>(0, 0));
+
+    // neither the least int divided by -1, nor its magnitude, fits in an int, so bounds involving
+    // them are the greatest int
+    constexpr int least = std::numeric_limits<int>::min();
+    constexpr int greatest = std::numeric_limits<int>::max();
+    assert(interval(0, greatest) == -interval(least, 0));
+    assert(interval(least, greatest) == interval(least, 0) / interval(-1, 1));
+    assert(interval(0, greatest) == interval(least, 0) / interval(-1, -1));
+    assert(interval(least + 1, 0) == interval(least, 0) % interval(least, least));
+    assert(interval(least + 1, greatest) == interval(least, greatest) % interval(least, -1));
+
+    // comparisons are certain only when they hold, or fail, everywhere
+    assert(certainly(evaluate(block_size < n, region)));
+    assert(possibly(evaluate(block_size < 0_c, region)) and not certainly(evaluate(block_size < 0_c, region)));
+    assert(not possibly(evaluate(n <= 999, region)));
+
+    // every point's value lies within the bound
+    for(int x = 1000; x <= 2000; x += 37)
+    {
+      for(int y = -64; y <= 128; ++y)
+      {
+        if(y == 0) continue;
+        environment point(binding<"n">{x}, binding<"block_size">{y});
+        auto expr = (n + 3) % block_size - ceil_div(n, block_size) * -block_size;
+        assert(evaluate(expr, region).contains(evaluate(expr, point)));
+      }
+    }
+  }
+
+  {
+    variable<"block_size"> block_size;
+    variable<"tile"> tile;
+
+    parameter_space space(powers_of_two<"block_size">(1, 1024), range<"tile">(0, 65));
+    assert(11 * 65 == space.size());
+
+    // tile == 0 would divide by zero, so the constraints must be checked before the cost is evaluated
+    auto cost = ceil_div(12345, block_size) * (block_size + tile * 3) + (block_size % tile) * 100;
+    std::tuple constraints(0 < tile, tile * 4 <= block_size, block_size * tile <= 4096);
+
+    thread_pool pool(4);
+
+    // check the result against every point
+    std::optional<int> expected;
+    for(std::size_t i = 0; i < space.size(); ++i)
+    {
+      auto env = space[i];
+      if(std::apply([&](const auto&... c) { return (evaluate(c, env) and ...); }, constraints))
+      {
+        int c = evaluate(cost, env);
+        if(not expected or c < *expected) expected = c;
+      }
+    }
+
+    auto exhaustive_result = tune(cost, constraints, space, exhaustive(), pool);
+    assert(expected == exhaustive_result.cost);
+    assert(expected == evaluate(cost, *exhaustive_result.best));
+    assert(space.size() == exhaustive_result.num_evaluated);
+
+    // pruning abandons a block_size as soon as it is too small for any tile
+    auto pruned_result = tune(cost, constraints, space, pruned(), pool);
+    assert(expected == pruned_result.cost);
+    assert(pruned_result.num_evaluated < space.size());
+
+    // bounding the cost over regions of the space abandons most block_sizes without visiting a tile
+    auto bounded_result = tune(cost, constraints, space, bounded(), pool);
+    assert(expected == bounded_result.cost);
+    assert(bounded_result.num_evaluated < pruned_result.num_evaluated);
+
+    auto random_result = tune(cost, constraints, space, random_restart{64, 7}, pool);
+    assert(random_result.best);
+    assert(*expected <= random_result.cost);
+    assert(random_result.cost == evaluate(cost, *random_result.best));
+
+    // the same seed finds the same point
+    auto again = tune(cost, constraints, space, random_restart{64, 7}, pool);
+    assert(get<"block_size">(*random_result.best) == get<"block_size">(*again.best));
+    assert(get<"tile">(*random_result.best) == get<"tile">(*again.best));
+
+    // no point satisfies contradictory constraints
+    assert(not tune(cost, std::tuple(block_size < 0), space).best);
+    assert(not tune(cost, std::tuple(block_size < 0), space, pruned()).best);
+    assert(not tune(cost, std::tuple(block_size < 0), space, bounded()).best);
+
+    // comparisons format like the other operations
+    assert("(tile*4)<=block_size" == fmt::format("{}", std::get<1>(constraints)));
+
+    // an axis binds variables with the annotations it carries, as powers_of_two carries pow2
+    {
+      variable<"block_size", int, pow2> annotated_block_size;
+      variable<"tile", int, in_range<0,64>> annotated_tile;
+      parameter_space annotated_space(powers_of_two<"block_size">(1, 1024), range<"tile", int, in_range<0,64>>(0, 65));
+
+      auto annotated_cost = ceil_div(12345, annotated_block_size) * (annotated_block_size + annotated_tile * 3) + (annotated_block_size % annotated_tile) * 100;
+      std::tuple annotated_constraints(0 < annotated_tile, annotated_tile * 4 <= annotated_block_size, annotated_block_size * annotated_tile <= 4096);
+
+      assert(expected == tune(annotated_cost, annotated_constraints, annotated_space, exhaustive(), pool).cost);
+      assert(expected == tune(annotated_cost, annotated_constraints, annotated_space, pruned(), pool).cost);
+      assert(expected == tune(annotated_cost, annotated_constraints, annotated_space, bounded(), pool).cost);
+
+      try
+      {
+        range<"tile", int, in_range<0,64>>(0, 66);
+        assert(false);
+      }
+      catch(std::domain_error)
+      {
+      }
+
+      try
+      {
+        range<"tile">(0, 65, 0);
+        assert(false);
+      }
+      catch(std::domain_error)
+      {
+      }
+
+      assert((std::vector<unsigned char>{250, 253}) == (range<"tile", unsigned char>(250, 255, 3).values));
+    }
+  }
+
+  {
+    auto path = std::filesystem::temp_directory_path() / fmt::format("variable_test_{}.cache", getpid());
+    std::filesystem::remove(path);
+
+    variable<"block_size"> block_size;
+    variable<"tile"> tile;
+    parameter_space space(powers_of_two<"block_size">(32, 1024), range<"tile">(1, 33));
+    auto cost = ceil_div(12345, block_size) * (block_size + tile * 3);
+    std::tuple constraints(tile * 4 <= block_size);
+
+    {
+      tuning_cache cache(path);
+      auto first = tune(cost, constraints, space, exhaustive(), cache);
+      assert(space.size() == first.num_evaluated);
+
+      // a second search is answered by the cache
+      auto second = tune(cost, constraints, space, exhaustive(), cache);
+      assert(0 == second.num_evaluated);
+      assert(first.cost == second.cost);
+      assert(get<"block_size">(*first.best) == get<"block_size">(*second.best));
+
+      // a search by another strategy, or with other parameters, is not answered by the cache
+      auto random = tune(cost, constraints, space, random_restart{4, 7}, cache);
+      assert(0 < random.num_evaluated);
+      assert(0 == tune(cost, constraints, space, random_restart{4, 7}, cache).num_evaluated);
+      assert(0 < tune(cost, constraints, space, random_restart{4, 8}, cache).num_evaluated);
+      assert(0 < tune(cost, constraints, space, pruned(), cache).num_evaluated);
+
+      // only the bindings of an expression's variables are part of its key
+      environment env(binding<"block_size">{128}, binding<"n">{12345});
+      assert(tuning_key(ceil_div(12345, block_size), env) == tuning_key(ceil_div(12345, block_size), env.set<"n">(0)));
+      assert(tuning_key(ceil_div(12345, block_size), env) != tuning_key(ceil_div(12345, block_size), env.set<"block_size">(256)));
+      assert(std::tuple(97, 128) == cached_evaluate(std::tuple(ceil_div(12345, block_size), block_size), env, cache));
+    }
+
+    // each thread shares the file through its own cache, as separate processes would
+    std::vector<std::thread> writers;
+    for(int t = 0; t < 4; ++t)
+    {
+      writers.emplace_back([&, t]
+      {
+        tuning_cache cache(path);
+        for(int i = 0; i < 100; ++i)
+        {
+          cache.insert(1000 * t + i, i);
+        }
+      });
+    }
+
+    for(auto& writer : writers)
+    {
+      writer.join();
+    }
+
+    // reopening the file finds every record: one for each of the four searches above, one for
+    // cached_evaluate, and those of the threads
+    tuning_cache cache(path);
+    assert(5 + 400 == cache.size());
+    assert(99 == cache.find<int>(3099));
+    assert(not cache.find<int>(5000));
+    assert(not cache.find<long>(3099));
+
+    std::filesystem::remove(path);
+  }
+
+  {
+    variable<"n"> n;
+    variable<"block_size"> block_size;
+
+    // each variable is bound to the argument in the position of its name
+    constexpr auto num_blocks = compile<"n","block_size">(ceil_div(n, block_size));
+    static_assert(97 == num_blocks(12345, 128));
+    assert(49 == num_blocks(12345, 256));
+
+    auto shape = compile<"block_size","n">(std::tuple(ceil_div(n, block_size) * 2_c, block_size));
+    assert(std::tuple(97 * 2, 128) == shape(128, 12345));
+
+    // literals are kept, and the arguments' types are those of the result
+    auto scaled = compile<"n">(n * 3 + 1);
+    assert(3L * 5'000'000'000L + 1 == scaled(5'000'000'000L));
+  }
+
+  {
+    variable<"block_size"> block_size;
+    variable<"tile"> tile;
+
+    // the text of an expression without runtime literals is known at compile time
+    static_assert("(block_size+1)*(tile%4)" == static_text<decltype((block_size + 1_c) * (tile % 4_c))>);
+
+    // only runtime literals are formatted when the text is rendered
+    std::array<char, 64> buffer;
+    auto expr = ceil_div(12345, block_size) * (tile + 2_c) - 7;
+    assert("((((12345+block_size)-1)/block_size)*(tile+2))-7" == render_to(expr, buffer));
+    assert(fmt::format("{}", expr) == render_to(expr, buffer));
+
+    try
+    {
+      render_to(expr, std::span(buffer.data(), 8));
+      assert(false);
+    }
+    catch(std::length_error)
+    {
+    }
+  }
+
+  {
+    variable<"n"> n;
+    variable<"block_size"> block_size;
+
+    // structural hashes are computed at compile time, and are the same on every platform
+    static_assert(structural_hash(n + 1) == 0x6c000242d3f8e1e4);
+    static_assert(structural_hash(n + 1_c) == structural_hash(n + 1));
+    static_assert(structural_hash(n + 1) != structural_hash(n + 2));
+    static_assert(structural_hash(n + 1) != structural_hash(block_size + 1));
+    static_assert(structural_hash(n - 1) != structural_hash(n + 1));
+    static_assert(structural_hash(n * (block_size + 1)) != structural_hash((n * block_size) + 1));
+
+    static_assert(structurally_equal(ceil_div(n, block_size), ceil_div(n, block_size)));
+    static_assert(structurally_equal(n + 1_c, n + 1));
+    static_assert(not structurally_equal(n + 1, n + 2));
+    static_assert(not structurally_equal(n + 1, block_size + 1));
+    static_assert(not structurally_equal(n + 1, n - 1));
+    static_assert(not structurally_equal(n / 2, n / 2.0));
+    static_assert(structurally_equal(std::tuple(n, 2), std::tuple(n, 2)));
+    static_assert(not structurally_equal(std::tuple(n, 2), std::tuple(n)));
+  }
+
+  {
+    variable<"n"> n;
+    variable<"block_size", int, pow2> block_size;
+    variable<"tile", int, multiple_of<32>> tile;
+    variable<"lane", int, in_range<0,31>> lane;
+
+    // annotations lower operations by what they state, and formatting is unchanged
+    static_assert(std::same_as<::detail::shift_divides, decltype((n / block_size).f)>);
+    static_assert(std::same_as<::detail::shift_modulus, decltype((n % block_size).f)>);
+    static_assert(std::same_as<::detail::shift_multiplies<true>, decltype((block_size * n).f)>);
+    static_assert(std::same_as<::detail::exact_shift_divides, decltype((tile / 8_c).f)>);
+    static_assert(std::same_as<constant<0>, decltype(tile % 16_c)>);
+    static_assert(std::same_as<::detail::nonnegative<std::divides<>>, decltype((lane / 3_c).f)>);
+    static_assert(std::same_as<std::divides<>, decltype((n / 3_c).f)>);
+    static_assert("((n+block_size)-1)/block_size" == static_text<decltype((n + block_size - 1_c) / block_size)>);
+    static_assert(structural_hash(ceil_div(n, block_size)) == structural_hash(ceil_div(n, variable<"block_size">())));
+
+    for(int b = 1; b <= 1024; b *= 2)
+    {
+      for(int x : {-1025, -1024, -513, -7, -1, 0, 1, 7, 513, 1024, 1025})
+      {
+        environment env(binding<"n">{x}, binding<"block_size", int, pow2>{b});
+        assert(x / b == evaluate(n / block_size, env));
+        assert(x % b == evaluate(n % block_size, env));
+        assert(x * b == evaluate(block_size * n, env));
+        assert(x * b == evaluate(n * block_size, env));
+        assert((x + b - 1) / b == evaluate(ceil_div(n, block_size), env));
+      }
+    }
+
+    for(int t = -320; t <= 320; t += 32)
+    {
+      environment env(binding<"tile", int, multiple_of<32>>{t});
+      assert(t / 8 == evaluate(tile / 8_c, env));
+    }
+
+    for(int l = 0; l < 32; ++l)
+    {
+      environment env(binding<"lane", int, in_range<0,31>>{l});
+      assert(l / 3 == evaluate(lane / 3_c, env));
+      assert(l % 3 == evaluate(lane % 3_c, env));
+    }
+
+    // bindings are checked once, when they are made or changed
+    try
+    {
+      binding<"block_size", int, pow2> invalid{96};
+      assert(false);
+    }
+    catch(std::domain_error)
+    {
+    }
+
+    // the value of an annotated binding may be read, but not changed in place
+    static_assert(128 == binding<"block_size", int, pow2>{128}.value());
+    static_assert(std::same_as<const int&, decltype(std::declval<binding<"block_size", int, pow2>&>().value())>);
+
+    environment env(binding<"n">{12345}, binding<"block_size", int, pow2>{128});
+    assert(97 == evaluate(ceil_div(n, block_size), env));
+    assert(49 == evaluate(ceil_div(n, block_size), set<"block_size">(env, 256)));
+
+    try
+    {
+      set<"block_size">(env, 96);
+      assert(false);
+    }
+    catch(std::domain_error)
+    {
+    }
+
+    try
+    {
+      env.assign<"block_size">(96);
+      assert(false);
+    }
+    catch(std::domain_error)
+    {
+    }
+
+    try
+    {
+      std::vector<int> sizes{32, 64, 96};
+      binding<"block_size", std::span<const int>, pow2> invalid{sizes};
+      assert(false);
+    }
+    catch(std::domain_error)
+    {
+    }
+
+    // compiled expressions check the arguments bound to annotated variables
+    auto num_blocks = compile<"n","block_size">(ceil_div(n, block_size));
+    assert(97 == num_blocks(12345, 128));
+
+    try
+    {
+      num_blocks(12345, 96);
+      assert(false);
+    }
+    catch(std::domain_error)
+    {
+    }
+  }
+
+  {
+    variable<"n", int, in_range<0,(1 << 20)>> n;
+    variable<"block_size", int, pow2> block_size;
+    variable<"x", double> x;
+    variable<"y", double> y;
+
+    // rules apply as expressions are built, and the text shows the rewritten operation
+    auto num_blocks = (n + block_size - 1_c) / block_size;
+    static_assert(std::same_as<::detail::ceil_divides<::detail::shift_divides>, decltype(num_blocks.f)>);
+    static_assert("ceil_div(n, block_size)" == static_text<decltype(num_blocks)>);
+    static_assert(std::same_as<::detail::ceil_divides<::detail::nonnegative<std::divides<>>>, decltype(((n + 7_c) / 8_c).f)>);
+    static_assert(std::same_as<decltype(n / 32_c), decltype((n / 4_c) / 8_c)>);
+    static_assert(std::same_as<decltype(variable<"m">() / 32_c), decltype((variable<"m">() / 4_c) / 8_c)>);
+    static_assert(std::same_as<decltype(x), decltype(-(-x))>);
+
+    // n and block_size may be negative here, so the formula is left as it is
+    static_assert(std::same_as<std::divides<>, decltype(ceil_div(variable<"n">(), variable<"block_size">()).f)>);
+    static_assert(std::same_as<::detail::shift_divides, decltype(ceil_div(variable<"n">(), block_size).f)>);
+
+    // an unsigned sum wraps around where a ceil_div would not, so it is left as it is unless
+    // annotations bound it
+    {
+      variable<"u", unsigned> u;
+      variable<"d", unsigned> d;
+      static_assert(std::same_as<std::divides<>, decltype(((u + d - 1_c) / d).f)>);
+      static_assert(std::same_as<std::divides<>, decltype(((u + 3_c) / 4_c).f)>);
+
+      environment env(binding<"u", unsigned>{std::numeric_limits<unsigned>::max() - 1}, binding<"d", unsigned>{4});
+      assert(0 == evaluate((u + d - 1_c) / d, env));
+      assert(0 == evaluate((u + 3_c) / 4_c, env));
+
+      variable<"v", unsigned, in_range<0u,(1u << 20)>> v;
+      variable<"e", unsigned, in_range<1u,1024u>> e;
+      static_assert(std::same_as<::detail::ceil_divides<::detail::nonnegative<std::divides<>>>, decltype(((v + e - 1_c) / e).f)>);
+      static_assert(std::same_as<::detail::ceil_divides<::detail::nonnegative<std::divides<>>>, decltype(((v + 3_c) / 4_c).f)>);
+      static_assert(std::same_as<std::divides<>, decltype(((v + d - 1_c) / d).f)>);
+
+      environment bounded_env(binding<"v", unsigned, in_range<0u,(1u << 20)>>{1025}, binding<"e", unsigned, in_range<1u,1024u>>{100});
+      assert(11 == evaluate((v + e - 1_c) / e, bounded_env));
+      assert(257 == evaluate((v + 3_c) / 4_c, bounded_env));
+    }
+
+    auto fma = x * y + 1.0;
+    static_assert(::detail::is_instantiation_of_v<decltype(fma), op3>);
+    static_assert(::detail::is_instantiation_of_v<decltype(1.0 + x * y), op3>);
+    static_assert(not ::detail::is_instantiation_of_v<decltype(variable<"i">() * variable<"j">() + 1), op3>);
+    assert("fma(x, y, 1)" == format("{}", fma));
+    assert("fma(x, y, x*y)" == format("{}", x * y + x * y));
+    assert(structural_hash(fma) == structural_hash(1.0 + x * y));
+    assert(not structurally_equal(fma, x * (y + 1.0)));
+
+    for(int b = 1; b <= 1024; b *= 2)
+    {
+      for(int i : {0, 1, 7, 8, 9, 513, 1024, 1025, 1 << 20})
+      {
+        environment env(binding<"n", int, in_range<0,(1 << 20)>>{i}, binding<"block_size", int, pow2>{b});
+        assert((i + b - 1) / b == evaluate(num_blocks, env));
+        assert((i + 7) / 8 == evaluate((n + 7_c) / 8_c, env));
+        assert(i / 32 == evaluate((n / 4_c) / 8_c, env));
+      }
+    }
+
+    for(int i : {-1025, -33, -32, -31, -1, 0, 31, 32, 33, 1025})
+    {
+      environment env(binding<"m">{i});
+      assert(i / 4 / 8 == evaluate((variable<"m">() / 4_c) / 8_c, env));
+    }
+
+    // fma rounds once
+    environment env(binding<"x", double>{0.1}, binding<"y", double>{10.0});
+    assert(std::fma(0.1, 10.0, -1.0) == evaluate(x * y + -1.0, env));
+    assert(std::fma(0.1, 10.0, 0.1) == evaluate(x + x * y, env));
+    assert(std::fma(0.1, 10.0, 1.0) == evaluate(-(-fma), env));
+
+    // ternary operations evaluate in batches and when compiled
+    std::vector<double> xs(1000);
+    std::vector<double> ys(xs.size());
+    std::iota(xs.begin(), xs.end(), 0.5);
+    std::vector<double> result(xs.size());
+    evaluate_batch(fma * 2.0, environment(binding<"x", std::span<const double>>{xs}, binding<"y", double>{0.25}), std::span(result));
+
+    for(std::size_t i = 0; i < result.size(); ++i)
+    {
+      assert(std::fma(xs[i], 0.25, 1.0) * 2.0 == result[i]);
+    }
+
+    auto f = compile<"x","y">(fma);
+    assert(std::fma(0.1, 10.0, 1.0) == f(0.1, 10.0));
+    assert(std::fma(3.0, 10.0, 1.0) == evaluate(partially_evaluate(fma, environment(binding<"y", double>{10.0})), environment(binding<"x", double>{3.0})));
+  }
+
+  {
+    variable<"n"> n;
+    variable<"block_size"> block_size;
+    environment env(binding<"n">{12345}, binding<"block_size">{128});
+
+    // not_instrumented is evaluate, even in a constant expression
+    constexpr environment constant_env(binding<"n">{12345}, binding<"block_size">{128});
+    static_assert(97 == evaluate(ceil_div(n, block_size), constant_env, not_instrumented()));
+
+    // instrumented evaluation records each operation and variable, at its position in preorder
+    profile p;
+    auto expr = ceil_div(n, block_size);
+    for(int i = 0; i < 10; ++i)
+    {
+      assert(97 == evaluate(expr, env, instrumented{&p}));
+    }
+
+    std::vector<profile_entry> entries = p.snapshot();
+    assert(6 == entries.size());
+
+    std::vector<std::string_view> labels;
+    for(const profile_entry& e : entries)
+    {
+      assert(structural_hash(expr) == e.expression);
+      assert(10 == e.calls);
+      assert(0 == e.misses and 0 == e.mismatches);
+      labels.push_back(e.label);
+    }
+
+    // the literal 1, at position 5, is not recorded
+    assert((std::vector<std::string_view>{"/", "-", "+", "n", "block_size", "block_size"} == labels));
+    assert(6 == entries.back().node);
+    assert(entries[0].cycles >= entries[1].cycles);
+
+    // each thread records into its own buffer, and a snapshot sums them
+    std::vector<std::thread> threads;
+    for(int t = 0; t < 4; ++t)
+    {
+      threads.emplace_back([&]
+      {
+        for(int i = 0; i < 100; ++i)
+        {
+          evaluate(expr, env, instrumented{&p});
+        }
+      });
+    }
+
+    for(auto& t : threads) t.join();
+
+    assert(410 == p.snapshot()[0].calls);
+
+    // the elements of a tuple are profiled as separate expressions
+    profile q;
+    auto [blocks, size] = evaluate(std::tuple(expr, block_size * 2), env, instrumented{&q});
+    assert(97 == blocks and 256 == size);
+    assert(8 == q.snapshot().size());
+    assert(0 == q.num_dropped());
   }
 
   // this prints "foo" to the terminal
@@ -177,6 +1005,12 @@ int main()
 //    binding<"bar"> b{13};
 //    environment env(b);
 //    evaluate(foo, env);
+//  }
+
+  // so does this, as the binding does not carry the variable's annotation
+//  {
+//    environment env(binding<"block_size">{96});
+//    evaluate(variable<"block_size", int, pow2>(), env);
 //  }
 
   return 0;
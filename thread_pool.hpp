@@ -0,0 +1,234 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+// a thread_pool executes parallel loops on a fixed set of threads, balancing load by work stealing
+//
+// each participant in a loop begins with a contiguous share of its iterations and takes them one at
+// a time from the front of its share. a participant whose share runs out steals the back half of the
+// largest share remaining. shares are single atomic words, so neither taking nor stealing locks.
+class thread_pool
+{
+  public:
+    // the thread calling for_each participates in the loop, so num_threads - 1 threads are created
+    explicit thread_pool(std::size_t num_threads = std::max(1u, std::thread::hardware_concurrency()))
+      : shares_(std::max<std::size_t>(1, num_threads))
+    {
+      for(std::size_t participant = 1; participant < shares_.size(); ++participant)
+      {
+        threads_.emplace_back([this, participant]
+        {
+          wait_for_work(participant);
+        });
+      }
+    }
+
+    thread_pool(const thread_pool&) = delete;
+
+    ~thread_pool()
+    {
+      {
+        std::lock_guard lock{mutex_};
+        stopping_ = true;
+      }
+
+      work_available_.notify_all();
+
+      for(auto& thread : threads_)
+      {
+        thread.join();
+      }
+    }
+
+    // the number of threads which participate in each loop
+    std::size_t size() const
+    {
+      return shares_.size();
+    }
+
+    // calls f(participant, i) for each i in [0, n) and returns after every call has returned
+    //
+    // participant is in [0, size()) and identifies the calling thread, so that f may keep per-thread state
+    // without synchronization. if any call throws, one of the exceptions is rethrown after the loop ends.
+    //
+    // for_each may be called concurrently from several threads, but not from within f
+    template<class F>
+    void for_each(std::size_t n, F&& f)
+    {
+      if(n > max_iterations) throw std::length_error("thread_pool::for_each: too many iterations.");
+
+      std::lock_guard loop_lock{loop_mutex_};
+
+      for(std::size_t participant = 0; participant < size(); ++participant)
+      {
+        shares_[participant].range.store(pack(n * participant / size(), n * (participant + 1) / size()), std::memory_order_relaxed);
+      }
+
+      {
+        std::lock_guard lock{mutex_};
+        body_ = std::ref(f);
+        exception_ = nullptr;
+        num_working_ = size();
+        ++generation_;
+      }
+
+      work_available_.notify_all();
+
+      work(0);
+
+      std::unique_lock lock{mutex_};
+      work_finished_.wait(lock, [&]{ return num_working_ == 0; });
+
+      body_ = nullptr;
+      if(exception_) std::rethrow_exception(exception_);
+    }
+
+    // the pool shared by library functions which are not given one
+    static thread_pool& default_pool()
+    {
+      static thread_pool pool;
+      return pool;
+    }
+
+  private:
+    constexpr static std::uint64_t max_iterations = 0xffffffff;
+
+    // a share packs the range [begin, end) into a single word, begin in the upper half
+    constexpr static std::uint64_t pack(std::uint64_t begin, std::uint64_t end)
+    {
+      return (begin << 32) | end;
+    }
+
+    constexpr static std::uint64_t begin(std::uint64_t range)
+    {
+      return range >> 32;
+    }
+
+    constexpr static std::uint64_t end(std::uint64_t range)
+    {
+      return range & max_iterations;
+    }
+
+    constexpr static std::uint64_t remaining(std::uint64_t range)
+    {
+      return begin(range) < end(range) ? end(range) - begin(range) : 0;
+    }
+
+    struct alignas(64) share
+    {
+      std::atomic<std::uint64_t> range;
+    };
+
+    // takes the first iteration of participant's share
+    bool take(std::size_t participant, std::size_t& i)
+    {
+      auto& range = shares_[participant].range;
+      std::uint64_t r = range.load(std::memory_order_relaxed);
+
+      while(begin(r) < end(r))
+      {
+        if(range.compare_exchange_weak(r, pack(begin(r) + 1, end(r)), std::memory_order_acq_rel))
+        {
+          i = begin(r);
+          return true;
+        }
+      }
+
+      return false;
+    }
+
+    // moves the back half of the largest remaining share to participant's share
+    bool steal(std::size_t participant)
+    {
+      for(;;)
+      {
+        std::size_t victim = participant;
+        std::uint64_t victim_range = 0;
+
+        for(std::size_t other = 0; other < size(); ++other)
+        {
+          std::uint64_t r = shares_[other].range.load(std::memory_order_relaxed);
+          if(remaining(r) > remaining(victim_range))
+          {
+            victim = other;
+            victim_range = r;
+          }
+        }
+
+        if(victim == participant) return false;
+
+        std::uint64_t middle = begin(victim_range) + (end(victim_range) - begin(victim_range)) / 2;
+
+        if(shares_[victim].range.compare_exchange_strong(victim_range, pack(begin(victim_range), middle), std::memory_order_acq_rel))
+        {
+          shares_[participant].range.store(pack(middle, end(victim_range)), std::memory_order_release);
+          return true;
+        }
+      }
+    }
+
+    void work(std::size_t participant)
+    {
+      std::size_t i;
+
+      do
+      {
+        while(take(participant, i))
+        {
+          try
+          {
+            body_(participant, i);
+          }
+          catch(...)
+          {
+            std::lock_guard lock{mutex_};
+            if(not exception_) exception_ = std::current_exception();
+          }
+        }
+      }
+      while(steal(participant));
+
+      std::lock_guard lock{mutex_};
+      if(--num_working_ == 0) work_finished_.notify_all();
+    }
+
+    void wait_for_work(std::size_t participant)
+    {
+      std::uint64_t generation = 0;
+
+      for(;;)
+      {
+        {
+          std::unique_lock lock{mutex_};
+          work_available_.wait(lock, [&]{ return stopping_ or generation_ != generation; });
+          if(stopping_) return;
+          generation = generation_;
+        }
+
+        work(participant);
+      }
+    }
+
+    std::vector<share> shares_;
+    std::vector<std::thread> threads_;
+
+    std::mutex loop_mutex_;
+
+    std::mutex mutex_;
+    std::condition_variable work_available_;
+    std::condition_variable work_finished_;
+    std::function<void(std::size_t,std::size_t)> body_;
+    std::exception_ptr exception_;
+    std::size_t num_working_ = 0;
+    std::uint64_t generation_ = 0;
+    bool stopping_ = false;
+};
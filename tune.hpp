@@ -0,0 +1,697 @@
+#pragma once
+
+#include "interval.hpp"
+#include "sweep.hpp"
+#include "tuning_cache.hpp"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <random>
+#include <stdexcept>
+#include <string_view>
+#include <tuple>
+#include <vector>
+
+// tune chooses the point of a parameter_space which minimizes a cost expression subject to
+// constraint expressions
+//
+// each axis of the space is the domain of one variable: a range, powers of two, or any explicit
+// list of values. constraints are expressions whose values are bool, such as block_size <= n.
+// a point satisfies the constraints when each of them is true there. the cost of a point is only
+// evaluated once it satisfies the constraints, so a constraint may guard the cost against division
+// by zero.
+
+// the domain of integers first, first + stride, ... which are less than last
+//
+// the axis carries Annotations. throws std::domain_error if stride is not positive, or if a value
+// does not satisfy them
+template<detail::sl n, std::integral T = int, class... Annotations>
+axis<n,T,Annotations...> range(T first, T last, T stride = 1)
+{
+  if(stride <= 0)
+  {
+    throw std::domain_error("range: stride must be positive.");
+  }
+
+  axis<n,T,Annotations...> result;
+  for(T value = first; value < last; value += stride)
+  {
+    detail::validate<Annotations...>(value);
+    result.values.push_back(value);
+
+    // the next value would not be representable, so it could not be less than last
+    if(value > std::numeric_limits<T>::max() - stride) break;
+  }
+
+  return result;
+}
+
+// the domain of powers of two in [lo, hi], which may bind a variable annotated with pow2
+template<detail::sl n, std::integral T = int>
+axis<n,T,pow2> powers_of_two(T lo, T hi)
+{
+  axis<n,T,pow2> result;
+  for(T value = 1; value <= hi; value *= 2)
+  {
+    if(value >= lo) result.values.push_back(value);
+    if(value > hi / 2) break;
+  }
+
+  return result;
+}
+
+
+// a tuning_problem is a cost to minimize over a space subject to constraints
+template<class C, class Constraints, class Space>
+struct tuning_problem;
+
+template<unevaluated C, class... Cs, class... Axes>
+struct tuning_problem<C, std::tuple<Cs...>, parameter_space<Axes...>>
+{
+  static_assert(sizeof...(Axes) > 0, "tuning_problem: space has no axes.");
+
+  using environment_type = typename parameter_space<Axes...>::environment_type;
+  using cost_type = decltype(evaluate(std::declval<C>(), std::declval<environment_type>()));
+
+  C cost;
+  std::tuple<Cs...> constraints;
+  parameter_space<Axes...> space;
+
+  // true when env satisfies every constraint
+  constexpr bool satisfies_constraints(const environment_type& env) const
+  {
+    return std::apply([&](const auto&... constraint)
+    {
+      return (static_cast<bool>(evaluate(constraint, env)) and ...);
+    },
+    constraints);
+  }
+
+  // the cost of point, or nothing if it does not satisfy the constraints
+  constexpr std::optional<cost_type> cost_of(std::size_t point) const
+  {
+    environment_type env = space[point];
+    if(not satisfies_constraints(env)) return std::nullopt;
+    return evaluate(cost, env);
+  }
+};
+
+
+// the best point found by a search strategy, and the number of points it evaluated
+template<class T>
+struct alignas(64) search_result
+{
+  T cost = std::numeric_limits<T>::max();
+
+  // npos when no point satisfied the constraints
+  std::size_t point = npos;
+
+  std::size_t num_evaluated = 0;
+
+  constexpr static std::size_t npos = -1;
+
+  // keeps point if it is better than the best point so far. ties go to the lower numbered point
+  constexpr void consider(const T& other_cost, std::size_t other_point)
+  {
+    if(other_cost < cost or (not (cost < other_cost) and other_point < point))
+    {
+      cost = other_cost;
+      point = other_point;
+    }
+  }
+
+  constexpr void combine(const search_result& other)
+  {
+    if(other.point != npos) consider(other.cost, other.point);
+    num_evaluated += other.num_evaluated;
+  }
+};
+
+
+namespace detail
+{
+
+// the state kept by each participant in an exhaustive search
+template<class T, class... Axes>
+struct alignas(64) exhaustive_workspace
+{
+  std::tuple<std::vector<typename Axes::value_type>...> columns{std::vector<typename Axes::value_type>(chunk_size)...};
+  std::vector<char> satisfied = std::vector<char>(chunk_size);
+  std::vector<char> feasible = std::vector<char>(chunk_size);
+  std::vector<std::size_t> points = std::vector<std::size_t>(chunk_size);
+  std::vector<T> costs = std::vector<T>(chunk_size);
+};
+
+// evaluates the points [first, first + n) of problem's space in batches
+template<class C, class... Cs, class... Axes, class T>
+void exhaustive_chunk(const tuning_problem<C,std::tuple<Cs...>,parameter_space<Axes...>>& problem, std::size_t first, std::size_t n, exhaustive_workspace<T,Axes...>& workspace, search_result<T>& result)
+{
+  problem.space.fill(first, n, workspace.columns);
+
+  // evaluate each constraint over the whole chunk
+  std::fill_n(workspace.feasible.begin(), n, true);
+
+  std::apply([&](const auto&... constraint)
+  {
+    auto env = column_environment(problem.space, workspace.columns, n);
+
+    ((evaluate_batch(constraint, env, std::span(workspace.satisfied.data(), n)),
+      std::transform(workspace.feasible.begin(), workspace.feasible.begin() + n, workspace.satisfied.begin(), workspace.feasible.begin(), std::logical_and())), ...);
+  },
+  problem.constraints);
+
+  // move the feasible points to the front of each column
+  std::size_t m = 0;
+  for(std::size_t j = 0; j < n; ++j)
+  {
+    if(workspace.feasible[j])
+    {
+      std::apply([&](auto&... column)
+      {
+        ((column[m] = column[j]), ...);
+      },
+      workspace.columns);
+
+      workspace.points[m++] = first + j;
+    }
+  }
+
+  // evaluate the cost of only the feasible points
+  if(m > 0)
+  {
+    evaluate_batch(problem.cost, column_environment(problem.space, workspace.columns, m), std::span(workspace.costs.data(), m));
+  }
+
+  for(std::size_t j = 0; j < m; ++j)
+  {
+    result.consider(workspace.costs[j], workspace.points[j]);
+  }
+
+  result.num_evaluated += n;
+}
+
+// the number of axes which constraint C depends on, counting from the first, so that
+// it may be checked once each of those axes has a value
+template<class C, class... Axes>
+constexpr std::size_t constraint_depth()
+{
+  std::array<bool, sizeof...(Axes)> depends{depends_on<C>(Axes::name)...};
+
+  std::size_t result = 0;
+  for(std::size_t k = 0; k < depends.size(); ++k)
+  {
+    if(depends[k]) result = k + 1;
+  }
+
+  return result;
+}
+
+// true when env satisfies each constraint of problem which can first be checked at depth
+template<std::size_t depth, class C, class... Cs, class... Axes, class Env>
+constexpr bool satisfies_constraints_at(const tuning_problem<C,std::tuple<Cs...>,parameter_space<Axes...>>& problem, const Env& env)
+{
+  return [&]<std::size_t... is>(std::index_sequence<is...>)
+  {
+    auto check = [&]<std::size_t i>(std::integral_constant<std::size_t,i>)
+    {
+      using constraint_type = std::tuple_element_t<i, std::tuple<Cs...>>;
+
+      if constexpr (constraint_depth<constraint_type,Axes...>() == depth)
+      {
+        return static_cast<bool>(evaluate(std::get<i>(problem.constraints), env));
+      }
+      else
+      {
+        return true;
+      }
+    };
+
+    return (check(std::integral_constant<std::size_t,is>()) and ...);
+  }(std::index_sequence_for<Cs...>());
+}
+
+// binds the name of a in env to a's cth value
+template<class Env, sl n, class T, class... As>
+void assign(Env& env, const axis<n,T,As...>& a, std::size_t c)
+{
+  env.template assign<n>(a.values[c]);
+}
+
+// assigns each value of axis k in turn, descending to axis k + 1 when the constraints checkable
+// so far are satisfied
+template<std::size_t k, class Problem, class Env, class T>
+void descend(const Problem& problem, Env& env, std::array<std::size_t, Env::size()>& coordinates, search_result<T>& result)
+{
+  if constexpr (k == Env::size())
+  {
+    ++result.num_evaluated;
+    result.consider(evaluate(problem.cost, env), problem.space.point(coordinates));
+  }
+  else
+  {
+    const auto& axis = std::get<k>(problem.space.axes());
+
+    for(std::size_t c = 0; c < axis.values.size(); ++c)
+    {
+      assign(env, axis, c);
+      coordinates[k] = c;
+
+      if(satisfies_constraints_at<k+1>(problem, env))
+      {
+        descend<k+1>(problem, env, coordinates, result);
+      }
+    }
+  }
+}
+
+template<class Axis>
+struct interval_binding;
+
+// an interval binding carries the annotations of its axis, which its bounds satisfy
+template<sl n, class T, class... As>
+struct interval_binding<axis<n,T,As...>>
+{
+  using type = binding<n, interval<T>, As...>;
+};
+
+// the smallest interval containing each of a's values
+template<sl n, class T, class... As>
+interval<T> value_hull(const axis<n,T,As...>& a)
+{
+  auto [lo, hi] = std::minmax_element(a.values.begin(), a.values.end());
+  return {*lo, *hi};
+}
+
+// binds the name of a in region to the interval of all of a's values
+template<class Env, sl n, class T, class... As>
+void widen(Env& region, const axis<n,T,As...>& a)
+{
+  region.template assign<n>(value_hull(a));
+}
+
+// the environment binding each axis of space to the interval of its values
+template<class... Axes>
+auto interval_environment(const parameter_space<Axes...>& space)
+{
+  return std::apply([](const auto&... axes)
+  {
+    return environment<typename interval_binding<Axes>::type...>{typename interval_binding<Axes>::type{value_hull(axes)}...};
+  },
+  space.axes());
+}
+
+// false when interval evaluation proves that no point of region satisfies the constraints, or that
+// none costs less than the best point of result
+template<class Problem, class Region, class T>
+bool may_improve(const Problem& problem, const Region& region, const search_result<T>& result)
+{
+  try
+  {
+    bool feasible = std::apply([&](const auto&... constraint)
+    {
+      return (possibly(evaluate(constraint, region)) and ...);
+    },
+    problem.constraints);
+
+    if(not feasible) return false;
+    if(result.point == search_result<T>::npos) return true;
+
+    // ties are kept, as a point of region may be numbered lower than the best point
+    return not (result.cost < evaluate(problem.cost, region).lo);
+  }
+  catch(const std::domain_error&)
+  {
+    // a divisor which is zero everywhere in region bounds nothing
+    return true;
+  }
+}
+
+// descends as descend does, narrowing axis k of region to each of its values in turn, and abandons
+// the assignment when may_improve proves it fruitless
+template<std::size_t k, class Problem, class Env, class Region, class T>
+void descend_bounded(const Problem& problem, Env& env, Region& region, std::array<std::size_t, Env::size()>& coordinates, search_result<T>& result)
+{
+  if constexpr (k == Env::size())
+  {
+    ++result.num_evaluated;
+    result.consider(evaluate(problem.cost, env), problem.space.point(coordinates));
+  }
+  else
+  {
+    const auto& axis = std::get<k>(problem.space.axes());
+
+    for(std::size_t c = 0; c < axis.values.size(); ++c)
+    {
+      assign(env, axis, c);
+      assign(region, axis, c);
+      coordinates[k] = c;
+
+      // once every axis has a value, evaluating the point costs no more than bounding it
+      if(satisfies_constraints_at<k+1>(problem, env) and (k + 1 == Env::size() or may_improve(problem, region, result)))
+      {
+        descend_bounded<k+1>(problem, env, region, coordinates, result);
+      }
+    }
+
+    widen(region, axis);
+  }
+}
+
+} // end detail
+
+
+// an exhaustive search evaluates every point, in batches
+struct exhaustive
+{
+  constexpr static std::string_view name = "exhaustive";
+
+  template<class C, class... Cs, class... Axes>
+  auto search(const tuning_problem<C,std::tuple<Cs...>,parameter_space<Axes...>>& problem, thread_pool& pool) const
+  {
+    using T = typename tuning_problem<C,std::tuple<Cs...>,parameter_space<Axes...>>::cost_type;
+
+    std::vector<detail::exhaustive_workspace<T,Axes...>> workspaces(pool.size());
+    std::vector<search_result<T>> results(pool.size());
+
+    std::size_t size = problem.space.size();
+    std::size_t num_chunks = (size + detail::chunk_size - 1) / detail::chunk_size;
+
+    pool.for_each(num_chunks, [&](std::size_t participant, std::size_t chunk)
+    {
+      std::size_t first = chunk * detail::chunk_size;
+      detail::exhaustive_chunk(problem, first, std::min(detail::chunk_size, size - first), workspaces[participant], results[participant]);
+    });
+
+    for(std::size_t i = 1; i < results.size(); ++i)
+    {
+      results[0].combine(results[i]);
+    }
+
+    return results[0];
+  }
+};
+
+// a pruned search assigns the axes one at a time, in order, and abandons a partial assignment as
+// soon as a constraint depending only on the axes assigned so far fails
+//
+// the values of the first axis are searched in parallel
+struct pruned
+{
+  constexpr static std::string_view name = "pruned";
+
+  template<class Problem>
+  auto search(const Problem& problem, thread_pool& pool) const
+  {
+    using T = typename Problem::cost_type;
+    using environment_type = typename Problem::environment_type;
+
+    std::vector<search_result<T>> results(pool.size());
+
+    if(problem.space.size() > 0 and detail::satisfies_constraints_at<0>(problem, problem.space[0]))
+    {
+      const auto& first_axis = std::get<0>(problem.space.axes());
+
+      pool.for_each(first_axis.values.size(), [&](std::size_t participant, std::size_t c)
+      {
+        environment_type env = problem.space[0];
+        std::array<std::size_t, environment_type::size()> coordinates{};
+
+        detail::assign(env, first_axis, c);
+        coordinates[0] = c;
+
+        if(detail::satisfies_constraints_at<1>(problem, env))
+        {
+          detail::descend<1>(problem, env, coordinates, results[participant]);
+        }
+      });
+    }
+
+    for(std::size_t i = 1; i < results.size(); ++i)
+    {
+      results[0].combine(results[i]);
+    }
+
+    return results[0];
+  }
+};
+
+// a bounded search is a pruned search which also bounds the constraints and cost over each
+// partial assignment by evaluating them with each unassigned axis bound to the interval of its
+// values. it abandons the assignment when no point it leads to can satisfy the constraints or
+// cost less than the best point found so far.
+//
+// the cost and constraints must be evaluable over intervals, as expressions of the arithmetic
+// operators and comparisons are
+struct bounded
+{
+  constexpr static std::string_view name = "bounded";
+
+  template<class Problem>
+  auto search(const Problem& problem, thread_pool& pool) const
+  {
+    using T = typename Problem::cost_type;
+    using environment_type = typename Problem::environment_type;
+
+    std::vector<search_result<T>> results(pool.size());
+
+    if(problem.space.size() > 0 and detail::satisfies_constraints_at<0>(problem, problem.space[0]))
+    {
+      const auto& first_axis = std::get<0>(problem.space.axes());
+
+      pool.for_each(first_axis.values.size(), [&](std::size_t participant, std::size_t c)
+      {
+        environment_type env = problem.space[0];
+        auto region = detail::interval_environment(problem.space);
+        std::array<std::size_t, environment_type::size()> coordinates{};
+
+        detail::assign(env, first_axis, c);
+        detail::assign(region, first_axis, c);
+        coordinates[0] = c;
+
+        if(detail::satisfies_constraints_at<1>(problem, env) and detail::may_improve(problem, region, results[participant]))
+        {
+          detail::descend_bounded<1>(problem, env, region, coordinates, results[participant]);
+        }
+      });
+    }
+
+    for(std::size_t i = 1; i < results.size(); ++i)
+    {
+      results[0].combine(results[i]);
+    }
+
+    return results[0];
+  }
+};
+
+// a random_restart search descends from random points to their best neighbor, which differs by
+// one position along one axis, until no neighbor is better
+//
+// restarts run in parallel. restart r draws its starting point from a generator seeded with
+// seed + r, so the result depends only on seed
+struct random_restart
+{
+  constexpr static std::string_view name = "random_restart";
+
+  std::size_t num_restarts = 16;
+  std::uint64_t seed = 0;
+
+  // the parameters which, with name, identify the search in a tuning_cache
+  constexpr std::tuple<std::size_t,std::uint64_t> parameters() const
+  {
+    return {num_restarts, seed};
+  }
+
+  template<class Problem>
+  auto search(const Problem& problem, thread_pool& pool) const
+  {
+    using T = typename Problem::cost_type;
+    constexpr std::size_t num_axes = Problem::environment_type::size();
+
+    std::vector<search_result<T>> results(pool.size());
+
+    if(problem.space.size() == 0) return results[0];
+
+    std::array<std::size_t, num_axes> sizes = std::apply([](const auto&... axes)
+    {
+      return std::array<std::size_t, num_axes>{axes.values.size()...};
+    },
+    problem.space.axes());
+
+    pool.for_each(num_restarts, [&](std::size_t participant, std::size_t restart)
+    {
+      auto& result = results[participant];
+
+      // infeasible points are worse than any feasible point
+      auto cost_of = [&](const std::array<std::size_t, num_axes>& coordinates)
+      {
+        ++result.num_evaluated;
+        return problem.cost_of(problem.space.point(coordinates));
+      };
+
+      auto better = [](const std::optional<T>& a, const std::optional<T>& b)
+      {
+        return a and (not b or *a < *b);
+      };
+
+      std::mt19937_64 generator(seed + restart);
+
+      std::array<std::size_t, num_axes> current;
+      for(std::size_t k = 0; k < num_axes; ++k)
+      {
+        current[k] = std::uniform_int_distribution<std::size_t>(0, sizes[k] - 1)(generator);
+      }
+
+      std::optional<T> current_cost = cost_of(current);
+
+      for(;;)
+      {
+        std::array<std::size_t, num_axes> best_neighbor = current;
+        std::optional<T> best_neighbor_cost;
+
+        for(std::size_t k = 0; k < num_axes; ++k)
+        {
+          for(int step : {-1, +1})
+          {
+            if((step < 0 and current[k] == 0) or (step > 0 and current[k] + 1 == sizes[k])) continue;
+
+            std::array<std::size_t, num_axes> neighbor = current;
+            neighbor[k] += step;
+
+            std::optional<T> neighbor_cost = cost_of(neighbor);
+            if(better(neighbor_cost, best_neighbor_cost))
+            {
+              best_neighbor = neighbor;
+              best_neighbor_cost = neighbor_cost;
+            }
+          }
+        }
+
+        if(not better(best_neighbor_cost, current_cost)) break;
+
+        current = best_neighbor;
+        current_cost = best_neighbor_cost;
+      }
+
+      if(current_cost) result.consider(*current_cost, problem.space.point(current));
+    });
+
+    for(std::size_t i = 1; i < results.size(); ++i)
+    {
+      results[0].combine(results[i]);
+    }
+
+    return results[0];
+  }
+};
+
+
+// the outcome of tune
+template<class Env, class T>
+struct tuning_result
+{
+  // the best point found, or nothing when no point satisfied the constraints
+  std::optional<Env> best;
+  T cost;
+
+  std::size_t num_evaluated;
+  double seconds;
+
+  double evaluations_per_second() const
+  {
+    return seconds > 0 ? num_evaluated / seconds : 0;
+  }
+};
+
+// searches space with strategy for the point which minimizes cost subject to constraints,
+// a tuple of expressions whose values are bool
+template<unevaluated C, class... Cs, class... Axes, class S = exhaustive>
+auto tune(const C& cost, const std::tuple<Cs...>& constraints, const parameter_space<Axes...>& space, const S& strategy = {}, thread_pool& pool = thread_pool::default_pool())
+{
+  using problem_type = tuning_problem<C,std::tuple<Cs...>,parameter_space<Axes...>>;
+  using environment_type = typename problem_type::environment_type;
+  using T = typename problem_type::cost_type;
+
+  problem_type problem{cost, constraints, space};
+
+  auto start = std::chrono::steady_clock::now();
+  search_result<T> found = strategy.search(problem, pool);
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+  std::optional<environment_type> best;
+  if(found.point != search_result<T>::npos) best = space[found.point];
+
+  return tuning_result<environment_type,T>{best, found.cost, found.num_evaluated, elapsed.count()};
+}
+
+// searches as tune does, unless cache already holds the result of the same search
+//
+// the search is identified by a fingerprint of the structure of cost and constraints, of the name and
+// values of each axis, and of the strategy's name and parameters, as strategies which are not
+// exhaustive may find different points. its result is stored as the number of the best point and
+// its cost. a result found in cache reports no evaluations.
+template<unevaluated C, class... Cs, class... Axes, class S = exhaustive>
+  requires (cacheable<typename tuning_problem<C,std::tuple<Cs...>,parameter_space<Axes...>>::cost_type> and requires { { S::name } -> std::convertible_to<std::string_view>; })
+auto tune(const C& cost, const std::tuple<Cs...>& constraints, const parameter_space<Axes...>& space, const S& strategy, tuning_cache& cache, thread_pool& pool = thread_pool::default_pool())
+{
+  using problem_type = tuning_problem<C,std::tuple<Cs...>,parameter_space<Axes...>>;
+  using environment_type = typename problem_type::environment_type;
+  using T = typename problem_type::cost_type;
+
+  fingerprint key;
+  key.add(structural_hash(cost));
+  std::apply([&](const auto&... c)
+  {
+    (key.add(structural_hash(c)), ...);
+  },
+  constraints);
+
+  std::apply([&](const auto&... axes)
+  {
+    ([&]
+    {
+      key.add(axes.name).add(axes.values.size());
+      for(const auto& value : axes.values)
+      {
+        key.add(value);
+      }
+    }(), ...);
+  },
+  space.axes());
+
+  key.add(std::string_view(S::name));
+  if constexpr (requires { strategy.parameters(); })
+  {
+    std::apply([&](const auto&... parameter)
+    {
+      (key.add(parameter), ...);
+    },
+    strategy.parameters());
+  }
+
+  auto start = std::chrono::steady_clock::now();
+
+  search_result<T> found;
+  if(auto cached = cache.find<std::tuple<std::uint64_t,T>>(key.value()))
+  {
+    found.point = std::get<0>(*cached);
+    found.cost = std::get<1>(*cached);
+  }
+  else
+  {
+    found = strategy.search(problem_type{cost, constraints, space}, pool);
+    cache.insert(key.value(), std::tuple<std::uint64_t,T>(found.point, found.cost));
+  }
+
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+  std::optional<environment_type> best;
+  if(found.point != search_result<T>::npos) best = space[found.point];
+
+  return tuning_result<environment_type,T>{best, found.cost, found.num_evaluated, elapsed.count()};
+}
@@ -0,0 +1,371 @@
+#pragma once
+
+#include "fingerprint.hpp"
+#include <array>
+#include <bit>
+#include <cerrno>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string_view>
+#include <system_error>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <fmt/format.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// the key under which a tuning_cache stores the value of expr in env
+//
+// the key is a fingerprint of expr's structural hash and of the name and value of each of its
+// variables, so bindings which expr does not use do not affect it. structural_hash and
+// for_each_binding are found by argument-dependent lookup, so this works with either front end.
+template<class E, class Env>
+std::uint64_t tuning_key(const E& expr, const Env& env)
+{
+  fingerprint result;
+  result.add(structural_hash(expr));
+
+  for_each_binding(expr, env, [&](std::string_view name, const auto& value)
+  {
+    result.add(name).add(value);
+  });
+
+  return result.value();
+}
+
+
+namespace detail
+{
+
+template<class T>
+struct is_tuple : std::false_type {};
+
+template<class... Ts>
+struct is_tuple<std::tuple<Ts...>> : std::true_type {};
+
+template<class T>
+struct is_cacheable : std::is_trivially_copyable<T> {};
+
+template<class... Ts>
+struct is_cacheable<std::tuple<Ts...>> : std::conjunction<is_cacheable<Ts>...> {};
+
+template<class T>
+constexpr std::size_t cached_size()
+{
+  if constexpr (is_tuple<T>::value)
+  {
+    return []<class... Ts>(std::type_identity<std::tuple<Ts...>>)
+    {
+      return (std::size_t(0) + ... + cached_size<Ts>());
+    }(std::type_identity<T>());
+  }
+  else
+  {
+    return sizeof(T);
+  }
+}
+
+// tuples are stored element by element, as a tuple itself is not trivially copyable
+template<class T>
+void store(const T& value, std::byte*& out)
+{
+  if constexpr (is_tuple<T>::value)
+  {
+    std::apply([&](const auto&... elements)
+    {
+      (store(elements, out), ...);
+    },
+    value);
+  }
+  else
+  {
+    std::memcpy(out, &value, sizeof(T));
+    out += sizeof(T);
+  }
+}
+
+template<class T>
+T load(const std::byte*& in)
+{
+  if constexpr (is_tuple<T>::value)
+  {
+    return []<class... Ts>(std::type_identity<std::tuple<Ts...>>, const std::byte*& in)
+    {
+      // braced initialization loads the elements in order
+      return std::tuple<Ts...>{load<Ts>(in)...};
+    }(std::type_identity<T>(), in);
+  }
+  else
+  {
+    T result;
+    std::memcpy(&result, in, sizeof(T));
+    in += sizeof(T);
+    return result;
+  }
+}
+
+} // end detail
+
+
+// a value may be cached if it is trivially copyable or a tuple of such values
+template<class T>
+concept cacheable = detail::is_cacheable<T>::value;
+
+
+// a tuning_cache is a file of values, such as tuning results, keyed by 64-bit fingerprints
+//
+// the file is append-only: inserting a key which is already present appends a new record, which
+// later lookups prefer. the file is memory-mapped, and lookups copy values directly out of the
+// mapping through an index built once by scanning it.
+//
+// any number of processes on one host may share a file. appends are serialized by an exclusive
+// flock, and each record carries a checksum, so a reader never accepts a record which is still being
+// written, and the next writer overwrites the partial record of one which crashed. the file never
+// shrinks, as other processes may have mapped all of it. a lookup which misses rescans the file for
+// records appended by other processes since.
+//
+// a tuning_cache object is not safe to use from several threads at once; give each its own.
+class tuning_cache
+{
+  public:
+    explicit tuning_cache(const std::filesystem::path& path)
+      : fd_{::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644)}
+    {
+      if(fd_ < 0) throw std::system_error(errno, std::generic_category(), fmt::format("tuning_cache: could not open {}", path.string()));
+
+      try
+      {
+        {
+          file_lock lock{fd_};
+          if(file_size() == 0) write_all(0, &magic, sizeof(magic));
+        }
+
+        refresh();
+
+        if(mapped_size_ < sizeof(magic) or std::memcmp(mapping_, &magic, sizeof(magic)) != 0)
+        {
+          throw std::runtime_error(fmt::format("tuning_cache: {} is not a tuning cache", path.string()));
+        }
+      }
+      catch(...)
+      {
+        unmap();
+        ::close(fd_);
+        throw;
+      }
+    }
+
+    tuning_cache(const tuning_cache&) = delete;
+
+    ~tuning_cache()
+    {
+      unmap();
+      ::close(fd_);
+    }
+
+    // returns the value most recently stored under key, or nothing if there is none
+    //
+    // a value stored as a different type is treated as missing when its size differs from T's
+    template<cacheable T>
+    std::optional<T> find(std::uint64_t key)
+    {
+      auto found = index_.find(key);
+      if(found == index_.end())
+      {
+        refresh();
+        found = index_.find(key);
+        if(found == index_.end()) return std::nullopt;
+      }
+
+      record_header header = read_header(found->second);
+      if(header.size != detail::cached_size<T>()) return std::nullopt;
+
+      const std::byte* payload = mapping_ + found->second + sizeof(record_header);
+      return detail::load<T>(payload);
+    }
+
+    // appends a record storing value under key
+    template<cacheable T>
+    void insert(std::uint64_t key, const T& value)
+    {
+      constexpr std::size_t size = detail::cached_size<T>();
+
+      std::vector<std::byte> record(sizeof(record_header) + padded(size));
+      std::byte* payload = record.data() + sizeof(record_header);
+      std::byte* out = payload;
+      detail::store(value, out);
+
+      record_header header{key, std::uint32_t(size), checksum(key, {payload, size})};
+      std::memcpy(record.data(), &header, sizeof(header));
+
+      {
+        file_lock lock{fd_};
+        refresh();
+
+        // a record which fails its checksum at the end of the file was left by a writer which crashed.
+        // it is written over rather than truncated, so that no other process's mapping of it is cut short
+        write_all(end_, record.data(), record.size());
+      }
+
+      refresh();
+    }
+
+    // indexes records appended since the last refresh, including those of other processes
+    void refresh()
+    {
+      std::size_t size = file_size();
+      if(size != mapped_size_)
+      {
+        unmap();
+        if(size != 0)
+        {
+          void* mapping = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd_, 0);
+          if(mapping == MAP_FAILED) throw std::system_error(errno, std::generic_category(), "tuning_cache: mmap");
+          mapping_ = static_cast<const std::byte*>(mapping);
+        }
+        mapped_size_ = size;
+      }
+
+      if(end_ < sizeof(magic)) end_ = sizeof(magic);
+
+      while(end_ + sizeof(record_header) <= mapped_size_)
+      {
+        record_header header = read_header(end_);
+        std::size_t record_size = sizeof(record_header) + padded(header.size);
+        if(mapped_size_ - end_ < record_size) break;
+
+        std::span<const std::byte> payload(mapping_ + end_ + sizeof(record_header), header.size);
+        if(header.checksum != checksum(header.key, payload)) break;
+
+        index_[header.key] = end_;
+        end_ += record_size;
+      }
+    }
+
+    // the number of distinct keys indexed
+    std::size_t size() const
+    {
+      return index_.size();
+    }
+
+  private:
+    constexpr static std::uint64_t magic = 0x3165686361637276; // "vrcache1"
+
+    struct record_header
+    {
+      std::uint64_t key;
+      std::uint32_t size;
+      std::uint32_t checksum;
+    };
+
+    struct file_lock
+    {
+      explicit file_lock(int fd)
+        : fd{fd}
+      {
+        if(::flock(fd, LOCK_EX) != 0) throw std::system_error(errno, std::generic_category(), "tuning_cache: flock");
+      }
+
+      file_lock(const file_lock&) = delete;
+
+      ~file_lock()
+      {
+        ::flock(fd, LOCK_UN);
+      }
+
+      int fd;
+    };
+
+    // records are padded so that each header is aligned
+    constexpr static std::size_t padded(std::size_t size)
+    {
+      return (size + alignof(record_header) - 1) / alignof(record_header) * alignof(record_header);
+    }
+
+    static std::uint32_t checksum(std::uint64_t key, std::span<const std::byte> payload)
+    {
+      fingerprint result;
+      result.add(key);
+      for(std::byte b : payload)
+      {
+        result.add(b);
+      }
+
+      return std::uint32_t(result.value());
+    }
+
+    record_header read_header(std::size_t offset) const
+    {
+      record_header result;
+      std::memcpy(&result, mapping_ + offset, sizeof(result));
+      return result;
+    }
+
+    std::size_t file_size() const
+    {
+      struct stat s;
+      if(::fstat(fd_, &s) != 0) throw std::system_error(errno, std::generic_category(), "tuning_cache: fstat");
+      return s.st_size;
+    }
+
+    // writes at offset rather than appending, so that a partial record may be written over
+    void write_all(std::size_t offset, const void* data, std::size_t size)
+    {
+      const char* bytes = static_cast<const char*>(data);
+      while(size > 0)
+      {
+        ssize_t written = ::pwrite(fd_, bytes, size, offset);
+        if(written < 0)
+        {
+          if(errno == EINTR) continue;
+          throw std::system_error(errno, std::generic_category(), "tuning_cache: pwrite");
+        }
+
+        bytes += written;
+        offset += written;
+        size -= written;
+      }
+    }
+
+    void unmap()
+    {
+      if(mapping_) ::munmap(const_cast<std::byte*>(mapping_), mapped_size_);
+      mapping_ = nullptr;
+      mapped_size_ = 0;
+    }
+
+    int fd_;
+    const std::byte* mapping_ = nullptr;
+    std::size_t mapped_size_ = 0;
+
+    // the offset just past the last valid record scanned
+    std::size_t end_ = 0;
+    std::unordered_map<std::uint64_t, std::size_t> index_;
+};
+
+
+// returns the value of expr in env from cache, evaluating and storing it on a miss
+template<class E, class Env>
+auto cached_evaluate(const E& expr, const Env& env, tuning_cache& cache)
+{
+  using T = decltype(evaluate(expr, env));
+
+  std::uint64_t key = tuning_key(expr, env);
+  if(auto found = cache.template find<T>(key)) return *found;
+
+  T result = evaluate(expr, env);
+  cache.insert(key, result);
+  return result;
+}
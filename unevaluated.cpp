@@ -1,8 +1,22 @@
 #include "unevaluated.hpp"
+#include "any_expression.hpp"
+#include "memo.hpp"
+#include "shared_environment.hpp"
+#include "tuning_cache.hpp"
+#include <array>
+#include <atomic>
 #include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
 #include <fmt/core.h>
 #include <fmt/ranges.h>
 #include <iostream>
+#include <numeric>
+#include <span>
+#include <thread>
+#include <vector>
+#include <unistd.h>
 
 template<class N, class D>
 constexpr auto ceil_div(N n, D d)
@@ -10,6 +24,86 @@ constexpr auto ceil_div(N n, D d)
   return (n + d - 1) / d;
 }
 
+template<class E>
+concept compilable = requires(const E& expr, const schema& s) { compile(expr, s); };
+
+template<class E>
+concept memoizable = requires { typename memoized<E,int>; };
+
+// counts calls to the global allocator
+//
+// the replacements are not inlined, so that the compiler does not see operator delete free a pointer
+// which, for all it knows, operator new did not get from malloc. the array forms are replaced
+// as well, so that every form of new is paired with a delete which frees what it allocates
+std::atomic<std::size_t> num_allocations = 0;
+
+[[gnu::noinline]] void* operator new(std::size_t size)
+{
+  ++num_allocations;
+  if(void* result = std::malloc(size)) return result;
+  throw std::bad_alloc();
+}
+
+[[gnu::noinline]] void* operator new[](std::size_t size)
+{
+  return operator new(size);
+}
+
+[[gnu::noinline]] void operator delete(void* ptr) noexcept
+{
+  std::free(ptr);
+}
+
+[[gnu::noinline]] void operator delete(void* ptr, std::size_t) noexcept
+{
+  std::free(ptr);
+}
+
+[[gnu::noinline]] void operator delete[](void* ptr) noexcept
+{
+  std::free(ptr);
+}
+
+[[gnu::noinline]] void operator delete[](void* ptr, std::size_t) noexcept
+{
+  std::free(ptr);
+}
+
+// counts the number of times it is copied
+struct count_copies
+{
+  int* copies;
+
+  explicit count_copies(int* copies)
+    : copies{copies}
+  {}
+
+  count_copies(const count_copies& other)
+    : copies{other.copies}
+  {
+    ++*copies;
+  }
+
+  int operator()(int x) const
+  {
+    return x;
+  }
+};
+
+// counts the number of times it is called
+struct count_calls
+{
+  int* calls;
+
+  constexpr int operator()(int x) const
+  {
+    ++*calls;
+    return x;
+  }
+
+  bool operator==(const count_calls&) const = default;
+};
+
 int main()
 {
   using namespace fmt;
@@ -163,6 +257,48 @@ int main()
       assert(((12345+128-1)/128) == evaluate(expr, new_env));
     }
 
+    {
+      // constants are folded together as expressions are built
+      auto expr = ((foo + 7_c) - 10_c) * 3_c * 2_c;
+      assert("(foo+-3)*6" == format("{}", expr));
+      assert(((13 + 7 - 10) * 3 * 2) == evaluate(expr, env));
+
+      auto flipped = (7_c - foo) + 10_c;
+      assert("17-foo" == format("{}", flipped));
+      assert((7 - 13 + 10) == evaluate(flipped, env));
+
+      // the value of a constant is part of its type, so identities cost nothing
+      static_assert(std::same_as<variable<int>, decltype(foo * 1_c)>);
+      static_assert(std::same_as<variable<int>, decltype(0_c + foo)>);
+      static_assert(std::same_as<variable<int>, decltype(foo / 1_c - 0_c)>);
+      assert("foo" == format("{}", (foo + 2_c) - 2_c));
+      assert("foo*1" == format("{}", foo * 1));
+
+      // constants may be spelled in any base an integer literal may
+      static_assert(std::same_as<constant<16>, decltype(0x10_c)>);
+      static_assert(std::same_as<constant<8>, decltype(010_c)>);
+      static_assert(std::same_as<constant<3>, decltype(0b11_c)>);
+      static_assert(std::same_as<constant<1000>, decltype(1'000_c)>);
+      static_assert(std::same_as<constant<0xffffffffu>, decltype(0xffffffff_c)>);
+      static_assert(std::same_as<constant<4294967295l>, decltype(4294967295_c)>);
+
+      // literals of different types are not reassociated
+      assert("(foo+1)-2.5" == format("{}", (foo + 1) - 2.5));
+
+      // signed literals whose values are not part of their types cannot be checked for overflow
+      // as the expression is built, so they are not reassociated
+      assert("(foo+7)-10" == format("{}", (foo + 7) - 10));
+
+      // nor are constants whose folded value would overflow
+      assert("(foo+2147483647)--1" == format("{}", (foo + constant<std::numeric_limits<int>::max()>()) - constant<-1>()));
+
+      // unsigned literals are folded modulo 2^N, which reassociates them exactly
+      variable<unsigned> n{"n"};
+      auto wrapped = (n + 1u) - 2u;
+      assert("n+4294967295" == format("{}", wrapped));
+      assert(12u == evaluate(wrapped, environment{ {"n", 13u} }));
+    }
+
     {
       auto num_blocks = ceil_div(12345, "block_size"_v);
       std::tuple shape("block_size"_v, num_blocks);
@@ -173,6 +309,483 @@ int main()
       assert(std::tuple(128, (12345+128-1)/128) == evaluate(shape, new_env));
     }
 
+    {
+      symbol_table symbols;
+      auto expr = intern(ceil_div(12345, "block_size"_v), symbols);
+      assert("((12345+block_size)-1)/block_size" == format("{}", expr));
+      assert(0 == symbols.find("block_size"));
+
+      slot_environment slots{symbols, env};
+      slots.set("block_size", 128);
+      assert(((12345+128-1)/128) == evaluate(expr, slots));
+
+      // a variable which has not been interned is found by name
+      assert(13 == evaluate(foo, slots));
+
+      auto shape = intern(std::tuple("block_size"_v, "foo"_v + 1), symbols);
+      assert(std::tuple(128, 14) == evaluate(shape, slots));
+
+      try
+      {
+        evaluate(intern("no_binding"_v, symbols), slots);
+        assert(false);
+      }
+      catch(std::runtime_error)
+      {
+      }
+    }
+
+    {
+      schema s;
+      s.declare<int>("block_size");
+      s.declare<int>("foo");
+
+      auto num_blocks = compile(ceil_div(12345, "block_size"_v), s);
+      auto shape = compile(std::tuple("block_size"_v, num_blocks.expression() + "foo"_v), s);
+
+      std::vector<scalar> arguments{128, 13};
+      assert(((12345+128-1)/128) == num_blocks(arguments));
+      assert(std::tuple(128, (12345+128-1)/128 + 13) == shape(arguments));
+
+      auto new_env = env;
+      new_env["block_size"] = 256;
+      assert(((12345+256-1)/256) == num_blocks(s.arguments(new_env)));
+
+      try
+      {
+        compile("no_binding"_v, s);
+        assert(false);
+      }
+      catch(std::runtime_error)
+      {
+      }
+
+      try
+      {
+        compile(variable<double>{"foo"}, s);
+        assert(false);
+      }
+      catch(std::bad_any_cast)
+      {
+      }
+    }
+
+    {
+      std::vector<int> n(1000);
+      std::vector<int> block_size(n.size());
+      std::iota(n.begin(), n.end(), 12000);
+      for(std::size_t i = 0; i < block_size.size(); ++i) block_size[i] = 32 << (i % 6);
+
+      environment columns{ {"n", std::span<const int>(n)}, {"block_size", std::span<const int>(block_size)} };
+
+      auto expr = -ceil_div("n"_v, "block_size"_v) * 2;
+
+      std::vector<int> result(n.size());
+      evaluate_batch(expr, columns, std::span(result));
+
+      for(std::size_t i = 0; i < result.size(); ++i)
+      {
+        assert(-((n[i] + block_size[i] - 1) / block_size[i]) * 2 == result[i]);
+      }
+
+      // a name may also be bound to a single value shared by every element
+      columns["block_size"] = 128;
+      evaluate_batch(expr, columns, std::span(result));
+
+      for(std::size_t i = 0; i < result.size(); ++i)
+      {
+        assert(-((n[i] + 128 - 1) / 128) * 2 == result[i]);
+      }
+
+      try
+      {
+        std::vector<int> too_long(n.size() + 1);
+        evaluate_batch(expr, columns, std::span(too_long));
+        assert(false);
+      }
+      catch(std::out_of_range)
+      {
+      }
+    }
+
+    {
+      auto new_env = env;
+      new_env["block_size"] = 128;
+      new_env["n"] = 12345;
+
+      auto num_blocks = ceil_div("n"_v, "block_size"_v);
+      std::tuple shape(num_blocks, "block_size"_v, num_blocks * 4);
+
+      assert(std::tuple(97, 128, 97 * 4) == evaluate(shape, new_env));
+      assert(evaluate(shape, new_env) == evaluate(common_subexpressions(shape), new_env));
+
+      // each distinct subexpression is computed once per evaluation
+      int calls = 0;
+      op1<decltype(num_blocks), count_calls> counted{num_blocks, {&calls}};
+
+      evaluate(std::tuple(counted, counted + 1, 2 * counted), new_env);
+      assert(3 == calls);
+
+      calls = 0;
+      common_subexpressions shared(counted, counted + 1, 2 * counted);
+      assert(std::tuple(97, 98, 194) == evaluate(shared, new_env));
+      assert(1 == calls);
+
+      // subexpressions of the same type are compared by name and value
+      calls = 0;
+      op1<decltype(num_blocks), count_calls> other{ceil_div("n"_v, "foo"_v), {&calls}};
+      assert(std::tuple(97, (12345 + 13 - 1) / 13) == evaluate(common_subexpressions(counted, other), new_env));
+      assert(2 == calls);
+    }
+
+    {
+      // dividing by a divider agrees with the built-in operators, including for negative operands
+      constexpr int min = std::numeric_limits<int>::min();
+      constexpr int max = std::numeric_limits<int>::max();
+
+      for(int d : {1, -1, 2, 3, -7, 128, -128, 1000, max, min})
+      {
+        divider<int> divisor{d};
+
+        for(int n : {0, 1, -1, 6, -6, 12345, -12345, max, min + 1})
+        {
+          assert(n / d == n / divisor);
+          assert(n % d == n % divisor);
+        }
+      }
+
+      // a variable bound to a divider divides by multiplication
+      auto expr = ceil_div("n"_v, "block_size"_v) + "n"_v % "block_size"_v;
+      int expected = ceil_div(-12345, -128) + -12345 % -128;
+
+      environment new_env{ {"n", -12345}, {"block_size", divider<int>{-128}} };
+      assert(expected == evaluate(expr, new_env));
+
+      schema s;
+      s.declare<int>("n");
+      s.declare<divider<int>>("block_size");
+
+      auto compiled = compile(expr, s);
+      assert(expected == compiled(s.arguments(new_env)));
+
+      // dividing a column by a single value computes its divider once per chunk
+      std::vector<int> n(1000);
+      std::iota(n.begin(), n.end(), -500);
+
+      environment columns{ {"n", std::span<const int>(n)}, {"block_size", -7} };
+
+      std::vector<int> result(n.size());
+      evaluate_batch(expr, columns, std::span(result));
+
+      for(std::size_t i = 0; i < result.size(); ++i)
+      {
+        assert(ceil_div(n[i], -7) + n[i] % -7 == result[i]);
+      }
+    }
+
+    {
+      // binding only n leaves a residual which depends on block_size alone
+      int calls = 0;
+      op1<variable<int>, count_calls> counted{"n"_v, {&calls}};
+
+      std::tuple expr(ceil_div(counted, "block_size"_v), "n"_v * 4);
+      auto specialized = partially_evaluate(expr, environment{ {"n", 12345} });
+      assert(1 == calls);
+      assert(12345 * 4 == std::get<1>(specialized).value);
+      assert("((12345+block_size)-1)/block_size" == fmt::format("{}", std::get<0>(specialized)));
+
+      environment late{ {"block_size", 128} };
+      assert(std::tuple(97, 12345 * 4) == evaluate(specialized, late));
+      assert(std::tuple(97, 12345 * 4) == evaluate(specialized, late));
+      assert(1 == calls);
+
+      // only the variables left unbound need be declared to compile a residual
+      schema s;
+      s.declare<int>("block_size");
+
+      auto launch = compile(specialized, s);
+      assert(std::tuple(49, 12345 * 4) == launch(std::vector<scalar>{256}));
+      assert(1 == calls);
+    }
+
+    {
+      // changing one binding recomputes only the subexpressions which depend on it
+      environment new_env{ {"block_size", 128}, {"n", 12345}, {"m", 100} };
+      evaluation_session session(new_env, ceil_div("n"_v, "block_size"_v), "m"_v * 2 + 1);
+
+      assert(std::tuple(97, 201) == evaluate(session));
+      assert(5 == session.num_recomputed());
+      assert(0 == session.num_reused());
+
+      // the first expression is reused whole, from its root
+      session.set("m", 50);
+      assert(std::tuple(97, 101) == evaluate(session));
+      assert(7 == session.num_recomputed());
+      assert(1 == session.num_reused());
+
+      session.set("block_size", 256);
+      assert(std::tuple(49, 101) == evaluate(session));
+      assert(10 == session.num_recomputed());
+      assert(2 == session.num_reused());
+    }
+
+    {
+      environment new_env{ {"n", 12345}, {"block_size", 128} };
+
+      alignas(std::max_align_t) std::array<std::byte, 1024> buffer;
+      expression_arena arena(buffer);
+
+      static_assert(64 == sizeof(any_expression<int>));
+
+      // neither creating nor destroying expressions allocates
+      std::size_t allocations = num_allocations;
+      {
+        any_expression<int> small("n"_v + 1);
+        any_expression<int> large(ceil_div("n"_v, "block_size"_v), arena);
+        std::size_t used = arena.size();
+
+        // expressions of any_expressions may be erased in turn
+        any_expression<int> combined(small * large, arena);
+        any_expression<int> copy = combined;
+        copy = small;
+
+        assert(12346 == evaluate(small, new_env));
+        assert(97 == evaluate(large, new_env));
+        assert(12346 * 97 == evaluate(combined, new_env));
+        assert(12346 == evaluate(copy, new_env));
+        assert(used < arena.size());
+      }
+      assert(allocations == num_allocations);
+
+      std::vector<any_expression<int>> forest{any_expression<int>("n"_v * 2), any_expression<int>(ceil_div("n"_v, "block_size"_v), arena), any_expression<int>("block_size"_v)};
+      forest.push_back(any_expression<int>(forest[0] - forest[1], arena));
+
+      std::vector<int> values;
+      for(const auto& expr : forest)
+      {
+        values.push_back(evaluate(expr, new_env));
+      }
+
+      assert((std::vector{12345 * 2, 97, 128, 12345 * 2 - 97}) == values);
+      assert("(n*2)-(((n+block_size)-1)/block_size)" == fmt::format("{}", forest[3]));
+
+      // the variables of an any_expression are hidden, so neither it nor an expression containing
+      // one may be compiled
+      static_assert(not compilable<any_expression<int>>);
+      static_assert(not compilable<decltype(forest[0] + "n"_v)>);
+      static_assert(compilable<decltype("n"_v + 1)>);
+
+      try
+      {
+        expression_arena tiny(std::span(buffer.data(), 8));
+        any_expression<int>(ceil_div("n"_v, "block_size"_v), tiny);
+        assert(false);
+      }
+      catch(std::bad_alloc)
+      {
+      }
+    }
+
+    {
+      // binding and evaluating scalars does not allocate
+      std::size_t allocations = num_allocations;
+      {
+        scalar n = 12345;
+        scalar block_size = divider<int>(128);
+        scalar copy = block_size;
+
+        assert(12345 == scalar_cast<int>(n));
+        assert(nullptr == scalar_cast<long>(&n));
+        assert(128 == scalar_cast<divider<int>>(copy).divisor());
+        assert(typeid(divider<int>) == copy.type());
+        assert(typeid(int) == n.type());
+      }
+      assert(allocations == num_allocations);
+
+      symbol_table symbols;
+      auto expr = intern(ceil_div("n"_v, "block_size"_v), symbols);
+      slot_environment slots(symbols, environment{ {"n", 12345}, {"block_size", 128} });
+
+      allocations = num_allocations;
+      assert(97 == evaluate(expr, slots));
+      slots.set("block_size", 256);
+      assert(49 == evaluate(expr, slots));
+      assert(allocations == num_allocations);
+
+      try
+      {
+        scalar_cast<unsigned>(scalar(7));
+        assert(false);
+      }
+      catch(bad_scalar_cast)
+      {
+      }
+    }
+
+    {
+      auto path = std::filesystem::temp_directory_path() / fmt::format("unevaluated_test_{}.cache", getpid());
+      std::filesystem::remove(path);
+
+      environment new_env{ {"n", 12345}, {"block_size", 128}, {"unused", 7} };
+      auto expr = ceil_div("n"_v, "block_size"_v);
+
+      {
+        tuning_cache cache(path);
+        assert(97 == cached_evaluate(expr, new_env, cache));
+        assert(97 == cache.find<int>(tuning_key(expr, new_env)));
+
+        // bindings expr does not use are not part of its key
+        new_env["unused"] = 8;
+        assert(97 == cache.find<int>(tuning_key(expr, new_env)));
+      }
+
+      // a record left partially written by a crashed writer is ignored, then written over by the next
+      // write. the file never shrinks, as other processes may have mapped its tail
+      {
+        std::FILE* file = std::fopen(path.c_str(), "ab");
+        std::array<char,64> torn;
+        torn.fill('x');
+        std::fwrite(torn.data(), 1, torn.size(), file);
+        std::fclose(file);
+      }
+
+      auto torn_size = std::filesystem::file_size(path);
+
+      {
+        tuning_cache cache(path);
+        assert(1 == cache.size());
+        cache.insert(13, 42);
+        assert(torn_size == std::filesystem::file_size(path));
+      }
+
+      tuning_cache cache(path);
+      assert(2 == cache.size());
+      assert(42 == cache.find<int>(13));
+
+      cache.insert(14, 43);
+      assert(3 == cache.size());
+      assert(43 == cache.find<int>(14));
+      assert(torn_size == std::filesystem::file_size(path));
+
+      std::filesystem::remove(path);
+    }
+
+    {
+      memo_table<std::tuple<int,int>> table(64, 4);
+      memoized shape(std::tuple(ceil_div("n"_v, "block_size"_v), "block_size"_v), table);
+
+      // expressions which structural_hash cannot tell apart from others would share keys
+      static_assert(memoizable<decltype(-"n"_v % 2)>);
+      static_assert(not memoizable<op2<variable<int>,int,std::bit_xor<>>>);
+      static_assert(not memoizable<decltype(any_expression<int>("n"_v) + 1)>);
+
+      environment new_env{ {"n", 12345}, {"block_size", 128} };
+      assert(std::tuple(97, 128) == shape(new_env));
+      assert(std::tuple(97, 128) == shape(new_env));
+      assert(1 == table.num_hits());
+      assert(1 == table.num_misses());
+
+      // many threads find the same entries without locking
+      std::vector<std::thread> readers;
+      for(int t = 0; t < 4; ++t)
+      {
+        readers.emplace_back([&]
+        {
+          for(int block_size = 1; block_size <= 1000; ++block_size)
+          {
+            environment thread_env{ {"n", 12345}, {"block_size", 32 * (block_size % 8 + 1)} };
+            assert(std::tuple(ceil_div(12345, 32 * (block_size % 8 + 1)), 32 * (block_size % 8 + 1)) == shape(thread_env));
+          }
+        });
+      }
+
+      for(auto& reader : readers)
+      {
+        reader.join();
+      }
+
+      assert(2 + 4000 == table.num_hits() + table.num_misses());
+
+      // distinct keys beyond the table's capacity evict earlier ones
+      for(int block_size = 1; block_size <= 1000; ++block_size)
+      {
+        new_env["block_size"] = block_size;
+        assert(std::tuple(ceil_div(12345, block_size), block_size) == shape(new_env));
+      }
+      assert(0 < table.num_evictions());
+
+      // an expression whose memoization is turned off does not consult the table
+      shape.set_enabled(false);
+      std::size_t lookups = table.num_hits() + table.num_misses();
+      assert(std::tuple(97, 128) == shape(environment{ {"n", 12345}, {"block_size", 128} }));
+      assert(lookups == table.num_hits() + table.num_misses());
+
+      // the bindings of a key are found by walking the expression in place, without copying it
+      int copies = 0;
+      auto sum = op1<variable<int>, count_copies>{"n"_v, count_copies{&copies}} + "block_size"_v;
+      copies = 0;
+
+      std::vector<std::string_view> names;
+      for_each_binding(sum, new_env, [&](std::string_view name, const auto&)
+      {
+        names.push_back(name);
+      });
+      assert((std::vector<std::string_view>{"n", "block_size"}) == names);
+      assert(0 == copies);
+    }
+
+    {
+      auto expr = ceil_div("n"_v, "block_size"_v) * ("tile"_v + 2_c) - 7;
+      std::array<char, 64> buffer;
+
+      // rendering copies names and operators into the buffer without allocating
+      std::size_t allocations = num_allocations;
+      std::string_view text = render_to(expr, buffer);
+      assert(allocations == num_allocations);
+
+      assert("((((n+block_size)-1)/block_size)*(tile+2))-7" == text);
+      assert(fmt::format("{}", expr) == text);
+
+      try
+      {
+        render_to(expr, std::span(buffer.data(), 8));
+        assert(false);
+      }
+      catch(std::length_error)
+      {
+      }
+    }
+
+    {
+      auto n = "n"_v;
+      auto block_size = "block_size"_v;
+
+      // structural hashes are the same on every platform and in both front ends
+      assert(0x6c000242d3f8e1e4 == structural_hash(n + 1));
+      assert(structural_hash(n + 1_c) == structural_hash(n + 1));
+      assert(structural_hash(n + 1) != structural_hash(n + 2));
+      assert(structural_hash(n + 1) != structural_hash(block_size + 1));
+      assert(structural_hash(n * (block_size + 1)) != structural_hash((n * block_size) + 1));
+
+      // hashing neither allocates nor depends on where names are stored
+      std::string name = "n";
+      std::size_t allocations = num_allocations;
+      assert(structural_hash(ceil_div(n, block_size)) == structural_hash(ceil_div(variable<int>{name}, block_size)));
+      assert(allocations == num_allocations);
+
+      assert(structurally_equal(ceil_div(n, block_size), ceil_div(variable<int>{name}, block_size)));
+      assert(not structurally_equal(n + 1, n + 2));
+      assert(not structurally_equal(n + 1, block_size + 1));
+      assert(structurally_equal(n + 1_c, n + 1));
+      assert(not structurally_equal(n / 2, n / 2.0));
+
+      // a residual with a value is the same as that value
+      auto specialized = partially_evaluate(n * block_size + n, environment{ {"n", 12345} });
+      auto expected = 12345 * block_size + 12345;
+      assert(structural_hash(expected) == structural_hash(specialized));
+      assert(structurally_equal(specialized, expected));
+    }
+
     {
       try
       {
@@ -201,6 +814,138 @@ int main()
     }
   }
 
+  {
+    auto n = "n"_v;
+    auto block_size = "block_size"_v;
+    environment env{ {"n", 12345}, {"block_size", 128} };
+
+    // instrumented evaluation records each operation and variable, at its position in preorder
+    profile p;
+    auto expr = ceil_div(n, block_size);
+    assert(97 == evaluate(expr, env, not_instrumented()));
+    for(int i = 0; i < 10; ++i)
+    {
+      assert(97 == evaluate(expr, env, instrumented{&p}));
+    }
+
+    std::vector<profile_entry> entries = p.snapshot();
+    assert(6 == entries.size());
+
+    std::vector<std::string_view> labels;
+    for(const profile_entry& e : entries)
+    {
+      assert(structural_hash(expr) == e.expression);
+      assert(10 == e.calls);
+      labels.push_back(e.label);
+    }
+
+    assert((std::vector<std::string_view>{"/", "-", "+", "n", "block_size", "block_size"} == labels));
+
+    // a divisor bound to a divider is still recorded
+    environment with_divider{ {"n", 12345}, {"block_size", divider(128)} };
+    assert(97 == evaluate(expr, with_divider, instrumented{&p}));
+    assert(11 == p.snapshot().back().calls);
+
+    // a missing binding and a binding of the wrong type are recorded before evaluate throws
+    try
+    {
+      evaluate(expr, environment{ {"n", 12345} }, instrumented{&p});
+      assert(false);
+    }
+    catch(std::runtime_error)
+    {
+    }
+
+    try
+    {
+      evaluate(expr, environment{ {"n", 12345.0}, {"block_size", 128} }, instrumented{&p});
+      assert(false);
+    }
+    catch(bad_scalar_cast)
+    {
+    }
+
+    entries = p.snapshot();
+    assert(1 == entries[3].mismatches);
+    assert(1 == entries[4].misses);
+    assert(11 == entries[0].calls);
+
+    // the elements of a tuple are profiled as separate expressions
+    profile q;
+    evaluate(std::tuple(expr, block_size * 2), env, instrumented{&q});
+    assert(8 == q.snapshot().size());
+  }
+
+  {
+    auto n = "n"_v;
+    auto block_size = "block_size"_v;
+    auto tile = "tile"_v;
+    shared_environment shared{ environment{ {"n", 12345}, {"block_size", 128}, {"tile", 4} } };
+
+    auto first = shared.read();
+    assert(0 == first.version());
+    assert(97 == evaluate(ceil_div(n, block_size), *first));
+
+    // a batch of changes is one version
+    assert(1 == shared.assign(environment{ {"block_size", 256}, {"tile", 8} }));
+    assert(1 == shared.version());
+
+    {
+      auto second = shared.read();
+      assert(1 == second.version());
+      assert(49 == evaluate(ceil_div(n, block_size), *second));
+      assert(8 == scalar_cast<int>(second->find("tile")->second));
+    }
+
+    // a snapshot keeps the version it was taken from
+    assert(97 == evaluate(ceil_div(n, block_size), *first));
+    assert(1 == shared.num_retired());
+
+    // readers never see half of a batch
+    std::atomic<bool> done = false;
+    std::vector<std::thread> readers;
+    for(int t = 0; t < 4; ++t)
+    {
+      readers.emplace_back([&]
+      {
+        std::uint64_t last_version = 0;
+        std::uint64_t last_published = 0;
+        while(not done.load())
+        {
+          auto s = shared.read();
+          assert(last_version <= s.version());
+          last_version = s.version();
+          assert(32 * evaluate(tile, *s) == evaluate(block_size, *s));
+
+          // the current version's number may be read without a snapshot while updates replace it
+          std::uint64_t published = shared.version();
+          assert(last_published <= published);
+          last_published = published;
+        }
+      });
+    }
+
+    for(int i = 1; i <= 1000; ++i)
+    {
+      shared.assign(environment{ {"block_size", 32 * (i % 16 + 1)}, {"tile", i % 16 + 1} });
+    }
+
+    done = true;
+    for(auto& reader : readers)
+    {
+      reader.join();
+    }
+
+    assert(1001 == shared.version());
+
+    // versions are destroyed once no snapshot holds them
+    {
+      auto dropped = std::move(first);
+    }
+    shared.reclaim();
+    assert(0 == shared.num_retired());
+  }
+
   // this prints "foo" to the terminal
   std::cout << foo << std::endl;
 
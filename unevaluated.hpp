@@ -1,29 +1,260 @@
 #pragma once
 
-#include <any>
+#include <algorithm>
+#include <array>
 #include <concepts>
+#include <functional>
 #include <fmt/core.h>
 #include <iostream>
+#include <limits>
 #include <map>
 #include <optional>
+#include <span>
 #include <stdexcept>
 #include <string>
 #include <string_view>
 #include <tuple>
+#include <typeinfo>
+#include <vector>
+#include "divider.hpp"
+#include "fingerprint.hpp"
+#include "profile.hpp"
+#include "scalar.hpp"
+#include "simd.hpp"
+
+namespace detail
+{
+
+template<typename T, template<typename...> class Template>
+struct is_instantiation_of : std::false_type {};
+
+template<template<typename...> class Template, typename... Args>
+struct is_instantiation_of<Template<Args...>, Template> : std::true_type {};
+
+template<typename T, template<typename...> class Template>
+inline constexpr bool is_instantiation_of_v = is_instantiation_of<T,Template>::value;
+
+} // end detail
 
 // an environment is a binding of names to values
-using environment = std::map<std::string, std::any, std::less<>>;
+using environment = std::map<std::string, scalar, std::less<>>;
+
+// a divider<T> is bound in place of a T, so it is stored inline like one
+template<std::integral T>
+struct is_inline_scalar<divider<T>> : std::true_type {};
+
+
+// a symbol_table interns names as dense integer ids
+class symbol_table
+{
+  public:
+    constexpr static std::size_t npos = -1;
+
+    // returns the id of name, adding name to the table if it is not yet present
+    std::size_t intern(std::string_view name)
+    {
+      auto found = ids_.find(name);
+      if(found == ids_.end())
+      {
+        found = ids_.emplace(std::string(name), names_.size()).first;
+        names_.emplace_back(name);
+      }
+
+      return found->second;
+    }
+
+    // returns the id of name, or npos if name has not been interned
+    std::size_t find(std::string_view name) const
+    {
+      auto found = ids_.find(name);
+      return found == ids_.end() ? npos : found->second;
+    }
+
+    std::string_view name(std::size_t id) const
+    {
+      return names_[id];
+    }
+
+    std::size_t size() const
+    {
+      return names_.size();
+    }
+
+  private:
+    std::map<std::string, std::size_t, std::less<>> ids_;
+    std::vector<std::string> names_;
+};
+
+
+// a slot_environment binds interned names to values stored contiguously by id
+//
+// unlike environment, looking up a variable whose slot has been resolved by intern(expr, symbols)
+// is a single indexed load rather than a string search
+//
+// the symbol_table is not owned and must outlive the slot_environment
+class slot_environment
+{
+  public:
+    explicit slot_environment(symbol_table& symbols)
+      : symbols_{&symbols},
+        slots_(symbols.size())
+    {}
+
+    slot_environment(symbol_table& symbols, const environment& env)
+      : slot_environment{symbols}
+    {
+      for(const auto& [name, value] : env)
+      {
+        set(name, value);
+      }
+    }
+
+    template<class T>
+    void set(std::string_view name, T&& value)
+    {
+      std::size_t id = symbols_->intern(name);
+      if(id >= slots_.size()) slots_.resize(symbols_->size());
+      slots_[id] = std::forward<T>(value);
+    }
+
+    // returns the value bound in slot id, or nullptr if there is none
+    const scalar* find(std::size_t id) const
+    {
+      return (id < slots_.size() and slots_[id].has_value()) ? &slots_[id] : nullptr;
+    }
+
+    // returns the value bound to name, or nullptr if there is none
+    const scalar* find(std::string_view name) const
+    {
+      return find(symbols_->find(name));
+    }
+
+    const scalar& operator[](std::size_t id) const
+    {
+      return slots_[id];
+    }
+
+    scalar& operator[](std::size_t id)
+    {
+      return slots_[id];
+    }
+
+    std::size_t size() const
+    {
+      return slots_.size();
+    }
+
+    const symbol_table& symbols() const
+    {
+      return *symbols_;
+    }
+
+  private:
+    symbol_table* symbols_;
+    std::vector<scalar> slots_;
+};
+
+
+// a schema declares the name and type of each positional argument of a compiled expression
+class schema
+{
+  public:
+    schema() = default;
+
+    // declares the name and type of each of env's bindings
+    explicit schema(const environment& env)
+    {
+      for(const auto& [name, value] : env)
+      {
+        declare(name, value.type());
+      }
+    }
+
+    // declares name with type T, returning its position
+    template<class T>
+    std::size_t declare(std::string_view name)
+    {
+      return declare(name, typeid(T));
+    }
+
+    std::size_t declare(std::string_view name, const std::type_info& type)
+    {
+      std::size_t id = symbols_.intern(name);
+      if(id == types_.size())
+      {
+        types_.push_back(&type);
+      }
+      else
+      {
+        types_[id] = &type;
+      }
+
+      return id;
+    }
+
+    // returns the position of name, or symbol_table::npos if it has not been declared
+    std::size_t find(std::string_view name) const
+    {
+      return symbols_.find(name);
+    }
+
+    const std::type_info& type(std::size_t position) const
+    {
+      return *types_[position];
+    }
+
+    std::size_t size() const
+    {
+      return types_.size();
+    }
+
+    const symbol_table& symbols() const
+    {
+      return symbols_;
+    }
+
+    // arranges env's bindings in the order of this schema's positions
+    std::vector<scalar> arguments(const environment& env) const
+    {
+      std::vector<scalar> result(size());
+
+      for(std::size_t i = 0; i < size(); ++i)
+      {
+        auto found = env.find(symbols_.name(i));
+        if(found == env.end()) throw std::runtime_error(fmt::format("{} not found in env", symbols_.name(i)));
+        if(found->second.type() != type(i)) throw bad_scalar_cast();
+        result[i] = found->second;
+      }
+
+      return result;
+    }
+
+  private:
+    symbol_table symbols_;
+    std::vector<const std::type_info*> types_;
+};
+
+
+// a positional_environment binds variables to an array of arguments by slot
+//
+// it performs no checks: it is only meant to be used by a compiled_expression, whose
+// variables have been checked against a schema describing the arguments
+struct positional_environment
+{
+  const scalar* arguments;
+};
+
 
 // evaluating any old value is just the identity
-template<class T>
-constexpr T evaluate(const T& value, const environment& env)
+template<class T, class Env>
+constexpr T evaluate(const T& value, const Env& env)
 {
   return value;
 }
 
 // evaluating a tuple returns a tuple of the recursive evaluation of its elements
-template<class... Ts>
-constexpr auto evaluate(const std::tuple<Ts...>& t, const environment& env)
+template<class... Ts, class Env>
+constexpr auto evaluate(const std::tuple<Ts...>& t, const Env& env)
 {
   return std::apply([&](const auto&... elements)
   {
@@ -32,6 +263,69 @@ constexpr auto evaluate(const std::tuple<Ts...>& t, const environment& env)
   t);
 }
 
+// interning any old value is just the identity
+template<class T>
+constexpr T intern(const T& value, symbol_table&)
+{
+  return value;
+}
+
+// interning a tuple interns each of its elements
+template<class... Ts>
+constexpr auto intern(const std::tuple<Ts...>& t, symbol_table& symbols)
+{
+  return std::apply([&](const auto&... elements)
+  {
+    return std::make_tuple(intern(elements, symbols)...);
+  },
+  t);
+}
+
+// partially evaluating any old value is just the identity
+template<class T>
+constexpr T partially_evaluate(const T& value, const environment&)
+{
+  return value;
+}
+
+// partially evaluating a tuple partially evaluates each of its elements
+template<class... Ts>
+constexpr auto partially_evaluate(const std::tuple<Ts...>& t, const environment& env)
+{
+  return std::apply([&](const auto&... elements)
+  {
+    return std::make_tuple(partially_evaluate(elements, env)...);
+  },
+  t);
+}
+
+// visiting the variables of any old value does nothing
+template<class T, class F>
+constexpr void for_each_variable(T&, F&&)
+{
+}
+
+// visiting the variables of a tuple visits the variables of each of its elements
+template<class... Ts, class F>
+constexpr void for_each_variable(std::tuple<Ts...>& t, F&& f)
+{
+  std::apply([&](auto&... elements)
+  {
+    (for_each_variable(elements, f), ...);
+  },
+  t);
+}
+
+template<class... Ts, class F>
+constexpr void for_each_variable(const std::tuple<Ts...>& t, F&& f)
+{
+  std::apply([&](const auto&... elements)
+  {
+    (for_each_variable(elements, f), ...);
+  },
+  t);
+}
+
 template<class T>
 using evaluated_t = decltype(evaluate(std::declval<T>(), std::declval<environment>()));
 
@@ -45,147 +339,1778 @@ concept unevaluated = requires(T val, environment env)
   { evaluate(val, env) } -> different_from<T>;
 };
 
-template<class L, class R>
-concept at_least_one_unevaluated =
-  unevaluated<L>
-  or unevaluated<R>
-;
+template<class L, class R>
+concept at_least_one_unevaluated =
+  unevaluated<L>
+  or unevaluated<R>
+;
+
+// a residual is what remains of an expression E after partially_evaluate, defined below
+template<unevaluated E>
+struct residual;
+
+namespace detail
+{
+
+// returns the value of a partially evaluated expression, or nullptr if it has none
+template<class T>
+constexpr const T* folded_value(const T& literal)
+{
+  return &literal;
+}
+
+template<class E>
+constexpr const evaluated_t<E>* folded_value(const residual<E>& expr)
+{
+  return expr.value ? &*expr.value : nullptr;
+}
+
+// returns the T held by value
+//
+// an integral variable may also be bound to a divider<T>, which stands for its divisor
+template<class T>
+T scalar_value_cast(const scalar& value)
+{
+  if constexpr (std::integral<T>)
+  {
+    if(auto d = scalar_cast<divider<T>>(&value)) return *d;
+  }
+
+  return scalar_cast<T>(value);
+}
+
+} // end detail
+
+template<class T>
+struct variable
+{
+  std::string_view name;
+
+  // the id of name in the symbol_table given to intern, if any
+  std::size_t slot = symbol_table::npos;
+
+  // returns the value bound to self in env
+  friend const scalar& lookup(const variable& self, const environment& env)
+  {
+    auto found = env.find(self.name);
+    if(found == env.end()) throw std::runtime_error(fmt::format("{} not found in env", self.name));
+    return found->second;
+  }
+
+  friend const scalar& lookup(const variable& self, const slot_environment& env)
+  {
+    // a variable which has not been interned falls back to a search by name
+    const scalar* found = self.slot != symbol_table::npos ? env.find(self.slot) : env.find(self.name);
+    if(not found) throw std::runtime_error(fmt::format("{} not found in env", self.name));
+    return *found;
+  }
+
+  friend const scalar& lookup(const variable& self, const positional_environment& env) noexcept
+  {
+    return env.arguments[self.slot];
+  }
+
+  friend T evaluate(const variable& self, const environment& env)
+  {
+    return detail::scalar_value_cast<T>(lookup(self, env));
+  }
+
+  friend T evaluate(const variable& self, const slot_environment& env)
+  {
+    return detail::scalar_value_cast<T>(lookup(self, env));
+  }
+
+  friend T evaluate(const variable& self, const positional_environment& env) noexcept
+  {
+    const scalar& argument = lookup(self, env);
+
+    if constexpr (std::integral<T>)
+    {
+      // compile admits a divider<T> in place of a T
+      if(auto d = scalar_cast<divider<T>>(&argument)) return *d;
+    }
+
+    return *scalar_cast<T>(&argument);
+  }
+
+  // partially evaluating a variable yields its value if env binds it
+  friend residual<variable> partially_evaluate(const variable& self, const environment& env)
+  {
+    auto found = env.find(self.name);
+    if(found == env.end()) return {std::nullopt, self};
+    return {detail::scalar_value_cast<T>(found->second), self};
+  }
+
+  template<class F>
+  friend void for_each_variable(variable& self, F&& f)
+  {
+    f(self);
+  }
+
+  template<class F>
+  friend void for_each_variable(const variable& self, F&& f)
+  {
+    f(self);
+  }
+
+  // interning a variable resolves its name to a slot
+  friend variable intern(const variable& self, symbol_table& symbols)
+  {
+    return {self.name, symbols.intern(self.name)};
+  }
+
+  friend std::ostream& operator<<(std::ostream& os, const variable& self)
+  {
+    return os << self.name;
+  }
+};
+
+template<unevaluated E, std::invocable<evaluated_t<E>> F>
+struct op1
+{
+  template<class Env>
+  friend auto evaluate(const op1& self, const Env& env)
+  {
+    return self.f(evaluate(self.expr, env));
+  }
+
+  friend op1 intern(const op1& self, symbol_table& symbols)
+  {
+    return {intern(self.expr, symbols), self.f};
+  }
+
+  // partially evaluating an op1 folds it to a value when its operand has one
+  friend auto partially_evaluate(const op1& self, const environment& env)
+  {
+    auto expr = partially_evaluate(self.expr, env);
+
+    residual<op1<decltype(expr),F>> result{std::nullopt, {expr, self.f}};
+    if(auto value = detail::folded_value(expr)) result.value = self.f(*value);
+
+    return result;
+  }
+
+  template<class G>
+  friend void for_each_variable(op1& self, G&& g)
+  {
+    for_each_variable(self.expr, g);
+  }
+
+  template<class G>
+  friend void for_each_variable(const op1& self, G&& g)
+  {
+    for_each_variable(self.expr, g);
+  }
+
+  E expr;
+  F f;
+};
+
+namespace detail
+{
+
+// true when an op2 divides a T by a variable<T>, which may be bound to a divider<T>
+template<class L, class R, class F>
+concept divides_by_variable =
+  is_instantiation_of_v<R,variable>
+  and std::integral<evaluated_t<R>>
+  and std::same_as<evaluated_t<L>, evaluated_t<R>>
+  and divides_or_modulus<F>
+;
+
+} // end detail
+
+template<class L, class R, std::invocable<evaluated_t<L>, evaluated_t<R>> F>
+  requires at_least_one_unevaluated<L,R>
+struct op2
+{
+  template<class Env>
+  friend auto evaluate(const op2& self, const Env& env)
+  {
+    if constexpr (detail::divides_by_variable<L,R,F>)
+    {
+      // a divisor bound to a divider divides by multiplication
+      const scalar& divisor = lookup(self.rhs, env);
+
+      if(auto d = scalar_cast<divider<evaluated_t<R>>>(&divisor))
+      {
+        return self.f(evaluate(self.lhs,env), *d);
+      }
+
+      return self.f(evaluate(self.lhs,env), detail::scalar_value_cast<evaluated_t<R>>(divisor));
+    }
+    else
+    {
+      return self.f(evaluate(self.lhs,env), evaluate(self.rhs,env));
+    }
+  }
+
+  friend op2 intern(const op2& self, symbol_table& symbols)
+  {
+    return {intern(self.lhs, symbols), intern(self.rhs, symbols), self.f};
+  }
+
+  // partially evaluating an op2 folds it to a value when both of its operands have one
+  friend auto partially_evaluate(const op2& self, const environment& env)
+  {
+    auto lhs = partially_evaluate(self.lhs, env);
+    auto rhs = partially_evaluate(self.rhs, env);
+
+    residual<op2<decltype(lhs),decltype(rhs),F>> result{std::nullopt, {lhs, rhs, self.f}};
+
+    auto lhs_value = detail::folded_value(lhs);
+    auto rhs_value = detail::folded_value(rhs);
+    if(lhs_value and rhs_value) result.value = self.f(*lhs_value, *rhs_value);
+
+    return result;
+  }
+
+  template<class G>
+  friend void for_each_variable(op2& self, G&& g)
+  {
+    for_each_variable(self.lhs, g);
+    for_each_variable(self.rhs, g);
+  }
+
+  template<class G>
+  friend void for_each_variable(const op2& self, G&& g)
+  {
+    for_each_variable(self.lhs, g);
+    for_each_variable(self.rhs, g);
+  }
+
+  L lhs;
+  R rhs;
+  F f;
+};
+
+struct unary_plus
+{
+  constexpr auto operator()(const auto& value) const
+  {
+    return +value;
+  }
+};
+
+// a residual is the result of partially evaluating an expression E with an environment which
+// binds only some of its variables
+//
+// when the environment binds all of E's variables, a residual holds E's value, and evaluating it
+// is just a load. otherwise, it holds E, whose subexpressions are residuals in turn, so that
+// evaluation only visits those parts of E which depend on variables left unbound
+template<unevaluated E>
+struct residual
+{
+  template<class Env>
+  friend evaluated_t<E> evaluate(const residual& self, const Env& env)
+  {
+    return self.value ? *self.value : evaluate(self.expr, env);
+  }
+
+  friend residual intern(const residual& self, symbol_table& symbols)
+  {
+    return {self.value, intern(self.expr, symbols)};
+  }
+
+  // the variables of a residual with a value are not visited, as they are never evaluated
+  template<class F>
+  friend void for_each_variable(residual& self, F&& f)
+  {
+    if(not self.value) for_each_variable(self.expr, f);
+  }
+
+  template<class F>
+  friend void for_each_variable(const residual& self, F&& f)
+  {
+    if(not self.value) for_each_variable(self.expr, f);
+  }
+
+  std::optional<evaluated_t<E>> value;
+  E expr;
+};
+
+// calls f with the name and bound value of each of expr's variables, in preorder
+template<class E, class F>
+void for_each_binding(const E& expr, const environment& env, F&& f)
+{
+  for_each_variable(expr, [&]<class T>(const variable<T>& var)
+  {
+    f(var.name, evaluate(var, env));
+  });
+}
+
+// a constant is a literal whose value is part of its type
+//
+// because the operators below can see a constant's value, they simplify expressions
+// involving it as they are built. For example, x * 1_c is just x.
+template<auto v>
+struct constant
+{
+  using value_type = decltype(v);
+  constexpr static value_type value = v;
+
+  constexpr operator value_type() const
+  {
+    return v;
+  }
+};
+
+namespace detail
+{
+
+template<class T>
+struct is_constant : std::false_type {};
+
+template<auto v>
+struct is_constant<constant<v>> : std::true_type {};
+
+template<class T>
+inline constexpr bool is_constant_v = is_constant<T>::value;
+
+// the type of a literal's value
+template<class T>
+struct literal_value
+{
+  using type = T;
+};
+
+template<auto v>
+struct literal_value<constant<v>>
+{
+  using type = decltype(v);
+};
+
+template<class T>
+using literal_value_t = typename literal_value<T>::type;
+
+template<class F>
+concept additive = std::same_as<F,std::plus<>> or std::same_as<F,std::minus<>>;
+
+template<class F>
+concept multiplicative = std::same_as<F,std::multiplies<>>;
+
+// true when C is a constant which leaves the other operand of F unchanged
+template<class F, class C, bool on_left>
+constexpr bool is_identity_element()
+{
+  if constexpr (not is_constant_v<C>)
+  {
+    return false;
+  }
+  else if constexpr (std::same_as<F,std::plus<>>)
+  {
+    return C::value == 0;
+  }
+  else if constexpr (std::same_as<F,std::minus<>>)
+  {
+    return not on_left and C::value == 0;
+  }
+  else if constexpr (std::same_as<F,std::multiplies<>>)
+  {
+    return C::value == 1;
+  }
+  else if constexpr (std::same_as<F,std::divides<>>)
+  {
+    return not on_left and C::value == 1;
+  }
+  else
+  {
+    return false;
+  }
+}
+
+// true when arithmetic on T wraps modulo 2^N rather than overflowing, so that literals of type T
+// may be folded together whatever their values
+template<class T>
+constexpr bool wraps_around()
+{
+  return std::unsigned_integral<T> and std::same_as<T, decltype(T() + T())>;
+}
+
+// true when a F b does not fit in T
+template<class F, class T>
+constexpr bool fold_overflows(F, T a, T b)
+{
+  T result{};
+
+  if constexpr (std::same_as<F,std::plus<>>)
+  {
+    return __builtin_add_overflow(a, b, &result);
+  }
+  else if constexpr (std::same_as<F,std::minus<>>)
+  {
+    return __builtin_sub_overflow(a, b, &result);
+  }
+  else
+  {
+    return __builtin_mul_overflow(a, b, &result);
+  }
+}
+
+// true when the literals a and b may be combined with one of +, - or * as expressions are built
+//
+// this requires that the folded literal equals a F b, which is always the case for types which
+// wrap around. otherwise a and b must both be constants, so that overflow is found when the
+// expression's type is chosen, and an expression whose folded literal would overflow is left as
+// it was written.
+template<class F, class A, class B>
+constexpr bool is_foldable()
+{
+  using T = literal_value_t<A>;
+
+  if constexpr (wraps_around<T>())
+  {
+    return true;
+  }
+  else if constexpr (is_constant_v<A> and is_constant_v<B>)
+  {
+    return not fold_overflows(F(), T(A::value), T(B::value));
+  }
+  else
+  {
+    return false;
+  }
+}
+
+// combines the literals a and b with one of +, - or *, wrapping around modulo 2^N
+//
+// the result is a constant when both a and b are
+template<class F, class A, class B>
+constexpr auto fold(F f, const A& a, const B& b)
+{
+  using T = literal_value_t<A>;
+
+  if constexpr (is_constant_v<A> and is_constant_v<B>)
+  {
+    return constant<T(f(T(A::value), T(B::value)))>{};
+  }
+  else
+  {
+    return T(f(T(a), T(b)));
+  }
+}
+
+// the operation G which rewrites (x F1 a) F2 b as x F1 (a G b)
+template<class F1, class F2>
+using reassociated_operation_t = std::conditional_t<
+  std::same_as<F1,F2>,
+  std::conditional_t<additive<F2>, std::plus<>, F2>,
+  std::minus<>
+>;
+
+// true when the literal operands of (x F1 a) F2 b, or of (a F1 x) F2 b, may be folded together
+//
+// this requires that F1 and F2 are both additive or both multiplicative, that x, a, and b are all
+// of the same integral type, and that a and b are foldable, so that reassociation yields exactly
+// the same value
+template<class L, class R, class F2, bool x_on_left>
+constexpr bool is_reassociable()
+{
+  if constexpr (is_instantiation_of_v<L,op2> and not unevaluated<R>)
+  {
+    using X = std::conditional_t<x_on_left, decltype(L::lhs), decltype(L::rhs)>;
+    using A = std::conditional_t<x_on_left, decltype(L::rhs), decltype(L::lhs)>;
+    using F1 = decltype(L::f);
+
+    if constexpr (unevaluated<X> and not unevaluated<A>)
+    {
+      using T = evaluated_t<X>;
+      using G = std::conditional_t<x_on_left, reassociated_operation_t<F1,F2>, F2>;
+
+      if constexpr (((additive<F1> and additive<F2>) or (multiplicative<F1> and multiplicative<F2>))
+        and std::integral<T>
+        and std::same_as<T, literal_value_t<A>>
+        and std::same_as<T, literal_value_t<R>>)
+      {
+        return is_foldable<G,A,R>();
+      }
+    }
+  }
+
+  return false;
+}
+
+// builds the expression lhs F rhs, simplifying it when a simpler expression has the same value:
+//
+//   x + 0_c, x - 0_c, x * 1_c, and x / 1_c are x
+//   (x + a) - b is x + (a - b), and similarly for other combinations of + and -
+//   (x * a) * b is x * (a * b)
+//
+// where x is unevaluated and a and b are foldable literals
+template<class L, class R, class F>
+constexpr auto make_op2(const L& lhs, const R& rhs, F f)
+{
+  using result_type = std::invoke_result_t<F, evaluated_t<L>, evaluated_t<R>>;
+
+  if constexpr (is_identity_element<F,R,false>() and std::same_as<evaluated_t<L>, result_type>)
+  {
+    return lhs;
+  }
+  else if constexpr (is_identity_element<F,L,true>() and std::same_as<evaluated_t<R>, result_type>)
+  {
+    return rhs;
+  }
+  else if constexpr (is_reassociable<L,R,F,true>())
+  {
+    // (x F1 a) F b -> x F1 (a G b), where G is + when F1 and F agree and - otherwise
+    using G = reassociated_operation_t<decltype(L::f),F>;
+    return make_op2(lhs.lhs, fold(G(), lhs.rhs, rhs), lhs.f);
+  }
+  else if constexpr (is_reassociable<L,R,F,false>())
+  {
+    // (a F1 x) F b -> (a F b) F1 x
+    return make_op2(fold(f, lhs.lhs, rhs), lhs.rhs, lhs.f);
+  }
+  else
+  {
+    return op2<L,R,F>{lhs, rhs, f};
+  }
+}
+
+} // end detail
+
+template<unevaluated E>
+  requires requires(evaluated_t<E> value) { +value; }
+constexpr op1<E,unary_plus> operator+(const E& expr)
+{
+  return {expr, unary_plus()};
+}
+
+template<unevaluated E>
+  requires requires(evaluated_t<E> value) { -value; }
+constexpr op1<E,std::negate<>> operator-(const E& expr)
+{
+  return {expr, std::negate()};
+}
+
+template<unevaluated E>
+  requires requires(evaluated_t<E> value) { ~value; }
+constexpr op1<E,std::bit_not<>> operator~(const E& expr)
+{
+  return {expr, std::bit_not()};
+}
+
+template<class L, at_least_one_unevaluated<L> R>
+  requires requires(evaluated_t<L> lhs, evaluated_t<R> rhs) { lhs + rhs; }
+constexpr auto operator+(const L& lhs, const R& rhs)
+{
+  return detail::make_op2(lhs, rhs, std::plus());
+}
+
+template<class L, at_least_one_unevaluated<L> R>
+  requires requires(evaluated_t<L> lhs, evaluated_t<R> rhs) { lhs - rhs; }
+constexpr auto operator-(const L& lhs, const R& rhs)
+{
+  return detail::make_op2(lhs, rhs, std::minus());
+}
+
+template<class L, at_least_one_unevaluated<L> R>
+  requires requires(evaluated_t<L> lhs, evaluated_t<R> rhs) { lhs * rhs; }
+constexpr auto operator*(const L& lhs, const R& rhs)
+{
+  return detail::make_op2(lhs, rhs, std::multiplies());
+}
+
+template<class L, at_least_one_unevaluated<L> R>
+  requires requires(evaluated_t<L> lhs, evaluated_t<R> rhs) { lhs / rhs; }
+constexpr auto operator/(const L& lhs, const R& rhs)
+{
+  return detail::make_op2(lhs, rhs, std::divides());
+}
+
+template<class L, at_least_one_unevaluated<L> R>
+  requires requires(evaluated_t<L> lhs, evaluated_t<R> rhs) { lhs % rhs; }
+constexpr auto operator%(const L& lhs, const R& rhs)
+{
+  return detail::make_op2(lhs, rhs, std::modulus());
+}
+
+// user-defined literal operator allows variable written as literals, For example,
+//
+//     auto var = "block_size"_v;
+//
+// var has type variable<int>.
+constexpr variable<int> operator""_v(const char* str, std::size_t n) noexcept
+{
+  return {std::string_view{str,n}};
+}
+
+namespace detail
+{
+
+struct integer_literal
+{
+  unsigned long long value;
+  bool decimal;
+  bool valid;
+  bool overflow;
+};
+
+// parses the characters of an integer literal, which may be decimal, or hexadecimal, binary, or
+// octal with the prefix 0x, 0b, or 0
+template<char... digits>
+constexpr integer_literal parse_integer_literal()
+{
+  constexpr char text[] = {digits...};
+  std::size_t i = 0;
+  unsigned base = 10;
+
+  if(sizeof(text) > 1 and text[0] == '0')
+  {
+    if(text[1] == 'x' or text[1] == 'X')
+    {
+      base = 16;
+      i = 2;
+    }
+    else if(text[1] == 'b' or text[1] == 'B')
+    {
+      base = 2;
+      i = 2;
+    }
+    else
+    {
+      base = 8;
+      i = 1;
+    }
+  }
+
+  integer_literal result{0, base == 10, i < sizeof(text), false};
+
+  for(; i < sizeof(text); ++i)
+  {
+    char c = text[i];
+    if(c == '\'') continue;
+
+    unsigned digit = 'a' <= c and c <= 'f' ? c - 'a' + 10 :
+                     'A' <= c and c <= 'F' ? c - 'A' + 10 :
+                     '0' <= c and c <= '9' ? c - '0' :
+                     base;
+
+    if(digit >= base) result.valid = false;
+
+    result.overflow = result.overflow
+      or __builtin_mul_overflow(result.value, base, &result.value)
+      or __builtin_add_overflow(result.value, digit, &result.value);
+  }
+
+  return result;
+}
+
+} // end detail
+
+
+// user-defined literal operator allows constants written as integer literals, For example,
+//
+//     auto one = 1_c;
+//
+// one has type constant<1>. Like an integer literal, the constant's type is the first of int,
+// long, long long, and unsigned long long which can represent its value, and may also be
+// unsigned int or unsigned long when it is not decimal.
+template<char... digits>
+constexpr auto operator""_c() noexcept
+{
+  constexpr detail::integer_literal literal = detail::parse_integer_literal<digits...>();
+  static_assert(literal.valid, "_c: invalid digit in integer literal.");
+  static_assert(not literal.overflow, "_c: integer literal is too large for unsigned long long.");
+
+  constexpr unsigned long long value = literal.value;
+
+  if constexpr (value <= std::numeric_limits<int>::max())
+  {
+    return constant<int(value)>{};
+  }
+  else if constexpr (not literal.decimal and value <= std::numeric_limits<unsigned int>::max())
+  {
+    return constant<(unsigned int)value>{};
+  }
+  else if constexpr (value <= std::numeric_limits<long>::max())
+  {
+    return constant<long(value)>{};
+  }
+  else if constexpr (not literal.decimal and value <= std::numeric_limits<unsigned long>::max())
+  {
+    return constant<(unsigned long)value>{};
+  }
+  else if constexpr (value <= std::numeric_limits<long long>::max())
+  {
+    return constant<(long long)value>{};
+  }
+  else
+  {
+    return constant<value>{};
+  }
+}
+
+
+namespace detail
+{
+
+// the text of an operator, or "?" if it is unknown
+template<class F>
+constexpr std::string_view operator_text()
+{
+  if constexpr (std::same_as<F,unary_plus> or std::same_as<F,std::plus<>>) return "+";
+  else if constexpr (std::same_as<F,std::negate<>> or std::same_as<F,std::minus<>>) return "-";
+  else if constexpr (std::same_as<F,std::bit_not<>>) return "~";
+  else if constexpr (std::same_as<F,std::multiplies<>>) return "*";
+  else if constexpr (std::same_as<F,std::divides<>>) return "/";
+  else if constexpr (std::same_as<F,std::modulus<>>) return "%";
+  else return "?";
+}
+
+// the kinds of node which a structural hash distinguishes
+enum class node_kind : unsigned char { unary = 1, binary, variable, literal, tuple, opaque };
+
+template<class T>
+constexpr void add_literal(const T& value, fingerprint& result)
+{
+  if constexpr (requires(fingerprint f) { f.add(literal_value_t<T>(value)); })
+  {
+    result.add(node_kind::literal).add(literal_value_t<T>(value));
+  }
+  else
+  {
+    result.add(node_kind::opaque);
+  }
+}
+
+// adds the structure of expr to result, in preorder
+template<class E>
+void add_structure(const E& expr, fingerprint& result)
+{
+  if constexpr (is_instantiation_of_v<E,op1>)
+  {
+    result.add(node_kind::unary).add(operator_text<decltype(expr.f)>());
+    add_structure(expr.expr, result);
+  }
+  else if constexpr (is_instantiation_of_v<E,op2>)
+  {
+    result.add(node_kind::binary).add(operator_text<decltype(expr.f)>());
+    add_structure(expr.lhs, result);
+    add_structure(expr.rhs, result);
+  }
+  else if constexpr (is_instantiation_of_v<E,variable>)
+  {
+    result.add(node_kind::variable).add(expr.name);
+  }
+  else if constexpr (is_instantiation_of_v<E,residual>)
+  {
+    // a residual with a value is a literal
+    if(expr.value)
+    {
+      add_literal(*expr.value, result);
+    }
+    else
+    {
+      add_structure(expr.expr, result);
+    }
+  }
+  else if constexpr (is_instantiation_of_v<E,std::tuple>)
+  {
+    result.add(node_kind::tuple).add(std::tuple_size_v<E>);
+    std::apply([&](const auto&... elements)
+    {
+      (add_structure(elements, result), ...);
+    },
+    expr);
+  }
+  else
+  {
+    add_literal(expr, result);
+  }
+}
+
+// true when the structural hash of E describes it completely: each of its operators is built in,
+// and each of its literals can be fingerprinted, so that no other expression hashes alike but by
+// collision
+template<class E>
+constexpr bool is_structurally_hashable()
+{
+  if constexpr (is_instantiation_of_v<E,op1>)
+  {
+    return operator_text<decltype(E::f)>() != "?" and is_structurally_hashable<decltype(E::expr)>();
+  }
+  else if constexpr (is_instantiation_of_v<E,op2>)
+  {
+    return operator_text<decltype(E::f)>() != "?" and is_structurally_hashable<decltype(E::lhs)>() and is_structurally_hashable<decltype(E::rhs)>();
+  }
+  else if constexpr (is_instantiation_of_v<E,variable>)
+  {
+    return true;
+  }
+  else if constexpr (is_instantiation_of_v<E,residual>)
+  {
+    return is_structurally_hashable<evaluated_t<E>>() and is_structurally_hashable<decltype(E::expr)>();
+  }
+  else if constexpr (is_instantiation_of_v<E,std::tuple>)
+  {
+    return []<class... Ts>(std::type_identity<std::tuple<Ts...>>)
+    {
+      return (is_structurally_hashable<Ts>() and ...);
+    }(std::type_identity<E>());
+  }
+  else
+  {
+    return requires(const E& value, fingerprint f) { f.add(literal_value_t<E>(value)); };
+  }
+}
+
+// true when A and B are both op1s, or both op2s, of the same operator
+template<class A, class B>
+constexpr bool is_same_operation()
+{
+  if constexpr ((is_instantiation_of_v<A,op1> and is_instantiation_of_v<B,op1>) or (is_instantiation_of_v<A,op2> and is_instantiation_of_v<B,op2>))
+  {
+    return std::same_as<decltype(A::f), decltype(B::f)>;
+  }
+
+  return false;
+}
+
+} // end detail
+
+
+// a hash of expr's structure: the operator of each operation, the name of each variable, and the
+// value of each literal, in preorder
+//
+// the hash is a fingerprint, so it is the same in every build and on every platform, and is the
+// same as that of the same expression built by variable.hpp. it neither allocates nor formats, so it
+// is cheap enough to compute each time an expression is built. a constant hashes as its value, and a
+// residual with a value as that value. operators other than the built-in ones hash alike, as do
+// literals which a fingerprint cannot hash, so such expressions may collide.
+template<class E>
+std::uint64_t structural_hash(const E& expr)
+{
+  fingerprint result;
+  detail::add_structure(expr, result);
+  return result.value();
+}
+
+// true when a and b are the same expression: their operations have the same operators, their
+// variables the same names, and their literals the same types and values. a constant is the same
+// as a literal of its value's type, so x + 1_c is the same as x + 1
+//
+// a residual with a value is the same as a literal with that value
+template<class A, class B>
+bool structurally_equal(const A& a, const B& b)
+{
+  if constexpr (detail::is_instantiation_of_v<A,residual>)
+  {
+    return a.value ? structurally_equal(*a.value, b) : structurally_equal(a.expr, b);
+  }
+  else if constexpr (detail::is_instantiation_of_v<B,residual>)
+  {
+    return b.value ? structurally_equal(a, *b.value) : structurally_equal(a, b.expr);
+  }
+  else if constexpr (detail::is_same_operation<A,B>())
+  {
+    using F = decltype(a.f);
+
+    bool result = std::is_empty_v<F>;
+    if constexpr (std::equality_comparable<F>)
+    {
+      result = result or a.f == b.f;
+    }
+
+    if constexpr (detail::is_instantiation_of_v<A,op1>)
+    {
+      return result and structurally_equal(a.expr, b.expr);
+    }
+    else
+    {
+      return result and structurally_equal(a.lhs, b.lhs) and structurally_equal(a.rhs, b.rhs);
+    }
+  }
+  else if constexpr (detail::is_instantiation_of_v<A,variable> and std::same_as<A,B>)
+  {
+    return a.name == b.name;
+  }
+  else if constexpr (detail::is_instantiation_of_v<A,std::tuple> and detail::is_instantiation_of_v<B,std::tuple>)
+  {
+    if constexpr (std::tuple_size_v<A> == std::tuple_size_v<B>)
+    {
+      return [&]<std::size_t... i>(std::index_sequence<i...>)
+      {
+        return (structurally_equal(std::get<i>(a), std::get<i>(b)) and ...);
+      }(std::make_index_sequence<std::tuple_size_v<A>>());
+    }
+    else
+    {
+      return false;
+    }
+  }
+  else if constexpr (unevaluated<A> or unevaluated<B> or detail::is_instantiation_of_v<A,std::tuple> or detail::is_instantiation_of_v<B,std::tuple>)
+  {
+    return false;
+  }
+  else if constexpr (not std::same_as<detail::literal_value_t<A>, detail::literal_value_t<B>>)
+  {
+    // literals of different types may combine differently, as those of x/2 and x/2.0 do
+    return false;
+  }
+  else if constexpr (std::equality_comparable<detail::literal_value_t<A>>)
+  {
+    return detail::literal_value_t<A>(a) == detail::literal_value_t<B>(b);
+  }
+  else
+  {
+    return std::is_empty_v<A> and std::same_as<A,B>;
+  }
+}
+
+namespace detail
+{
+
+// evaluates expr over elements [offset, offset + n) of env's columns and passes the result,
+// an operand, to k
+template<class E, class K>
+void evaluate_chunk(const E& expr, const environment& env, std::size_t offset, std::size_t n, K&& k)
+{
+  if constexpr (is_instantiation_of_v<E,op1>)
+  {
+    evaluate_chunk(expr.expr, env, offset, n, [&]<class A>(const operand<A>& x)
+    {
+      using R = std::invoke_result_t<decltype(expr.f), A>;
+      R result[chunk_size];
+      transform(expr.f, x, result, n);
+      k(column<R>(result));
+    });
+  }
+  else if constexpr (is_instantiation_of_v<E,op2>)
+  {
+    evaluate_chunk(expr.lhs, env, offset, n, [&]<class A>(const operand<A>& lhs)
+    {
+      evaluate_chunk(expr.rhs, env, offset, n, [&]<class B>(const operand<B>& rhs)
+      {
+        using R = std::invoke_result_t<decltype(expr.f), A, B>;
+        R result[chunk_size];
+        transform(expr.f, lhs, rhs, result, n);
+        k(column<R>(result));
+      });
+    });
+  }
+  else if constexpr (is_instantiation_of_v<E,residual>)
+  {
+    if(expr.value)
+    {
+      k(broadcast(*expr.value));
+    }
+    else
+    {
+      evaluate_chunk(expr.expr, env, offset, n, k);
+    }
+  }
+  else if constexpr (is_instantiation_of_v<E,variable>)
+  {
+    using T = evaluated_t<E>;
+
+    // a variable is bound either to a column or to a single value
+    auto found = env.find(expr.name);
+    if(found == env.end()) throw std::runtime_error(fmt::format("{} not found in env", expr.name));
+
+    if(auto values = scalar_cast<std::span<const T>>(&found->second))
+    {
+      if(values->size() < offset + n) throw std::out_of_range(fmt::format("{}: column is shorter than output", expr.name));
+      k(column(values->data() + offset));
+    }
+    else
+    {
+      k(broadcast(scalar_value_cast<T>(found->second)));
+    }
+  }
+  else
+  {
+    static_assert(not unevaluated<E>, "evaluate_batch: expression cannot be evaluated by columns.");
+    k(broadcast(literal_value_t<E>(expr)));
+  }
+}
+
+} // end detail
+
+
+// evaluates expr once per element of out, writing each result to out
+//
+// each of env's values is either a std::span<const T>, whose ith element is used to compute out[i],
+// or a single T used to compute every element of out
+template<unevaluated E, class R>
+void evaluate_batch(const E& expr, const environment& env, std::span<R> out)
+{
+  for(std::size_t offset = 0; offset < out.size(); offset += detail::chunk_size)
+  {
+    std::size_t n = std::min(detail::chunk_size, out.size() - offset);
+
+    detail::evaluate_chunk(expr, env, offset, n, [&](const auto& result)
+    {
+      detail::copy(result, out.data() + offset, n);
+    });
+  }
+}
+
+
+namespace detail
+{
+
+// returns a std::tuple of std::type_identity<N> for each node N of E's tree, in preorder
+template<class E>
+constexpr auto preorder_types()
+{
+  if constexpr (is_instantiation_of_v<E,op1>)
+  {
+    return std::tuple_cat(std::tuple<std::type_identity<E>>(), preorder_types<decltype(E::expr)>());
+  }
+  else if constexpr (is_instantiation_of_v<E,op2>)
+  {
+    return std::tuple_cat(std::tuple<std::type_identity<E>>(), preorder_types<decltype(E::lhs)>(), preorder_types<decltype(E::rhs)>());
+  }
+  else
+  {
+    return std::tuple<std::type_identity<E>>();
+  }
+}
+
+// the number of nodes in E's tree
+template<class E>
+constexpr std::size_t tree_size = std::tuple_size_v<decltype(preorder_types<E>())>;
+
+// the position of each expression's root among the nodes of several expressions, where the nodes of
+// each expression follow those of the expressions before it
+template<class... Es>
+constexpr std::array<std::size_t, sizeof...(Es)> root_positions = []
+{
+  std::array<std::size_t, sizeof...(Es)> sizes{tree_size<Es>...};
+  std::array<std::size_t, sizeof...(Es)> result{};
+  for(std::size_t j = 1; j < result.size(); ++j)
+  {
+    result[j] = result[j-1] + sizes[j-1];
+  }
+  return result;
+}();
+
+// the type of the node at position i of a list of nodes
+template<class Nodes, std::size_t i>
+using node_t = typename std::tuple_element_t<i,Nodes>::type;
+
+// the positions before i of nodes whose type is the same as the type of the node at position i
+template<class Nodes, std::size_t i>
+constexpr auto earlier_positions_of_same_type()
+{
+  constexpr auto same = []<std::size_t... js>(std::index_sequence<js...>)
+  {
+    return std::array<bool,i>{std::same_as<node_t<Nodes,js>, node_t<Nodes,i>>...};
+  }(std::make_index_sequence<i>());
+
+  std::array<std::size_t, std::count(same.begin(), same.end(), true)> result{};
+  for(std::size_t j = 0, n = 0; j < i; ++j)
+  {
+    if(same[j]) result[n++] = j;
+  }
+
+  return result;
+}
+
+// true when a node after position i has the same type as the node at position i
+template<class Nodes, std::size_t i>
+constexpr bool has_later_position_of_same_type()
+{
+  return []<std::size_t... js>(std::index_sequence<js...>)
+  {
+    return (std::same_as<node_t<Nodes,i+1+js>, node_t<Nodes,i>> or ...);
+  }(std::make_index_sequence<std::tuple_size_v<Nodes> - i - 1>());
+}
+
+template<class E>
+constexpr bool is_shareable = is_instantiation_of_v<E,op1> or is_instantiation_of_v<E,op2> or is_instantiation_of_v<E,variable>;
+
+// finds, for expr at position i and each node beneath it, the first position of an identical subexpression
+template<std::size_t i, class Nodes, class E, std::size_t n>
+void find_leaders(const E& expr, std::array<std::uint64_t,n>& hashes, std::array<const void*,n>& nodes, std::array<std::size_t,n>& leaders)
+{
+  if constexpr (is_instantiation_of_v<E,op1>)
+  {
+    find_leaders<i+1,Nodes>(expr.expr, hashes, nodes, leaders);
+  }
+  else if constexpr (is_instantiation_of_v<E,op2>)
+  {
+    find_leaders<i+1,Nodes>(expr.lhs, hashes, nodes, leaders);
+    find_leaders<i+1+tree_size<decltype(E::lhs)>,Nodes>(expr.rhs, hashes, nodes, leaders);
+  }
+
+  hashes[i] = structural_hash(expr);
+  nodes[i] = &expr;
+  leaders[i] = i;
+
+  if constexpr (is_shareable<E>)
+  {
+    // only nodes of the same type can be identical
+    for(std::size_t c : earlier_positions_of_same_type<Nodes,i>())
+    {
+      if(leaders[c] == c and hashes[c] == hashes[i] and structurally_equal(*static_cast<const E*>(nodes[c]), expr))
+      {
+        leaders[i] = c;
+        break;
+      }
+    }
+  }
+}
+
+// the values computed during a shared evaluation
+template<class Env, class... Nodes>
+struct shared_values
+{
+  std::tuple<std::optional<decltype(evaluate(std::declval<typename Nodes::type>(), std::declval<Env>()))>...> values;
+
+  shared_values(const Env&, std::tuple<Nodes...>)
+  {}
+};
+
+// evaluates expr, the node at position i, reusing the value of its leader when it has one
+template<std::size_t i, class Nodes, class E, class Env, class Values, std::size_t n>
+auto evaluate_shared(const E& expr, const Env& env, Values& values, const std::array<std::size_t,n>& leaders)
+{
+  if constexpr (is_shareable<E>)
+  {
+    using value_type = decltype(evaluate(expr, env));
+
+    constexpr auto candidates = earlier_positions_of_same_type<Nodes,i>();
+
+    if constexpr (candidates.size() > 0)
+    {
+      if(leaders[i] != i)
+      {
+        const value_type* found = nullptr;
+
+        [&]<std::size_t... cs>(std::index_sequence<cs...>)
+        {
+          ((leaders[i] == candidates[cs] ? (found = &*std::get<candidates[cs]>(values.values)) : nullptr), ...);
+        }(std::make_index_sequence<candidates.size()>());
+
+        return *found;
+      }
+    }
+
+    value_type result = [&]
+    {
+      if constexpr (is_instantiation_of_v<E,op1>)
+      {
+        return expr.f(evaluate_shared<i+1,Nodes>(expr.expr, env, values, leaders));
+      }
+      else if constexpr (is_instantiation_of_v<E,op2>)
+      {
+        // evaluate lhs before rhs, because leaders precede the positions which share them
+        auto lhs = evaluate_shared<i+1,Nodes>(expr.lhs, env, values, leaders);
+        auto rhs = evaluate_shared<i+1+tree_size<decltype(E::lhs)>,Nodes>(expr.rhs, env, values, leaders);
+        return expr.f(lhs, rhs);
+      }
+      else
+      {
+        return evaluate(expr, env);
+      }
+    }();
+
+    if constexpr (has_later_position_of_same_type<Nodes,i>())
+    {
+      std::get<i>(values.values) = result;
+    }
+
+    return result;
+  }
+  else
+  {
+    return evaluate(expr, env);
+  }
+}
+
+} // end detail
+
+
+// common_subexpressions wraps a tuple of expressions so that evaluating it evaluates each
+// subexpression which occurs more than once, whether within one expression or across several,
+// only once. Variables are subexpressions too, so each distinct name is looked up once.
+//
+// identical subexpressions are found when a common_subexpressions is constructed, by comparing
+// structural hashes, and so cost nothing to find during evaluation
+template<class... Es>
+class common_subexpressions
+{
+  public:
+    common_subexpressions(const std::tuple<Es...>& exprs)
+      : exprs_{exprs}
+    {
+      std::array<std::uint64_t, num_nodes> hashes;
+      std::array<const void*, num_nodes> nodes;
+
+      [&]<std::size_t... is>(std::index_sequence<is...>)
+      {
+        (detail::find_leaders<roots[is],node_types>(std::get<is>(exprs_), hashes, nodes, leaders_), ...);
+      }(std::index_sequence_for<Es...>());
+    }
+
+    common_subexpressions(const Es&... exprs)
+      : common_subexpressions{std::tuple<Es...>{exprs...}}
+    {}
+
+    const std::tuple<Es...>& expressions() const
+    {
+      return exprs_;
+    }
+
+    // the number of distinct subexpressions evaluated by each evaluation
+    std::size_t size() const
+    {
+      std::size_t result = 0;
+      for(std::size_t i = 0; i < num_nodes; ++i)
+      {
+        result += leaders_[i] == i;
+      }
+
+      return result;
+    }
+
+    template<class Env>
+    friend auto evaluate(const common_subexpressions& self, const Env& env)
+    {
+      detail::shared_values values(env, node_types());
+
+      return [&]<std::size_t... is>(std::index_sequence<is...>)
+      {
+        // braced initialization evaluates the expressions in order
+        return std::tuple<decltype(evaluate(std::declval<Es>(), env))...>{detail::evaluate_shared<roots[is],node_types>(std::get<is>(self.exprs_), env, values, self.leaders_)...};
+      }(std::index_sequence_for<Es...>());
+    }
+
+  private:
+    using node_types = decltype(std::tuple_cat(detail::preorder_types<Es>()...));
+    constexpr static std::size_t num_nodes = std::tuple_size_v<node_types>;
+
+    constexpr static auto roots = detail::root_positions<Es...>;
+
+    std::tuple<Es...> exprs_;
+
+    // leaders_[i] is the first position whose subexpression is identical to the one at position i
+    std::array<std::size_t, num_nodes> leaders_;
+};
+
+namespace detail
+{
 
-template<class T>
-struct variable
+// the positions of the nodes which depend on each variable, by name
+using dependency_map = std::map<std::string, std::vector<std::size_t>, std::less<>>;
+
+// records the position of expr, the node at position i, and of each operation beneath it, as
+// dependent on each of its variables, and returns the names of those variables
+template<std::size_t i, class E>
+std::vector<std::string_view> record_dependencies(const E& expr, dependency_map& dependents)
 {
-  std::string_view name;
+  std::vector<std::string_view> names;
 
-  friend T evaluate(const variable& self, const environment& env)
+  if constexpr (is_instantiation_of_v<E,op1>)
   {
-    auto found = env.find(self.name);
-    if(found == env.end()) throw std::runtime_error(fmt::format("{} not found in env", self.name));
-    return std::any_cast<T>(found->second);
+    names = record_dependencies<i+1>(expr.expr, dependents);
   }
-
-  friend std::ostream& operator<<(std::ostream& os, const variable& self)
+  else if constexpr (is_instantiation_of_v<E,op2>)
   {
-    return os << self.name;
+    names = record_dependencies<i+1>(expr.lhs, dependents);
+    auto rhs_names = record_dependencies<i+1+tree_size<decltype(E::lhs)>>(expr.rhs, dependents);
+    names.insert(names.end(), rhs_names.begin(), rhs_names.end());
+  }
+  else
+  {
+    for_each_variable(expr, [&](const auto& var)
+    {
+      names.push_back(var.name);
+    });
   }
-};
 
-template<unevaluated E, std::invocable<evaluated_t<E>> F>
-struct op1
-{
-  friend auto evaluate(const op1& self, const environment& env)
+  if constexpr (is_instantiation_of_v<E,op1> or is_instantiation_of_v<E,op2>)
   {
-    return self.f(evaluate(self.expr, env));
+    for(std::string_view name : names)
+    {
+      auto& positions = dependents[std::string(name)];
+      if(positions.empty() or positions.back() != i) positions.push_back(i);
+    }
   }
 
-  E expr;
-  F f;
+  return names;
+}
+
+// a tuple of a std::optional value for each of a list of nodes
+template<class Nodes>
+struct node_values;
+
+template<class... Nodes>
+struct node_values<std::tuple<Nodes...>>
+{
+  using type = std::tuple<std::optional<evaluated_t<typename Nodes::type>>...>;
 };
 
-template<class L, class R, std::invocable<evaluated_t<L>, evaluated_t<R>> F>
-  requires at_least_one_unevaluated<L,R>
-struct op2
+} // end detail
+
+
+// an evaluation_session evaluates a tuple of expressions repeatedly as the bindings of its
+// environment change, remembering the value of each subexpression between evaluations
+//
+// the session records which variables each subexpression depends on when it is created, so
+// changing a binding with set forgets exactly the values of the subexpressions which contain it.
+// the next evaluation recomputes those and reuses the rest.
+template<class... Es>
+class evaluation_session
 {
-  friend auto evaluate(const op2& self, const environment& env)
-  {
-    return self.f(evaluate(self.lhs,env), evaluate(self.rhs,env));
-  }
+  public:
+    evaluation_session(const environment& env, const std::tuple<Es...>& exprs)
+      : env_{env},
+        exprs_{exprs}
+    {
+      [&]<std::size_t... is>(std::index_sequence<is...>)
+      {
+        (detail::record_dependencies<roots[is]>(std::get<is>(exprs_), dependents_), ...);
+      }(std::index_sequence_for<Es...>());
+    }
 
-  L lhs;
-  R rhs;
-  F f;
+    evaluation_session(const environment& env, const Es&... exprs)
+      : evaluation_session{env, std::tuple<Es...>{exprs...}}
+    {}
+
+    const environment& env() const
+    {
+      return env_;
+    }
+
+    const std::tuple<Es...>& expressions() const
+    {
+      return exprs_;
+    }
+
+    // binds name to value, forgetting the value of each subexpression which depends on name
+    void set(std::string_view name, scalar value)
+    {
+      auto found = env_.find(name);
+      if(found == env_.end())
+      {
+        env_.emplace(std::string(name), std::move(value));
+      }
+      else
+      {
+        found->second = std::move(value);
+      }
+
+      auto dependents = dependents_.find(name);
+      if(dependents != dependents_.end())
+      {
+        for(std::size_t i : dependents->second)
+        {
+          valid_[i] = false;
+        }
+      }
+    }
+
+    // the number of times an evaluation reused the remembered value of a subexpression
+    std::size_t num_reused() const
+    {
+      return num_reused_;
+    }
+
+    // the number of times an evaluation computed the value of a subexpression
+    std::size_t num_recomputed() const
+    {
+      return num_recomputed_;
+    }
+
+    friend auto evaluate(evaluation_session& self)
+    {
+      return [&]<std::size_t... is>(std::index_sequence<is...>)
+      {
+        // braced initialization evaluates the expressions in order
+        return std::tuple<evaluated_t<Es>...>{self.template evaluate_node<roots[is]>(std::get<is>(self.exprs_))...};
+      }(std::index_sequence_for<Es...>());
+    }
+
+  private:
+    using node_types = decltype(std::tuple_cat(detail::preorder_types<Es>()...));
+    constexpr static std::size_t num_nodes = std::tuple_size_v<node_types>;
+
+    constexpr static auto roots = detail::root_positions<Es...>;
+
+    // evaluates expr, the node at position i
+    template<std::size_t i, class E>
+    evaluated_t<E> evaluate_node(const E& expr)
+    {
+      if constexpr (detail::is_instantiation_of_v<E,op1> or detail::is_instantiation_of_v<E,op2>)
+      {
+        auto& value = std::get<i>(values_);
+
+        if(valid_[i])
+        {
+          ++num_reused_;
+        }
+        else
+        {
+          if constexpr (detail::is_instantiation_of_v<E,op1>)
+          {
+            value = expr.f(evaluate_node<i+1>(expr.expr));
+          }
+          else
+          {
+            auto lhs = evaluate_node<i+1>(expr.lhs);
+            auto rhs = evaluate_node<i+1+detail::tree_size<decltype(E::lhs)>>(expr.rhs);
+            value = expr.f(lhs, rhs);
+          }
+
+          valid_[i] = true;
+          ++num_recomputed_;
+        }
+
+        return *value;
+      }
+      else
+      {
+        return evaluate(expr, env_);
+      }
+    }
+
+    environment env_;
+    std::tuple<Es...> exprs_;
+    detail::dependency_map dependents_;
+    typename detail::node_values<node_types>::type values_;
+    std::array<bool, num_nodes> valid_{};
+    std::size_t num_reused_ = 0;
+    std::size_t num_recomputed_ = 0;
 };
 
-struct unary_plus
+// a compiled_expression evaluates an expression against an array of positional arguments
+//
+// name resolution and type checking happen once, in compile, so evaluation performs no lookups,
+// allocates nothing, and does not throw
+template<class E>
+class compiled_expression
 {
-  constexpr auto operator()(const auto& value) const
-  {
-    return +value;
-  }
+  public:
+    using result_type = decltype(evaluate(std::declval<E>(), std::declval<positional_environment>()));
+
+    explicit compiled_expression(const E& expr)
+      : expr_{expr}
+    {}
+
+    // arguments must be ordered and typed as described by the schema given to compile
+    result_type operator()(const scalar* arguments) const noexcept
+    {
+      return evaluate(expr_, positional_environment{arguments});
+    }
+
+    result_type operator()(const std::vector<scalar>& arguments) const noexcept
+    {
+      return (*this)(arguments.data());
+    }
+
+    const E& expression() const
+    {
+      return expr_;
+    }
+
+  private:
+    E expr_;
 };
 
-template<unevaluated E>
-  requires requires(evaluated_t<E> value) { +value; }
-constexpr op1<E,unary_plus> operator+(const E& expr)
+namespace detail
 {
-  return {expr, unary_plus()};
-}
 
-template<unevaluated E>
-  requires requires(evaluated_t<E> value) { -value; }
-constexpr op1<E,std::negate<>> operator-(const E& expr)
+// true when each node of E may be evaluated against a positional_environment
+template<class E>
+constexpr bool is_compilable()
 {
-  return {expr, std::negate()};
+  if constexpr (is_instantiation_of_v<E,op1> or is_instantiation_of_v<E,residual>)
+  {
+    return is_compilable<decltype(E::expr)>();
+  }
+  else if constexpr (is_instantiation_of_v<E,op2>)
+  {
+    return is_compilable<decltype(E::lhs)>() and is_compilable<decltype(E::rhs)>();
+  }
+  else if constexpr (is_instantiation_of_v<E,std::tuple>)
+  {
+    return []<class... Ts>(std::type_identity<std::tuple<Ts...>>)
+    {
+      return (is_compilable<Ts>() and ...);
+    }(std::type_identity<E>());
+  }
+  else
+  {
+    return requires(const E& expr, const positional_environment& env) { evaluate(expr, env); };
+  }
 }
 
-template<unevaluated E>
-  requires requires(evaluated_t<E> value) { ~value; }
-constexpr op1<E,std::bit_not<>> operator~(const E& expr)
+} // end detail
+
+// compile resolves each of expr's variables to its position in s and checks its type
+//
+// throws std::runtime_error if a variable is not declared by s and bad_scalar_cast if
+// a variable's type differs from its declaration. an integral variable<T> may be declared
+// as a divider<T>, so that dividing by it is a multiplication
+template<class E>
+  requires (detail::is_compilable<E>())
+compiled_expression<E> compile(const E& expr, const schema& s)
 {
-  return {expr, std::bit_not()};
+  E result = expr;
+
+  for_each_variable(result, [&]<class T>(variable<T>& var)
+  {
+    var.slot = s.find(var.name);
+    if(var.slot == symbol_table::npos) throw std::runtime_error(fmt::format("{} not found in schema", var.name));
+
+    bool is_divider = false;
+    if constexpr (std::integral<T>) is_divider = s.type(var.slot) == typeid(divider<T>);
+
+    if(s.type(var.slot) != typeid(T) and not is_divider) throw bad_scalar_cast();
+  });
+
+  return compiled_expression<E>{result};
 }
 
-template<class L, at_least_one_unevaluated<L> R>
-  requires requires(evaluated_t<L> lhs, evaluated_t<R> rhs) { lhs + rhs; }
-constexpr op2<L,R,std::plus<>> operator+(const L& lhs, const R& rhs)
+
+// an instrumentation policy is not_instrumented or instrumented, from profile.hpp
+template<class P>
+concept instrumentation_policy = requires { { P::enabled } -> std::convertible_to<bool>; };
+
+namespace detail
 {
-  return {lhs, rhs, std::plus()};
-}
 
-template<class L, at_least_one_unevaluated<L> R>
-  requires requires(evaluated_t<L> lhs, evaluated_t<R> rhs) { lhs - rhs; }
-constexpr op2<L,R,std::minus<>> operator-(const L& lhs, const R& rhs)
+// the label of a node in a profile
+template<class E>
+constexpr std::string_view profile_label(const E& expr)
 {
-  return {lhs, rhs, std::minus()};
+  if constexpr (is_instantiation_of_v<E,op1> or is_instantiation_of_v<E,op2>) return operator_text<decltype(E::f)>();
+  else if constexpr (is_instantiation_of_v<E,variable>) return expr.name;
+  else return "residual";
 }
 
-template<class L, at_least_one_unevaluated<L> R>
-  requires requires(evaluated_t<L> lhs, evaluated_t<R> rhs) { lhs * rhs; }
-constexpr op2<L,R,std::multiplies<>> operator*(const L& lhs, const R& rhs)
+// evaluates a variable, recording a missing binding or a binding of the wrong type before rethrowing
+template<class T, class Env>
+const scalar& instrumented_lookup(const variable<T>& var, const Env& env, profile_buffer& buffer, std::uint64_t expression, std::uint32_t i)
 {
-  return {lhs, rhs, std::multiplies()};
+  try
+  {
+    return lookup(var, env);
+  }
+  catch(const std::runtime_error&)
+  {
+    buffer.record(expression, i, var.name, profile_buffer::miss);
+    throw;
+  }
 }
 
-template<class L, at_least_one_unevaluated<L> R>
-  requires requires(evaluated_t<L> lhs, evaluated_t<R> rhs) { lhs / rhs; }
-constexpr op2<L,R,std::divides<>> operator/(const L& lhs, const R& rhs)
+template<class T>
+T instrumented_cast(const variable<T>& var, const scalar& value, profile_buffer& buffer, std::uint64_t expression, std::uint32_t i)
 {
-  return {lhs, rhs, std::divides()};
+  try
+  {
+    return scalar_value_cast<T>(value);
+  }
+  catch(const bad_scalar_cast&)
+  {
+    buffer.record(expression, i, var.name, profile_buffer::mismatch);
+    throw;
+  }
 }
 
-template<class L, at_least_one_unevaluated<L> R>
-  requires requires(evaluated_t<L> lhs, evaluated_t<R> rhs) { lhs % rhs; }
-constexpr op2<L,R,std::modulus<>> operator%(const L& lhs, const R& rhs)
+// evaluates expr, the node at position i of the expression whose structural hash is expression,
+// recording the calls and cycles of each of its operations and variables in buffer
+template<std::size_t i, class E, class Env>
+auto evaluate_instrumented(const E& expr, const Env& env, profile_buffer& buffer, std::uint64_t expression)
 {
-  return {lhs, rhs, std::modulus()};
+  if constexpr (is_instantiation_of_v<E,op1> or is_instantiation_of_v<E,op2> or is_instantiation_of_v<E,variable> or is_instantiation_of_v<E,residual>)
+  {
+    std::uint64_t start = timestamp();
+
+    auto result = [&]
+    {
+      if constexpr (is_instantiation_of_v<E,op1>)
+      {
+        return expr.f(evaluate_instrumented<i+1>(expr.expr, env, buffer, expression));
+      }
+      else if constexpr (is_instantiation_of_v<E,op2>)
+      {
+        constexpr std::size_t rhs = i + 1 + tree_size<decltype(E::lhs)>;
+        auto l = evaluate_instrumented<i+1>(expr.lhs, env, buffer, expression);
+
+        if constexpr (divides_by_variable<decltype(E::lhs),decltype(E::rhs),decltype(E::f)>)
+        {
+          // as op2's evaluate does, a divisor bound to a divider divides by multiplication
+          std::uint64_t divisor_start = timestamp();
+          const scalar& divisor = instrumented_lookup(expr.rhs, env, buffer, expression, rhs);
+
+          if(auto d = scalar_cast<divider<evaluated_t<decltype(E::rhs)>>>(&divisor))
+          {
+            buffer.record(expression, rhs, expr.rhs.name, timestamp() - divisor_start);
+            return expr.f(l, *d);
+          }
+
+          auto r = instrumented_cast(expr.rhs, divisor, buffer, expression, rhs);
+          buffer.record(expression, rhs, expr.rhs.name, timestamp() - divisor_start);
+          return expr.f(l, r);
+        }
+        else
+        {
+          auto r = evaluate_instrumented<rhs>(expr.rhs, env, buffer, expression);
+          return expr.f(l, r);
+        }
+      }
+      else if constexpr (is_instantiation_of_v<E,variable>)
+      {
+        if constexpr (std::same_as<Env,positional_environment>)
+        {
+          // compile has already checked the arguments' names and types
+          return evaluate(expr, env);
+        }
+        else
+        {
+          return instrumented_cast(expr, instrumented_lookup(expr, env, buffer, expression, i), buffer, expression, i);
+        }
+      }
+      else
+      {
+        return evaluate(expr, env);
+      }
+    }();
+
+    buffer.record(expression, i, profile_label(expr), timestamp() - start);
+    return result;
+  }
+  else
+  {
+    // literals cost nothing to evaluate, so they are not recorded
+    return evaluate(expr, env);
+  }
 }
 
-// user-defined literal operator allows variable written as literals, For example,
-//
-//     auto var = "block_size"_v;
+} // end detail
+
+
+// evaluates expr in env as policy directs
 //
-// var has type variable<int>.
-constexpr variable<int> operator""_v(const char* str, std::size_t n) noexcept
+// with not_instrumented, this is evaluate(expr, env), and costs nothing more. with instrumented, each
+// operation and variable of expr records its calls and the cycles spent evaluating it, including its
+// operands, in the profile named by the policy, keyed by expr's structural hash. a variable which is
+// not bound, or is bound to a value of the wrong type, also records a miss or a mismatch before
+// evaluate throws. the elements of a tuple are recorded as separate expressions.
+template<class E, class Env, instrumentation_policy P>
+  requires requires(const E& expr, const Env& env) { evaluate(expr, env); }
+auto evaluate(const E& expr, const Env& env, const P& policy)
 {
-  return {std::string_view{str,n}};
+  if constexpr (not P::enabled)
+  {
+    return evaluate(expr, env);
+  }
+  else if constexpr (detail::is_instantiation_of_v<E,std::tuple>)
+  {
+    return std::apply([&](const auto&... elements)
+    {
+      // braced initialization evaluates the elements in order
+      return std::tuple<decltype(evaluate(elements, env))...>{evaluate(elements, env, policy)...};
+    },
+    expr);
+  }
+  else
+  {
+    return detail::evaluate_instrumented<0>(expr, env, policy.target->local(), structural_hash(expr));
+  }
 }
 
 #if __has_include(<fmt/format.h>)
 
+#include <fmt/format.h>
+
 namespace detail
 {
 
-template<typename T, template<typename...> class Template>
-struct is_instantiation_of : std::false_type {};
+// true when expr is an operation, which is parenthesized when it is an operand of another
+template<class T>
+constexpr bool is_operation(const T& expr)
+{
+  if constexpr (requires { expr.is_operation(); })
+  {
+    return expr.is_operation();
+  }
+  else
+  {
+    return is_instantiation_of_v<T,op1> or is_instantiation_of_v<T,op2>;
+  }
+}
 
-template<template<typename...> class Template, typename... Args>
-struct is_instantiation_of<Template<Args...>, Template> : std::true_type {};
+// a residual with a value formats as a literal
+template<class E>
+constexpr bool is_operation(const residual<E>& expr)
+{
+  return not expr.value and is_operation(expr.expr);
+}
 
-template<typename T, template<typename...> class Template>
-inline constexpr bool is_instantiation_of_v = is_instantiation_of<T,Template>::value;
+// writes the text of an operand to out, parenthesized if it is an operation
+template<class E, class OutputIt>
+OutputIt format_operand(const E& expr, OutputIt out);
+
+// writes the text of expr to out
+//
+// names and operators are copied rather than formatted, so formatting an expression allocates
+// nothing unless one of its literals does
+template<class E, class OutputIt>
+OutputIt format_text(const E& expr, OutputIt out)
+{
+  auto copy = [&](std::string_view s)
+  {
+    out = std::copy_n(s.data(), s.size(), out);
+  };
+
+  if constexpr (is_instantiation_of_v<E,op1>)
+  {
+    copy(operator_text<decltype(expr.f)>());
+    out = format_operand(expr.expr, out);
+  }
+  else if constexpr (is_instantiation_of_v<E,op2>)
+  {
+    out = format_operand(expr.lhs, out);
+    copy(operator_text<decltype(expr.f)>());
+    out = format_operand(expr.rhs, out);
+  }
+  else if constexpr (is_instantiation_of_v<E,variable>)
+  {
+    copy(expr.name);
+  }
+  else if constexpr (is_instantiation_of_v<E,residual>)
+  {
+    if(expr.value) return fmt::format_to(out, "{}", *expr.value);
+    out = format_text(expr.expr, out);
+  }
+  else
+  {
+    out = fmt::format_to(out, "{}", expr);
+  }
+
+  return out;
+}
+
+template<class E, class OutputIt>
+OutputIt format_operand(const E& expr, OutputIt out)
+{
+  if(not is_operation(expr)) return format_text(expr, out);
+
+  *out++ = '(';
+  out = format_text(expr, out);
+  *out++ = ')';
+  return out;
+}
 
 } // end detail
 
-#include <fmt/format.h>
+// writes the text of expr to buffer, as formatting expr would, and returns the text written
+//
+// nothing is allocated unless formatting one of expr's literals does
+//
+// throws std::length_error if buffer is too small
+template<class E>
+std::string_view render_to(const E& expr, std::span<char> buffer)
+{
+  auto result = fmt::format_to_n(buffer.data(), buffer.size(), "{}", expr);
+  if(result.size > buffer.size()) throw std::length_error("render_to: buffer is too small.");
+  return {buffer.data(), result.size};
+}
 
 template<class T>
 struct fmt::formatter<variable<T>>
@@ -203,6 +2128,33 @@ struct fmt::formatter<variable<T>>
   }
 };
 
+// a residual with a value formats as its value, and otherwise as its expression
+template<class E>
+struct fmt::formatter<residual<E>>
+{
+  template<class ParseContext>
+  constexpr auto parse(ParseContext& ctx)
+  {
+    return ctx.begin();
+  }
+
+  template<class FormatContext>
+  auto format(const residual<E>& expr, FormatContext& ctx)
+  {
+    return ::detail::format_text(expr, ctx.out());
+  }
+};
+
+template<auto v>
+struct fmt::formatter<constant<v>> : fmt::formatter<decltype(v)>
+{
+  template<class FormatContext>
+  auto format(const constant<v>&, FormatContext& ctx)
+  {
+    return fmt::formatter<decltype(v)>::format(v, ctx);
+  }
+};
+
 template<unevaluated E, std::invocable<evaluated_t<E>> F>
 struct fmt::formatter<op1<E,F>>
 {
@@ -215,24 +2167,7 @@ struct fmt::formatter<op1<E,F>>
   template<class FormatContext>
   auto format(const op1<E,F>& expr, FormatContext& ctx)
   {
-    char op = '?';
-    if constexpr (std::same_as<F,unary_plus>)
-    {
-      op = '+';
-    }
-    else if constexpr (std::same_as<F,std::negate<>>)
-    {
-      op = '-';
-    }
-    else if constexpr (std::same_as<F,std::bit_not<>>)
-    {
-      op = '~';
-    }
-
-    constexpr bool needs_parens = ::detail::is_instantiation_of_v<E,op1> or ::detail::is_instantiation_of_v<E,op2>;
-    constexpr auto format_string = needs_parens ? "{}({})" : "{}{}";
-
-    return fmt::format_to(ctx.out(), format_string, op, expr.expr);
+    return ::detail::format_text(expr, ctx.out());
   }
 };
 
@@ -248,39 +2183,7 @@ struct fmt::formatter<op2<L,R,F>>
   template<class FormatContext>
   auto format(const op2<L,R,F>& expr, FormatContext& ctx)
   {
-    char op = '?';
-    if constexpr (std::same_as<F,std::plus<>>)
-    {
-      op = '+';
-    }
-    else if constexpr (std::same_as<F,std::minus<>>)
-    {
-      op = '-';
-    }
-    else if constexpr (std::same_as<F,std::multiplies<>>)
-    {
-      op = '*';
-    }
-    else if constexpr (std::same_as<F,std::divides<>>)
-    {
-      op = '/';
-    }
-    else if constexpr (std::same_as<F,std::modulus<>>)
-    {
-      op = '%';
-    }
-
-    constexpr bool lhs_needs_parens = ::detail::is_instantiation_of_v<L,op1> or ::detail::is_instantiation_of_v<L,op2>;
-    constexpr bool rhs_needs_parens = ::detail::is_instantiation_of_v<R,op1> or ::detail::is_instantiation_of_v<R,op2>;
-
-    constexpr auto format_string = 
-      (lhs_needs_parens and rhs_needs_parens)         ? "({}){}({})" :
-      (lhs_needs_parens and not rhs_needs_parens)     ? "({}){}{}"   :
-      (not lhs_needs_parens and rhs_needs_parens)     ? "{}{}({})"
-                                                      : "{}{}{}"
-    ;
-
-    return fmt::format_to(ctx.out(), format_string, expr.lhs, op, expr.rhs);
+    return ::detail::format_text(expr, ctx.out());
   }
 };
 
@@ -1,13 +1,25 @@
 #pragma once
 
 #include <algorithm>
+#include <array>
+#include <bit>
+#include <cmath>
 #include <concepts>
+#include <cstdint>
 #include <functional>
 #include <iostream>
+#include <limits>
+#include <numeric>
+#include <optional>
+#include <span>
+#include <stdexcept>
 #include <string_view>
 #include <tuple>
 #include <type_traits>
 #include <utility>
+#include "fingerprint.hpp"
+#include "profile.hpp"
+#include "simd.hpp"
 
 namespace detail
 {
@@ -23,6 +35,24 @@ constexpr auto remove_tuple_element(const std::tuple<Ts...>& t)
   return helper(std::make_index_sequence<sizeof...(Ts) - 1>{});
 }
 
+template<typename T, template<typename...> class Template>
+struct is_instantiation_of : std::false_type {};
+
+template<template<typename...> class Template, typename... Args>
+struct is_instantiation_of<Template<Args...>, Template> : std::true_type {};
+
+template<typename T, template<typename...> class Template>
+inline constexpr bool is_instantiation_of_v = is_instantiation_of<T,Template>::value;
+
+template<class T>
+struct is_span : std::false_type {};
+
+template<class T, std::size_t extent>
+struct is_span<std::span<T,extent>> : std::true_type {};
+
+template<class T>
+inline constexpr bool is_span_v = is_span<T>::value;
+
 // sl: abbreviation of string_literal
 template<auto len>
 struct sl
@@ -43,11 +73,123 @@ struct sl
 } // end detail
 
 
-template<detail::sl n, class T = int>
+// annotations state facts about the values of a variable, such as
+//
+//     variable<"block_size", int, pow2> block_size;
+//
+// which the operators exploit to build cheaper expressions: dividing by block_size shifts rather
+// than divides. a variable with annotations must be bound by a binding with the same annotations,
+// which checks its value once, when it is made, so that evaluation may rely on them.
+
+// the value is a positive power of two
+struct pow2
+{
+  template<std::integral T>
+  constexpr static bool admits(T value)
+  {
+    return value > 0 and std::has_single_bit(std::make_unsigned_t<T>(value));
+  }
+};
+
+// the value is a multiple of m
+template<auto m>
+  requires (std::integral<decltype(m)> and m > 0)
+struct multiple_of
+{
+  constexpr static auto multiple = m;
+
+  template<std::integral T>
+  constexpr static bool admits(T value)
+  {
+    return value % m == 0;
+  }
+};
+
+// the value lies within [lo, hi]
+template<auto lo, auto hi>
+  requires (lo <= hi)
+struct in_range
+{
+  constexpr static auto min = lo;
+  constexpr static auto max = hi;
+
+  template<class T>
+  constexpr static bool admits(const T& value)
+  {
+    return lo <= value and value <= hi;
+  }
+};
+
+
+namespace detail
+{
+
+template<class T, class Tuple>
+constexpr bool tuple_contains_v = false;
+
+template<class T, class... Ts>
+constexpr bool tuple_contains_v<T, std::tuple<Ts...>> = (std::same_as<T,Ts> or ...);
+
+// throws std::domain_error unless value satisfies each of Annotations. each element of a span is
+// checked, as are both bounds of an interval, which are the least and greatest of its values
+template<class... Annotations, class T>
+constexpr void validate(const T& value)
+{
+  if constexpr (sizeof...(Annotations) > 0)
+  {
+    if constexpr (is_span_v<T>)
+    {
+      for(const auto& element : value)
+      {
+        validate<Annotations...>(element);
+      }
+    }
+    else if constexpr (requires { value.lo; value.hi; })
+    {
+      validate<Annotations...>(value.lo);
+      validate<Annotations...>(value.hi);
+    }
+    else if(not (Annotations::admits(value) and ...))
+    {
+      throw std::domain_error("binding: value does not satisfy its annotations.");
+    }
+  }
+}
+
+} // end detail
+
+
+template<detail::sl n, class T = int, class... Annotations>
 struct binding
 {
   constexpr static std::string_view name = n;
   using value_type = T;
+  using annotations = std::tuple<Annotations...>;
+
+  // throws std::domain_error if value does not satisfy Annotations
+  constexpr binding(const T& value)
+    : value_{value}
+  {
+    detail::validate<Annotations...>(value);
+  }
+
+  // the value may be read but not changed, as operators built from Annotations rely on them holding.
+  // a binding may only be replaced by another, which checks its own value
+  constexpr const value_type& value() const
+  {
+    return value_;
+  }
+
+  private:
+    value_type value_;
+};
+
+template<detail::sl n, class T>
+struct binding<n,T>
+{
+  constexpr static std::string_view name = n;
+  using value_type = T;
+  using annotations = std::tuple<>;
   value_type value;
 };
 
@@ -86,8 +228,18 @@ class environment
     {
       if constexpr (contains<name>())
       {
-        auto&& binding = std::get<find<name>()>(bindings_);
-        return binding.value;
+        const auto& binding = std::get<find<name>()>(bindings_);
+
+        // either way, the value is returned by value
+        if constexpr (std::tuple_size_v<typename binding_type<name>::annotations> == 0)
+        {
+          return binding.value;
+        }
+        else
+        {
+          typename binding_type<name>::value_type result = binding.value();
+          return result;
+        }
       }
       else
       {
@@ -96,6 +248,28 @@ class environment
       }
     }
 
+    // returns a reference to the value bound to name, so that it may be changed in place
+    //
+    // an annotated binding may only be changed through assign, which checks its new value
+    template<detail::sl name>
+    constexpr auto& get()
+    {
+      static_assert(contains<name>(), "Name not in environment.");
+      static_assert(std::tuple_size_v<typename binding_type<name>::annotations> == 0, "get: an annotated binding may only be changed through assign.");
+      return std::get<find<name>()>(bindings_).value;
+    }
+
+    // binds name to value in place
+    //
+    // throws std::domain_error if value does not satisfy the annotations of name's binding
+    template<detail::sl name, class T>
+    constexpr void assign(const T& value)
+    {
+      static_assert(contains<name>(), "Name not in environment.");
+      using binding_type = binding_type<name>;
+      std::get<find<name>()>(bindings_) = binding_type{typename binding_type::value_type(value)};
+    }
+
     template<detail::sl name>
     friend constexpr decltype(auto) get(const environment& env)
     {
@@ -123,7 +297,13 @@ class environment
     {
       if constexpr (contains<name>())
       {
-        return erase<name>().template set<name>(value);
+        // the new binding keeps the annotations of the one it replaces, and so is checked against them
+        return [&]<class... Annotations>(std::tuple<Annotations...>)
+        {
+          binding<name,T,Annotations...> replacement{value};
+          std::tuple new_bindings = std::tuple_cat(detail::remove_tuple_element<find<name>()>(bindings_), std::tuple(replacement));
+          return make_environment(new_bindings);
+        }(typename binding_type<name>::annotations());
       }
       else
       {
@@ -146,31 +326,61 @@ class environment
       return {bindings};
     }
 
-    template<detail::sl name, std::size_t i>
-    constexpr static int find_beginning_at()
+    constexpr static std::array<std::string_view, sizeof...(Bindings)> names{Bindings::name...};
+
+    // a permutation of the indices of Bindings... which sorts them by name
+    //
+    // bindings of the same name are kept in order, so that find returns the first of them
+    constexpr static std::array<std::size_t, sizeof...(Bindings)> sorted_indices = []
     {
-      if constexpr (i == size())
+      std::array<std::size_t, sizeof...(Bindings)> result{};
+      for(std::size_t i = 0; i < result.size(); ++i)
       {
-        return i;
+        result[i] = i;
       }
-      else if constexpr(name == std::tuple_element_t<i,tuple_type>::name)
+
+      std::sort(result.begin(), result.end(), [](std::size_t a, std::size_t b)
       {
-        return i;
-      }
-      else
+        return names[a] < names[b] or (names[a] == names[b] and a < b);
+      });
+
+      return result;
+    }();
+
+    // returns the index of the binding named name, or size() if there is none
+    //
+    // this is a binary search evaluated during constant evaluation, so looking up a name neither
+    // instantiates a template per binding nor recurses
+    template<detail::sl name>
+    constexpr static std::size_t find()
+    {
+      std::string_view key = name;
+
+      std::size_t lo = 0;
+      std::size_t hi = size();
+      while(lo < hi)
       {
-        return find_beginning_at<name, i+1>();
+        std::size_t mid = lo + (hi - lo) / 2;
+
+        if(names[sorted_indices[mid]] < key)
+        {
+          lo = mid + 1;
+        }
+        else
+        {
+          hi = mid;
+        }
       }
+
+      return (lo < size() and names[sorted_indices[lo]] == key) ? sorted_indices[lo] : size();
     }
 
+  public:
+    // the type of the binding of name
     template<detail::sl name>
-    constexpr static int find()
-    {
-      // XXX if we kept the Bindings... in sorted order,
-      //     we could do a logarithmic search
-      return find_beginning_at<name,0>();
-    }
+    using binding_type = std::tuple_element_t<find<name>(), tuple_type>;
 
+  private:
     std::tuple<Bindings...> bindings_;
 };
 
@@ -208,10 +418,20 @@ template<class T, class... Bindings>
   requires (not unevaluated<T>)
 constexpr T evaluate(const T& value, const environment<Bindings...>&)
 {
-  // XXX when T is a tuple_like, we need to map evaluate across the tuple's elements
   return value;
 }
 
+// evaluating a tuple returns a tuple of the recursive evaluation of its elements
+template<class... Ts, class... Bindings>
+constexpr auto evaluate(const std::tuple<Ts...>& t, const environment<Bindings...>& env)
+{
+  return std::apply([&](const auto&... elements)
+  {
+    return std::make_tuple(evaluate(elements, env)...);
+  },
+  t);
+}
+
 
 template<unevaluated E, std::invocable<evaluated_t<E>> F>
 struct op1
@@ -247,12 +467,38 @@ struct op2
   F f;
 };
 
-template<detail::sl n, class T = int>
+// an op3 applies a function of three operands, such as a fused multiply-add, which rewrite rules
+// build in place of several op2s
+template<class A, class B, class C, std::invocable<evaluated_t<A>, evaluated_t<B>, evaluated_t<C>> F>
+  requires (unevaluated<A> or unevaluated<B> or unevaluated<C>)
+struct op3
+{
+  struct is_unevaluated {};
+  using value_type = std::invoke_result_t<F,evaluated_t<A>,evaluated_t<B>,evaluated_t<C>>;
+
+  template<class... Bindings>
+  friend constexpr auto evaluate(const op3& self, const environment<Bindings...>& env)
+  {
+    return self.f(evaluate(self.first, env), evaluate(self.second, env), evaluate(self.third, env));
+  }
+
+  A first;
+  B second;
+  C third;
+  F f;
+};
+
+template<detail::sl n, class T = int, class... Annotations>
 struct variable
 {
   struct is_unevaluated {};
   constexpr static std::string_view name = n.value;
   using value_type = T;
+  using annotations = std::tuple<Annotations...>;
+
+  // true when the binding B carries each of this variable's annotations
+  template<class B>
+  constexpr static bool is_annotated_by = (detail::tuple_contains_v<Annotations, typename B::annotations> and ...);
 
   friend std::ostream& operator<<(std::ostream& os, variable self)
   {
@@ -267,6 +513,7 @@ struct variable
 
     if constexpr (found)
     {
+      static_assert(is_annotated_by<typename environment<Bindings...>::template binding_type<n>>, "evaluate(variable,env): the binding of an annotated variable must carry its annotations.");
       return get<n>(env);
     }
     else
@@ -275,6 +522,21 @@ struct variable
       return;
     }
   }
+
+  // partially evaluating a variable yields its value if env binds it, and the variable otherwise
+  template<class... Bindings>
+  friend constexpr auto partially_evaluate(const variable& self, const environment<Bindings...>& env)
+  {
+    if constexpr (environment<Bindings...>::template contains<n>())
+    {
+      static_assert(is_annotated_by<typename environment<Bindings...>::template binding_type<n>>, "partially_evaluate(variable,env): the binding of an annotated variable must carry its annotations.");
+      return get<n>(env);
+    }
+    else
+    {
+      return self;
+    }
+  }
 };
 
 struct unary_plus
@@ -285,207 +547,2481 @@ struct unary_plus
   }
 };
 
-template<unevaluated E>
-  requires requires(evaluated_t<E> value) { +value; }
-constexpr op1<E,unary_plus> operator+(const E& expr)
+// a constant is a literal whose value is part of its type
+//
+// because the operators below can see a constant's value, they simplify expressions
+// involving it as they are built. For example, x * 1_c is just x.
+template<auto v>
+struct constant
 {
-  return {expr, unary_plus()};
-}
+  using value_type = decltype(v);
+  constexpr static value_type value = v;
 
-template<unevaluated E>
-  requires requires(evaluated_t<E> value) { -value; }
-constexpr op1<E,std::negate<>> operator-(const E& expr)
-{
-  return {expr, std::negate()};
-}
+  constexpr operator value_type() const
+  {
+    return v;
+  }
+};
 
-template<unevaluated E>
-  requires requires(evaluated_t<E> value) { ~value; }
-constexpr op1<E,std::bit_not<>> operator~(const E& expr)
-{
-  return {expr, std::bit_not()};
-}
 
-template<class L, at_least_one_unevaluated<L> R>
-  requires requires(evaluated_t<L> lhs, evaluated_t<R> rhs) { lhs + rhs; }
-constexpr op2<L,R,std::plus<>> operator+(const L& lhs, const R& rhs)
-{
-  return {lhs, rhs, std::plus()};
-}
+// a rewrite_rule replaces an expression of type E, as it is built, with a cheaper expression of
+// the same value
+//
+// rewrite_rule is the extension point for rules: a specialization for a pattern of op1, op2 and op3
+// types with a static member function apply(const E&), returning an expression of another type,
+// adds a rule. the result is rewritten in turn, so rules may enable one another. the built-in
+// rules below are partial specializations constrained by the patterns they match, so a rule must
+// not match the same expressions as another.
+template<class E>
+struct rewrite_rule {};
 
-template<class L, at_least_one_unevaluated<L> R>
-  requires requires(evaluated_t<L> lhs, evaluated_t<R> rhs) { lhs - rhs; }
-constexpr op2<L,R,std::minus<>> operator-(const L& lhs, const R& rhs)
+namespace detail
 {
-  return {lhs, rhs, std::minus()};
-}
 
-template<class L, at_least_one_unevaluated<L> R>
-  requires requires(evaluated_t<L> lhs, evaluated_t<R> rhs) { lhs * rhs; }
-constexpr op2<L,R,std::multiplies<>> operator*(const L& lhs, const R& rhs)
+template<class E>
+constexpr auto rewrite(const E& expr)
 {
-  return {lhs, rhs, std::multiplies()};
+  if constexpr (requires { rewrite_rule<E>::apply(expr); })
+  {
+    return rewrite(rewrite_rule<E>::apply(expr));
+  }
+  else
+  {
+    return expr;
+  }
 }
 
-template<class L, at_least_one_unevaluated<L> R>
-  requires requires(evaluated_t<L> lhs, evaluated_t<R> rhs) { lhs / rhs; }
-constexpr op2<L,R,std::divides<>> operator/(const L& lhs, const R& rhs)
-{
-  return {lhs, rhs, std::divides()};
-}
+template<class T>
+struct is_constant : std::false_type {};
 
-template<class L, at_least_one_unevaluated<L> R>
-  requires requires(evaluated_t<L> lhs, evaluated_t<R> rhs) { lhs % rhs; }
-constexpr op2<L,R,std::modulus<>> operator%(const L& lhs, const R& rhs)
-{
-  return {lhs, rhs, std::modulus()};
-}
+template<auto v>
+struct is_constant<constant<v>> : std::true_type {};
 
-#if defined(__cpp_user_defined_literals)
+template<class T>
+inline constexpr bool is_constant_v = is_constant<T>::value;
 
-// user-defined literal operator allows variable written as literals, For example,
-//
-//     auto var = "block_size"_v;
-//
-// var has type variable<"block_size",int>.
-template<detail::sl name>
-constexpr variable<name> operator""_v() noexcept
+// the type of a literal's value
+template<class T>
+struct literal_value
 {
-  return {};
-}
-
-#endif // __cpp_user_defined_literals
-
-#if __has_include(<fmt/format.h>)
+  using type = T;
+};
 
-namespace detail
+template<auto v>
+struct literal_value<constant<v>>
 {
+  using type = decltype(v);
+};
 
-template<typename T, template<typename...> class Template>
-struct is_instantiation_of : std::false_type {};
-
-template<template<typename...> class Template, typename... Args>
-struct is_instantiation_of<Template<Args...>, Template> : std::true_type {};
-
-template<typename T, template<typename...> class Template>
-inline constexpr bool is_instantiation_of_v = is_instantiation_of<T,Template>::value;
+template<class T>
+using literal_value_t = typename literal_value<T>::type;
 
-} // end detail
+template<class F>
+concept additive = std::same_as<F,std::plus<>> or std::same_as<F,std::minus<>>;
 
-#include <fmt/format.h>
+template<class F>
+concept multiplicative = std::same_as<F,std::multiplies<>>;
 
-#if defined(__circle_lang__)
-template<auto len, detail::sl<len> name>
-struct fmt::formatter<variable<name>>
+// true when C is a constant which leaves the other operand of F unchanged
+template<class F, class C, bool on_left>
+constexpr bool is_identity_element()
 {
-  template<class ParseContext>
-  constexpr auto parse(ParseContext& ctx)
+  if constexpr (not is_constant_v<C>)
   {
-    return ctx.begin();
+    return false;
   }
-
-  template<class FormatContext>
-  auto format(const variable<name>&, FormatContext& ctx)
+  else if constexpr (std::same_as<F,std::plus<>>)
   {
-    return fmt::format_to(ctx.out(), "{}", name);
+    return C::value == 0;
   }
-};
-#else
-template<detail::sl name>
-struct fmt::formatter<variable<name>>
-{
-  template<class ParseContext>
-  constexpr auto parse(ParseContext& ctx)
+  else if constexpr (std::same_as<F,std::minus<>>)
   {
-    return ctx.begin();
+    return not on_left and C::value == 0;
   }
-
-  template<class FormatContext>
-  auto format(const variable<name>& var, FormatContext& ctx)
+  else if constexpr (std::same_as<F,std::multiplies<>>)
   {
-    return fmt::format_to(ctx.out(), "{}", var.name);
+    return C::value == 1;
   }
-};
-#endif
+  else if constexpr (std::same_as<F,std::divides<>>)
+  {
+    return not on_left and C::value == 1;
+  }
+  else
+  {
+    return false;
+  }
+}
 
-template<unevaluated E, std::invocable<evaluated_t<E>> F>
-struct fmt::formatter<op1<E,F>>
+// true when arithmetic on T wraps modulo 2^N rather than overflowing, so that literals of type T
+// may be folded together whatever their values
+template<class T>
+constexpr bool wraps_around()
 {
-  template<class ParseContext>
-  constexpr auto parse(ParseContext& ctx)
+  return std::unsigned_integral<T> and std::same_as<T, decltype(T() + T())>;
+}
+
+// true when a F b does not fit in T
+template<class F, class T>
+constexpr bool fold_overflows(F, T a, T b)
+{
+  T result{};
+
+  if constexpr (std::same_as<F,std::plus<>>)
   {
-    return ctx.begin();
+    return __builtin_add_overflow(a, b, &result);
   }
-
-  template<class FormatContext>
-  auto format(const op1<E,F>& expr, FormatContext& ctx)
+  else if constexpr (std::same_as<F,std::minus<>>)
   {
-    char op = '?';
-    if constexpr (std::same_as<F,unary_plus>)
-    {
-      op = '+';
-    }
-    else if constexpr (std::same_as<F,std::negate<>>)
-    {
-      op = '-';
-    }
-    else if constexpr (std::same_as<F,std::bit_not<>>)
-    {
-      op = '~';
-    }
+    return __builtin_sub_overflow(a, b, &result);
+  }
+  else
+  {
+    return __builtin_mul_overflow(a, b, &result);
+  }
+}
 
-    constexpr bool needs_parens = ::detail::is_instantiation_of_v<E,op1> or ::detail::is_instantiation_of_v<E,op2>;
-    constexpr auto format_string = needs_parens ? "{}({})" : "{}{}";
+// true when the literals a and b may be combined with one of +, - or * as expressions are built
+//
+// this requires that the folded literal equals a F b, which is always the case for types which
+// wrap around. otherwise a and b must both be constants, so that overflow is found when the
+// expression's type is chosen, and an expression whose folded literal would overflow is left as
+// it was written.
+template<class F, class A, class B>
+constexpr bool is_foldable()
+{
+  using T = literal_value_t<A>;
 
-    return fmt::format_to(ctx.out(), format_string, op, expr.expr);
+  if constexpr (wraps_around<T>())
+  {
+    return true;
   }
-};
+  else if constexpr (is_constant_v<A> and is_constant_v<B>)
+  {
+    return not fold_overflows(F(), T(A::value), T(B::value));
+  }
+  else
+  {
+    return false;
+  }
+}
 
-template<class L, class R, std::invocable<evaluated_t<L>, evaluated_t<R>> F>
-struct fmt::formatter<op2<L,R,F>>
+// combines the literals a and b with one of +, - or *, wrapping around modulo 2^N
+//
+// the result is a constant when both a and b are
+template<class F, class A, class B>
+constexpr auto fold(F f, const A& a, const B& b)
 {
-  template<class ParseContext>
-  constexpr auto parse(ParseContext& ctx)
+  using T = literal_value_t<A>;
+
+  if constexpr (is_constant_v<A> and is_constant_v<B>)
   {
-    return ctx.begin();
+    return constant<T(f(T(A::value), T(B::value)))>{};
   }
-
-  template<class FormatContext>
-  auto format(const op2<L,R,F>& expr, FormatContext& ctx)
+  else
   {
-    char op = '?';
-    if constexpr (std::same_as<F,std::plus<>>)
+    return T(f(T(a), T(b)));
+  }
+}
+
+// the operation G which rewrites (x F1 a) F2 b as x F1 (a G b)
+template<class F1, class F2>
+using reassociated_operation_t = std::conditional_t<
+  std::same_as<F1,F2>,
+  std::conditional_t<additive<F2>, std::plus<>, F2>,
+  std::minus<>
+>;
+
+// true when the literal operands of (x F1 a) F2 b, or of (a F1 x) F2 b, may be folded together
+//
+// this requires that F1 and F2 are both additive or both multiplicative, that x, a, and b are all
+// of the same integral type, and that a and b are foldable, so that reassociation yields exactly
+// the same value
+template<class L, class R, class F2, bool x_on_left>
+constexpr bool is_reassociable()
+{
+  if constexpr (is_instantiation_of_v<L,op2> and not unevaluated<R>)
+  {
+    using X = std::conditional_t<x_on_left, decltype(L::lhs), decltype(L::rhs)>;
+    using A = std::conditional_t<x_on_left, decltype(L::rhs), decltype(L::lhs)>;
+    using F1 = decltype(L::f);
+
+    if constexpr (unevaluated<X> and not unevaluated<A>)
+    {
+      using T = evaluated_t<X>;
+      using G = std::conditional_t<x_on_left, reassociated_operation_t<F1,F2>, F2>;
+
+      if constexpr (((additive<F1> and additive<F2>) or (multiplicative<F1> and multiplicative<F2>))
+        and std::integral<T>
+        and std::same_as<T, literal_value_t<A>>
+        and std::same_as<T, literal_value_t<R>>)
+      {
+        return is_foldable<G,A,R>();
+      }
+    }
+  }
+
+  return false;
+}
+
+// builds the expression lhs F rhs, simplifying it when a simpler expression has the same value:
+//
+//   x + 0_c, x - 0_c, x * 1_c, and x / 1_c are x
+//   (x + a) - b is x + (a - b), and similarly for other combinations of + and -
+//   (x * a) * b is x * (a * b)
+//
+// where x is unevaluated and a and b are foldable literals
+template<class L, class R, class F>
+constexpr auto make_op2(const L& lhs, const R& rhs, F f)
+{
+  using result_type = std::invoke_result_t<F, evaluated_t<L>, evaluated_t<R>>;
+
+  if constexpr (is_identity_element<F,R,false>() and std::same_as<evaluated_t<L>, result_type>)
+  {
+    return lhs;
+  }
+  else if constexpr (is_identity_element<F,L,true>() and std::same_as<evaluated_t<R>, result_type>)
+  {
+    return rhs;
+  }
+  else if constexpr (is_reassociable<L,R,F,true>())
+  {
+    // (x F1 a) F b -> x F1 (a G b), where G is + when F1 and F agree and - otherwise
+    using G = reassociated_operation_t<decltype(L::f),F>;
+    return make_op2(lhs.lhs, fold(G(), lhs.rhs, rhs), lhs.f);
+  }
+  else if constexpr (is_reassociable<L,R,F,false>())
+  {
+    // (a F1 x) F b -> (a F b) F1 x
+    return make_op2(fold(f, lhs.lhs, rhs), lhs.rhs, lhs.f);
+  }
+  else
+  {
+    return rewrite(op2<L,R,F>{lhs, rhs, f});
+  }
+}
+
+template<class A>
+constexpr bool implies_positive()
+{
+  if constexpr (std::same_as<A,pow2>) return true;
+  else if constexpr (requires { A::min; }) return A::min > 0;
+  else return false;
+}
+
+template<class A>
+constexpr bool implies_nonnegative()
+{
+  if constexpr (requires { A::min; }) return A::min >= 0;
+  else return implies_positive<A>();
+}
+
+// true when E is a variable annotated with pow2
+template<class E>
+constexpr bool is_power_of_two()
+{
+  if constexpr (requires { E::name; typename E::annotations; }) return tuple_contains_v<pow2, typename E::annotations>;
+  else return false;
+}
+
+// true when the value of E is known to be greater than zero
+template<class E>
+constexpr bool is_positive()
+{
+  if constexpr (is_constant_v<E>)
+  {
+    return E::value > 0;
+  }
+  else if constexpr (requires { E::name; typename E::annotations; })
+  {
+    return []<class... As>(std::tuple<As...>)
+    {
+      return (implies_positive<As>() or ...);
+    }(typename E::annotations());
+  }
+  else
+  {
+    return false;
+  }
+}
+
+// true when the value of E is known to be no less than zero
+template<class E>
+constexpr bool is_nonnegative()
+{
+  if constexpr (std::unsigned_integral<evaluated_t<E>> or is_positive<E>())
+  {
+    return true;
+  }
+  else if constexpr (is_constant_v<E>)
+  {
+    return E::value >= 0;
+  }
+  else if constexpr (requires { E::name; typename E::annotations; })
+  {
+    return []<class... As>(std::tuple<As...>)
+    {
+      return (implies_nonnegative<As>() or ...);
+    }(typename E::annotations());
+  }
+  else
+  {
+    return false;
+  }
+}
+
+// the greatest value E is known to take, or nothing when it is not known or is negative
+template<class E>
+constexpr std::optional<std::uintmax_t> known_maximum()
+{
+  if constexpr (is_constant_v<E>)
+  {
+    if constexpr (std::integral<literal_value_t<E>>)
+    {
+      if(std::cmp_greater_equal(E::value, 0)) return std::uintmax_t(E::value);
+    }
+
+    return std::nullopt;
+  }
+  else if constexpr (requires { E::name; typename E::annotations; })
+  {
+    return []<class... As>(std::tuple<As...>)
+    {
+      std::optional<std::uintmax_t> result;
+
+      ([&]
+      {
+        if constexpr (requires { As::max; })
+        {
+          if(std::cmp_greater_equal(As::max, 0) and (not result or std::cmp_less(As::max, *result))) result = As::max;
+        }
+      }(), ...);
+
+      return result;
+    }(typename E::annotations());
+  }
+  else
+  {
+    return std::nullopt;
+  }
+}
+
+// true when x + y is known not to wrap around
+//
+// signed arithmetic cannot wrap, as its overflow is undefined, but unsigned arithmetic wraps unless
+// the annotations of x and y bound them so that their sum fits
+template<class X, class Y>
+constexpr bool sum_cannot_wrap()
+{
+  using T = decltype(std::declval<evaluated_t<X>>() + std::declval<evaluated_t<Y>>());
+
+  if constexpr (std::unsigned_integral<T>)
+  {
+    constexpr std::optional<std::uintmax_t> x = known_maximum<X>();
+    constexpr std::optional<std::uintmax_t> y = known_maximum<Y>();
+
+    if constexpr (x and y)
+    {
+      return *y <= std::numeric_limits<T>::max() and *x <= std::numeric_limits<T>::max() - *y;
+    }
+    else
+    {
+      return false;
+    }
+  }
+  else
+  {
+    return true;
+  }
+}
+
+// the largest number of which the value of E is known to be a multiple
+template<class E>
+constexpr std::uint64_t known_multiple()
+{
+  if constexpr (requires { E::name; typename E::annotations; })
+  {
+    return []<class... As>(std::tuple<As...>)
+    {
+      std::uint64_t result = 1;
+      ([&]
+      {
+        if constexpr (requires { As::multiple; }) result = std::lcm(result, std::uint64_t(As::multiple));
+      }(), ...);
+      return result;
+    }(typename E::annotations());
+  }
+  else
+  {
+    return 1;
+  }
+}
+
+template<class T>
+constexpr int log2_of_power_of_two(T value)
+{
+  return std::countr_zero(std::make_unsigned_t<T>(value));
+}
+
+// the operators which annotations lower /, % and * to
+//
+// each computes the same value as the operation it names, given the facts about its operands
+// which selected it, and formats as that operation. operands may be constants, so each is read
+// through its literal value
+
+template<class A, class B>
+concept integral_operands = std::integral<literal_value_t<A>> and std::integral<literal_value_t<B>>;
+
+// x / d, where d is a power of two
+struct shift_divides
+{
+  using operation = std::divides<>;
+
+  template<class X, class D>
+  constexpr auto operator()(const X& x, const D& d) const
+  {
+    if constexpr (integral_operands<X,D>)
+    {
+      using T = decltype(literal_value_t<X>(x) / literal_value_t<D>(d));
+      T dividend = literal_value_t<X>(x);
+      int k = log2_of_power_of_two(literal_value_t<D>(d));
+
+      if constexpr (std::is_signed_v<T>)
+      {
+        // a negative dividend is biased by d - 1, so that the quotient rounds toward zero as / does
+        T bias = (dividend >> std::numeric_limits<T>::digits) & T((T(1) << k) - 1);
+        return T((dividend + bias) >> k);
+      }
+      else
+      {
+        return T(dividend >> k);
+      }
+    }
+    else
+    {
+      return x / d;
+    }
+  }
+};
+
+// x / c, where c is a power of two constant which divides x
+struct exact_shift_divides
+{
+  using operation = std::divides<>;
+
+  template<class X, class C>
+  constexpr auto operator()(const X& x, const C& c) const
+  {
+    if constexpr (integral_operands<X,C>)
+    {
+      using T = decltype(literal_value_t<X>(x) / literal_value_t<C>(c));
+      return T(T(literal_value_t<X>(x)) >> log2_of_power_of_two(literal_value_t<C>(c)));
+    }
+    else
+    {
+      return x / c;
+    }
+  }
+};
+
+// x % d, where d is a power of two
+struct shift_modulus
+{
+  using operation = std::modulus<>;
+
+  template<class X, class D>
+  constexpr auto operator()(const X& x, const D& d) const
+  {
+    if constexpr (integral_operands<X,D>)
+    {
+      using T = decltype(literal_value_t<X>(x) % literal_value_t<D>(d));
+      T dividend = literal_value_t<X>(x);
+      int k = log2_of_power_of_two(literal_value_t<D>(d));
+
+      if constexpr (std::is_signed_v<T>)
+      {
+        // the remainder takes the sign of the dividend
+        return T(dividend - (T(shift_divides()(x, d)) << k));
+      }
+      else
+      {
+        return T(dividend & T((T(1) << k) - 1));
+      }
+    }
+    else
+    {
+      return x % d;
+    }
+  }
+};
+
+// a * b, where one of a or b is a power of two
+template<bool power_on_left>
+struct shift_multiplies
+{
+  using operation = std::multiplies<>;
+
+  template<class A, class B>
+  constexpr auto operator()(const A& a, const B& b) const
+  {
+    if constexpr (integral_operands<A,B>)
+    {
+      using T = decltype(literal_value_t<A>(a) * literal_value_t<B>(b));
+      if constexpr (power_on_left) return T(T(literal_value_t<B>(b)) << log2_of_power_of_two(literal_value_t<A>(a)));
+      else return T(T(literal_value_t<A>(a)) << log2_of_power_of_two(literal_value_t<B>(b)));
+    }
+    else
+    {
+      return a * b;
+    }
+  }
+};
+
+// x / d and x % d, where x is not negative and d is positive, computed without regard to sign
+template<class F>
+struct nonnegative
+{
+  using operation = F;
+
+  template<class X, class D>
+  constexpr auto operator()(const X& x, const D& d) const
+  {
+    if constexpr (integral_operands<X,D>)
+    {
+      using T = decltype(F()(literal_value_t<X>(x), literal_value_t<D>(d)));
+      using U = std::make_unsigned_t<T>;
+      return T(F()(U(literal_value_t<X>(x)), U(literal_value_t<D>(d))));
+    }
+    else
+    {
+      return F()(x, d);
+    }
+  }
+};
+
+template<class L, class R>
+constexpr bool are_integral = integral_operands<evaluated_t<L>, evaluated_t<R>>;
+
+// true when R is a positive constant which divides every value of L
+template<class L, class R>
+constexpr bool divides_known_multiple()
+{
+  if constexpr (is_constant_v<R> and std::integral<literal_value_t<R>>)
+  {
+    return R::value > 0 and known_multiple<L>() % R::value == 0;
+  }
+  else
+  {
+    return false;
+  }
+}
+
+// true when R is a constant power of two greater than one which divides every value of L
+template<class L, class R>
+constexpr bool is_exact_shift()
+{
+  if constexpr (divides_known_multiple<L,R>())
+  {
+    return R::value > 1 and std::has_single_bit(std::uint64_t(R::value));
+  }
+  else
+  {
+    return false;
+  }
+}
+
+// returns lhs / rhs, lowered to cheaper operations when annotations allow
+template<class L, class R>
+constexpr auto make_divides(const L& lhs, const R& rhs)
+{
+  if constexpr (not are_integral<L,R>)
+  {
+    return make_op2(lhs, rhs, std::divides());
+  }
+  else if constexpr (is_exact_shift<L,R>())
+  {
+    return make_op2(lhs, rhs, exact_shift_divides());
+  }
+  else if constexpr (is_power_of_two<R>())
+  {
+    return make_op2(lhs, rhs, shift_divides());
+  }
+  else if constexpr (std::is_signed_v<std::invoke_result_t<std::divides<>, evaluated_t<L>, evaluated_t<R>>> and is_nonnegative<L>() and is_positive<R>())
+  {
+    return make_op2(lhs, rhs, nonnegative<std::divides<>>());
+  }
+  else
+  {
+    return make_op2(lhs, rhs, std::divides());
+  }
+}
+
+// returns lhs % rhs, lowered to cheaper operations when annotations allow
+template<class L, class R>
+constexpr auto make_modulus(const L& lhs, const R& rhs)
+{
+  if constexpr (not are_integral<L,R>)
+  {
+    return make_op2(lhs, rhs, std::modulus());
+  }
+  else if constexpr (divides_known_multiple<L,R>() and known_multiple<L>() > 1)
+  {
+    // the remainder of a multiple of rhs is zero
+    return constant<std::invoke_result_t<std::modulus<>, evaluated_t<L>, evaluated_t<R>>(0)>();
+  }
+  else if constexpr (is_power_of_two<R>())
+  {
+    return make_op2(lhs, rhs, shift_modulus());
+  }
+  else if constexpr (std::is_signed_v<std::invoke_result_t<std::modulus<>, evaluated_t<L>, evaluated_t<R>>> and is_nonnegative<L>() and is_positive<R>())
+  {
+    return make_op2(lhs, rhs, nonnegative<std::modulus<>>());
+  }
+  else
+  {
+    return make_op2(lhs, rhs, std::modulus());
+  }
+}
+
+// returns lhs * rhs, lowered to a shift when annotations allow
+template<class L, class R>
+constexpr auto make_multiplies(const L& lhs, const R& rhs)
+{
+  if constexpr (are_integral<L,R> and is_power_of_two<R>())
+  {
+    return make_op2(lhs, rhs, shift_multiplies<false>());
+  }
+  else if constexpr (are_integral<L,R> and is_power_of_two<L>())
+  {
+    return make_op2(lhs, rhs, shift_multiplies<true>());
+  }
+  else
+  {
+    return make_op2(lhs, rhs, std::multiplies());
+  }
+}
+
+// the fused operators which the built-in rewrite rules build
+//
+// each is written as a call of the function it names, so that logs show the operation computed
+
+// ceil_div(x, d) is (x + d - 1) / d, for x not negative and d positive, without computing x + d
+template<class Divides>
+struct ceil_divides
+{
+  constexpr static std::string_view function_name = "ceil_div";
+
+  template<class X, class D>
+  constexpr auto operator()(const X& x, const D& d) const
+  {
+    if constexpr (integral_operands<X,D>)
+    {
+      using T = decltype(literal_value_t<X>(x) / literal_value_t<D>(d));
+      T quotient = Divides()(x, d);
+      T remainder = T(literal_value_t<X>(x)) - quotient * T(literal_value_t<D>(d));
+      return T(quotient + (remainder != 0));
+    }
+    else
+    {
+      return (x + d - 1) / d;
+    }
+  }
+};
+
+// fma(a, b, c) is a * b + c, rounded once when it is floating point
+struct fused_multiply_add
+{
+  constexpr static std::string_view function_name = "fma";
+
+  template<class A, class B, class C>
+  constexpr auto operator()(const A& a, const B& b, const C& c) const
+  {
+    using T = decltype(literal_value_t<A>(a) * literal_value_t<B>(b) + literal_value_t<C>(c));
+
+    if constexpr (std::floating_point<T>)
+    {
+      return std::fma(T(literal_value_t<A>(a)), T(literal_value_t<B>(b)), T(literal_value_t<C>(c)));
+    }
+    else
+    {
+      return a * b + c;
+    }
+  }
+};
+
+template<class F>
+constexpr bool is_division = std::same_as<F,std::divides<>> or requires { requires std::same_as<typename F::operation, std::divides<>>; };
+
+template<class F>
+constexpr bool is_multiplication = std::same_as<F,std::multiplies<>> or requires { requires std::same_as<typename F::operation, std::multiplies<>>; };
+
+template<class E>
+constexpr bool is_multiplication_node = false;
+
+template<class L, class R, class F>
+constexpr bool is_multiplication_node<op2<L,R,F>> = is_multiplication<F>;
+
+template<class E, auto value>
+constexpr bool is_constant_equal_to()
+{
+  if constexpr (is_constant_v<E>) return E::value == value;
+  else return false;
+}
+
+// true when ((x + d) - one) / d, divided by F, may be rewritten as ceil_div(x, d)
+//
+// this requires that d, which appears twice, is a variable or constant, so that its value is the
+// same in both places, that x and d cannot be negative, where ceil_div differs, and that x + d
+// cannot wrap around, where the division of the wrapped sum differs
+template<class X, class D, class One, class F>
+constexpr bool is_ceil_div_pattern()
+{
+  if constexpr (is_division<F> and is_constant_equal_to<One,1>() and are_integral<X,D>)
+  {
+    return (requires { D::name; } or is_constant_v<D>) and is_nonnegative<X>() and is_nonnegative<D>() and sum_cannot_wrap<X,D>();
+  }
+  else
+  {
+    return false;
+  }
+}
+
+// true when (x + c1) / c2, divided by F, may be rewritten as ceil_div(x, c2)
+template<class X, class C1, class C2, class F>
+constexpr bool is_constant_ceil_div_pattern()
+{
+  if constexpr (is_division<F> and is_constant_v<C1> and is_constant_v<C2> and are_integral<X,C2>)
+  {
+    return C2::value > 1 and C1::value == C2::value - 1 and is_nonnegative<X>() and sum_cannot_wrap<X,C1>();
+  }
+  else
+  {
+    return false;
+  }
+}
+
+// the operator which computes ceil_div(x, d) most cheaply
+template<class D>
+using ceil_divides_for = ceil_divides<std::conditional_t<is_power_of_two<D>(), shift_divides, nonnegative<std::divides<>>>>;
+
+// true when a * b + c, multiplied by M, may be rewritten as fma(a, b, c)
+template<class A, class B, class M, class C>
+constexpr bool is_fma_pattern()
+{
+  if constexpr (is_multiplication<M>)
+  {
+    return std::floating_point<literal_value_t<std::invoke_result_t<fused_multiply_add, evaluated_t<A>, evaluated_t<B>, evaluated_t<C>>>>;
+  }
+  else
+  {
+    return false;
+  }
+}
+
+// true when (x / c1) / c2, divided by F1 and F2, may be rewritten as x / (c1 * c2)
+//
+// this requires that x, c1, and c2 are of the same integral type, and that c1 * c2 fits in it
+template<class X, class C1, class F1, class C2, class F2>
+constexpr bool is_exact_quotient_pattern()
+{
+  if constexpr (is_division<F1> and is_division<F2> and is_constant_v<C1> and is_constant_v<C2>)
+  {
+    using T = literal_value_t<C1>;
+
+    if constexpr (std::integral<T> and std::same_as<T, literal_value_t<C2>> and std::same_as<T, evaluated_t<X>>)
+    {
+      T product{};
+      return C1::value != 0 and C2::value != 0 and not __builtin_mul_overflow(C1::value, C2::value, &product);
+    }
+  }
+
+  return false;
+}
+
+} // end detail
+
+
+// ((x + d) - 1_c) / d is ceil_div(x, d), where x and d cannot be negative and x + d cannot wrap
+template<class X, class D, class One, class F>
+  requires (detail::is_ceil_div_pattern<X,D,One,F>())
+struct rewrite_rule<op2<op2<op2<X,D,std::plus<>>,One,std::minus<>>,D,F>>
+{
+  constexpr static auto apply(const op2<op2<op2<X,D,std::plus<>>,One,std::minus<>>,D,F>& expr)
+  {
+    return op2<X,D,detail::ceil_divides_for<D>>{expr.lhs.lhs.lhs, expr.rhs, {}};
+  }
+};
+
+// (x + (c - 1)) / c is ceil_div(x, c), where x cannot be negative and x + (c - 1) cannot wrap, as
+// the operators fold ((x + c) - 1_c) / c into this form
+template<class X, class C1, class C2, class F>
+  requires (detail::is_constant_ceil_div_pattern<X,C1,C2,F>())
+struct rewrite_rule<op2<op2<X,C1,std::plus<>>,C2,F>>
+{
+  constexpr static auto apply(const op2<op2<X,C1,std::plus<>>,C2,F>& expr)
+  {
+    return op2<X,C2,detail::ceil_divides_for<C2>>{expr.lhs.lhs, expr.rhs, {}};
+  }
+};
+
+// a * b + c is fma(a, b, c), when it is floating point
+template<class A, class B, class M, class C>
+  requires (detail::is_fma_pattern<A,B,M,C>())
+struct rewrite_rule<op2<op2<A,B,M>,C,std::plus<>>>
+{
+  constexpr static auto apply(const op2<op2<A,B,M>,C,std::plus<>>& expr)
+  {
+    return op3<A,B,C,detail::fused_multiply_add>{expr.lhs.lhs, expr.lhs.rhs, expr.rhs, {}};
+  }
+};
+
+// c + a * b is fma(a, b, c), when it is floating point and c is not itself a product
+template<class C, class A, class B, class M>
+  requires (detail::is_fma_pattern<A,B,M,C>() and not detail::is_multiplication_node<C>)
+struct rewrite_rule<op2<C,op2<A,B,M>,std::plus<>>>
+{
+  constexpr static auto apply(const op2<C,op2<A,B,M>,std::plus<>>& expr)
+  {
+    return op3<A,B,C,detail::fused_multiply_add>{expr.rhs.lhs, expr.rhs.rhs, expr.lhs, {}};
+  }
+};
+
+// (x / c1) / c2 is x / (c1 * c2), when c1 * c2 does not overflow
+template<class X, class C1, class F1, class C2, class F2>
+  requires (detail::is_exact_quotient_pattern<X,C1,F1,C2,F2>())
+struct rewrite_rule<op2<op2<X,C1,F1>,C2,F2>>
+{
+  constexpr static auto apply(const op2<op2<X,C1,F1>,C2,F2>& expr)
+  {
+    return detail::make_divides(expr.lhs.lhs, constant<C1::value * C2::value>());
+  }
+};
+
+template<unevaluated E>
+  requires requires(evaluated_t<E> value) { +value; }
+constexpr auto operator+(const E& expr)
+{
+  return detail::rewrite(op1<E,unary_plus>{expr, unary_plus()});
+}
+
+template<unevaluated E>
+  requires requires(evaluated_t<E> value) { -value; }
+constexpr auto operator-(const E& expr)
+{
+  return detail::rewrite(op1<E,std::negate<>>{expr, std::negate()});
+}
+
+template<unevaluated E>
+  requires requires(evaluated_t<E> value) { ~value; }
+constexpr auto operator~(const E& expr)
+{
+  return detail::rewrite(op1<E,std::bit_not<>>{expr, std::bit_not()});
+}
+
+template<class L, at_least_one_unevaluated<L> R>
+  requires requires(evaluated_t<L> lhs, evaluated_t<R> rhs) { lhs + rhs; }
+constexpr auto operator+(const L& lhs, const R& rhs)
+{
+  return detail::make_op2(lhs, rhs, std::plus());
+}
+
+template<class L, at_least_one_unevaluated<L> R>
+  requires requires(evaluated_t<L> lhs, evaluated_t<R> rhs) { lhs - rhs; }
+constexpr auto operator-(const L& lhs, const R& rhs)
+{
+  return detail::make_op2(lhs, rhs, std::minus());
+}
+
+template<class L, at_least_one_unevaluated<L> R>
+  requires requires(evaluated_t<L> lhs, evaluated_t<R> rhs) { lhs * rhs; }
+constexpr auto operator*(const L& lhs, const R& rhs)
+{
+  return detail::make_multiplies(lhs, rhs);
+}
+
+template<class L, at_least_one_unevaluated<L> R>
+  requires requires(evaluated_t<L> lhs, evaluated_t<R> rhs) { lhs / rhs; }
+constexpr auto operator/(const L& lhs, const R& rhs)
+{
+  return detail::make_divides(lhs, rhs);
+}
+
+template<class L, at_least_one_unevaluated<L> R>
+  requires requires(evaluated_t<L> lhs, evaluated_t<R> rhs) { lhs % rhs; }
+constexpr auto operator%(const L& lhs, const R& rhs)
+{
+  return detail::make_modulus(lhs, rhs);
+}
+
+// comparisons build expressions whose values are bool, such as the constraints given to tune
+//
+// == and != are not overloaded, as they compare expressions themselves
+template<class L, at_least_one_unevaluated<L> R>
+  requires requires(evaluated_t<L> lhs, evaluated_t<R> rhs) { lhs < rhs; }
+constexpr auto operator<(const L& lhs, const R& rhs)
+{
+  return detail::make_op2(lhs, rhs, std::less());
+}
+
+template<class L, at_least_one_unevaluated<L> R>
+  requires requires(evaluated_t<L> lhs, evaluated_t<R> rhs) { lhs <= rhs; }
+constexpr auto operator<=(const L& lhs, const R& rhs)
+{
+  return detail::make_op2(lhs, rhs, std::less_equal());
+}
+
+template<class L, at_least_one_unevaluated<L> R>
+  requires requires(evaluated_t<L> lhs, evaluated_t<R> rhs) { lhs > rhs; }
+constexpr auto operator>(const L& lhs, const R& rhs)
+{
+  return detail::make_op2(lhs, rhs, std::greater());
+}
+
+template<class L, at_least_one_unevaluated<L> R>
+  requires requires(evaluated_t<L> lhs, evaluated_t<R> rhs) { lhs >= rhs; }
+constexpr auto operator>=(const L& lhs, const R& rhs)
+{
+  return detail::make_op2(lhs, rhs, std::greater_equal());
+}
+
+// partially evaluating something that is not an unevaluated is just the identity
+template<class T, class... Bindings>
+  requires (not unevaluated<T>)
+constexpr T partially_evaluate(const T& value, const environment<Bindings...>&)
+{
+  return value;
+}
+
+// partially evaluating an op1 folds it to a value when its operand has one
+template<class E, class F, class... Bindings>
+constexpr auto partially_evaluate(const op1<E,F>& expr, const environment<Bindings...>& env)
+{
+  auto operand = partially_evaluate(expr.expr, env);
+
+  if constexpr (unevaluated<decltype(operand)>)
+  {
+    return detail::rewrite(op1<decltype(operand),F>{operand, expr.f});
+  }
+  else
+  {
+    return expr.f(operand);
+  }
+}
+
+// partially evaluating an op2 folds it to a value when both of its operands have one, and
+// otherwise rebuilds it from its residual operands, simplifying it as the operators do
+template<class L, class R, class F, class... Bindings>
+constexpr auto partially_evaluate(const op2<L,R,F>& expr, const environment<Bindings...>& env)
+{
+  auto lhs = partially_evaluate(expr.lhs, env);
+  auto rhs = partially_evaluate(expr.rhs, env);
+
+  if constexpr (at_least_one_unevaluated<decltype(lhs), decltype(rhs)>)
+  {
+    return detail::make_op2(lhs, rhs, expr.f);
+  }
+  else
+  {
+    return expr.f(lhs, rhs);
+  }
+}
+
+// partially evaluating an op3 folds it to a value when each of its operands has one
+template<class A, class B, class C, class F, class... Bindings>
+constexpr auto partially_evaluate(const op3<A,B,C,F>& expr, const environment<Bindings...>& env)
+{
+  auto first = partially_evaluate(expr.first, env);
+  auto second = partially_evaluate(expr.second, env);
+  auto third = partially_evaluate(expr.third, env);
+
+  if constexpr (unevaluated<decltype(first)> or unevaluated<decltype(second)> or unevaluated<decltype(third)>)
+  {
+    return detail::rewrite(op3<decltype(first),decltype(second),decltype(third),F>{first, second, third, expr.f});
+  }
+  else
+  {
+    return expr.f(first, second, third);
+  }
+}
+
+// partially evaluating a tuple partially evaluates each of its elements
+template<class... Ts, class... Bindings>
+constexpr auto partially_evaluate(const std::tuple<Ts...>& t, const environment<Bindings...>& env)
+{
+  return std::apply([&](const auto&... elements)
+  {
+    return std::make_tuple(partially_evaluate(elements, env)...);
+  },
+  t);
+}
+
+// calls f with the name and bound value of each of expr's variables, in preorder
+template<class E, class... Bindings, class F>
+constexpr void for_each_binding(const E& expr, const environment<Bindings...>& env, F&& f)
+{
+  if constexpr (detail::is_instantiation_of_v<E,op1>)
+  {
+    for_each_binding(expr.expr, env, f);
+  }
+  else if constexpr (detail::is_instantiation_of_v<E,op2>)
+  {
+    for_each_binding(expr.lhs, env, f);
+    for_each_binding(expr.rhs, env, f);
+  }
+  else if constexpr (detail::is_instantiation_of_v<E,op3>)
+  {
+    for_each_binding(expr.first, env, f);
+    for_each_binding(expr.second, env, f);
+    for_each_binding(expr.third, env, f);
+  }
+  else if constexpr (detail::is_instantiation_of_v<E,std::tuple>)
+  {
+    std::apply([&](const auto&... elements)
+    {
+      (for_each_binding(elements, env, f), ...);
+    },
+    expr);
+  }
+  else if constexpr (requires { E::name; })
+  {
+    f(E::name, evaluate(expr, env));
+  }
+}
+
+
+namespace detail
+{
+
+// the text of an operator, or "?" if it is unknown
+template<class F>
+constexpr std::string_view operator_text()
+{
+  if constexpr (std::same_as<F,unary_plus> or std::same_as<F,std::plus<>>) return "+";
+  else if constexpr (std::same_as<F,std::negate<>> or std::same_as<F,std::minus<>>) return "-";
+  else if constexpr (std::same_as<F,std::bit_not<>>) return "~";
+  else if constexpr (std::same_as<F,std::multiplies<>>) return "*";
+  else if constexpr (std::same_as<F,std::divides<>>) return "/";
+  else if constexpr (std::same_as<F,std::modulus<>>) return "%";
+  else if constexpr (std::same_as<F,std::less<>>) return "<";
+  else if constexpr (std::same_as<F,std::less_equal<>>) return "<=";
+  else if constexpr (std::same_as<F,std::greater<>>) return ">";
+  else if constexpr (std::same_as<F,std::greater_equal<>>) return ">=";
+  else if constexpr (requires { F::function_name; }) return F::function_name;
+  else if constexpr (requires { typename F::operation; }) return operator_text<typename F::operation>();
+  else return "?";
+}
+
+// the kinds of node which a structural hash distinguishes
+enum class node_kind : unsigned char { unary = 1, binary, variable, literal, tuple, opaque, ternary };
+
+// adds the structure of expr to result, in preorder
+template<class E>
+constexpr void add_structure(const E& expr, fingerprint& result)
+{
+  if constexpr (is_instantiation_of_v<E,op1>)
+  {
+    result.add(node_kind::unary).add(operator_text<decltype(E::f)>());
+    add_structure(expr.expr, result);
+  }
+  else if constexpr (is_instantiation_of_v<E,op2>)
+  {
+    result.add(node_kind::binary).add(operator_text<decltype(E::f)>());
+    add_structure(expr.lhs, result);
+    add_structure(expr.rhs, result);
+  }
+  else if constexpr (is_instantiation_of_v<E,op3>)
+  {
+    result.add(node_kind::ternary).add(operator_text<decltype(E::f)>());
+    add_structure(expr.first, result);
+    add_structure(expr.second, result);
+    add_structure(expr.third, result);
+  }
+  else if constexpr (is_instantiation_of_v<E,std::tuple>)
+  {
+    result.add(node_kind::tuple).add(std::tuple_size_v<E>);
+    std::apply([&](const auto&... elements)
+    {
+      (add_structure(elements, result), ...);
+    },
+    expr);
+  }
+  else if constexpr (requires { E::name; })
+  {
+    result.add(node_kind::variable).add(E::name);
+  }
+  else if constexpr (requires(fingerprint f) { f.add(literal_value_t<E>(expr)); })
+  {
+    result.add(node_kind::literal).add(literal_value_t<E>(expr));
+  }
+  else
+  {
+    result.add(node_kind::opaque);
+  }
+}
+
+// true when the structural hash of E describes it completely: each of its operators is built in,
+// and each of its literals can be fingerprinted, so that no other expression hashes alike but by
+// collision
+template<class E>
+constexpr bool is_structurally_hashable()
+{
+  if constexpr (is_instantiation_of_v<E,op1>)
+  {
+    return operator_text<decltype(E::f)>() != "?" and is_structurally_hashable<decltype(E::expr)>();
+  }
+  else if constexpr (is_instantiation_of_v<E,op2>)
+  {
+    return operator_text<decltype(E::f)>() != "?" and is_structurally_hashable<decltype(E::lhs)>() and is_structurally_hashable<decltype(E::rhs)>();
+  }
+  else if constexpr (is_instantiation_of_v<E,op3>)
+  {
+    return operator_text<decltype(E::f)>() != "?" and is_structurally_hashable<decltype(E::first)>() and is_structurally_hashable<decltype(E::second)>() and is_structurally_hashable<decltype(E::third)>();
+  }
+  else if constexpr (is_instantiation_of_v<E,std::tuple>)
+  {
+    return []<class... Ts>(std::type_identity<std::tuple<Ts...>>)
+    {
+      return (is_structurally_hashable<Ts>() and ...);
+    }(std::type_identity<E>());
+  }
+  else if constexpr (requires { E::name; })
+  {
+    return true;
+  }
+  else
+  {
+    return requires(const E& value, fingerprint f) { f.add(literal_value_t<E>(value)); };
+  }
+}
+
+template<class E>
+constexpr bool is_operation_v = is_instantiation_of_v<E,op1> or is_instantiation_of_v<E,op2> or is_instantiation_of_v<E,op3>;
+
+// true when A and B are both op1s, op2s, or op3s of the same operator
+template<class A, class B>
+constexpr bool is_same_operation()
+{
+  if constexpr ((is_instantiation_of_v<A,op1> and is_instantiation_of_v<B,op1>) or (is_instantiation_of_v<A,op2> and is_instantiation_of_v<B,op2>) or (is_instantiation_of_v<A,op3> and is_instantiation_of_v<B,op3>))
+  {
+    return std::same_as<decltype(A::f), decltype(B::f)>;
+  }
+
+  return false;
+}
+
+} // end detail
+
+
+// a hash of expr's structure: the operator of each operation, the name of each variable, and the
+// value of each literal, in preorder
+//
+// the hash is a fingerprint, so it is the same in every build and on every platform, and is the
+// same as that of the same expression built by unevaluated.hpp. a constant hashes as its value, so
+// x + 1_c and x + 1 hash alike. operators other than the built-in ones hash alike, as do literals
+// which a fingerprint cannot hash, so such expressions may collide.
+template<class E>
+constexpr std::uint64_t structural_hash(const E& expr)
+{
+  fingerprint result;
+  detail::add_structure(expr, result);
+  return result.value();
+}
+
+// true when a and b are the same expression: their operations have the same operators, their
+// variables the same names, and their literals the same types and values. a constant is the same
+// as a literal of its value's type, so x + 1_c is the same as x + 1
+template<class A, class B>
+constexpr bool structurally_equal(const A& a, const B& b)
+{
+  if constexpr (detail::is_same_operation<A,B>())
+  {
+    using F = decltype(A::f);
+
+    bool result = std::is_empty_v<F>;
+    if constexpr (std::equality_comparable<F>)
+    {
+      result = result or a.f == b.f;
+    }
+
+    if constexpr (detail::is_instantiation_of_v<A,op1>)
+    {
+      return result and structurally_equal(a.expr, b.expr);
+    }
+    else if constexpr (detail::is_instantiation_of_v<A,op2>)
+    {
+      return result and structurally_equal(a.lhs, b.lhs) and structurally_equal(a.rhs, b.rhs);
+    }
+    else
+    {
+      return result and structurally_equal(a.first, b.first) and structurally_equal(a.second, b.second) and structurally_equal(a.third, b.third);
+    }
+  }
+  else if constexpr (detail::is_operation_v<A>)
+  {
+    return false;
+  }
+  else if constexpr (requires { A::name; } or requires { B::name; })
+  {
+    if constexpr (requires { A::name; B::name; })
+    {
+      return A::name == B::name;
+    }
+    else
+    {
+      return false;
+    }
+  }
+  else if constexpr (detail::is_instantiation_of_v<A,std::tuple> or detail::is_instantiation_of_v<B,std::tuple>)
+  {
+    if constexpr (detail::is_instantiation_of_v<A,std::tuple> and detail::is_instantiation_of_v<B,std::tuple>)
+    {
+      if constexpr (std::tuple_size_v<A> == std::tuple_size_v<B>)
+      {
+        return [&]<std::size_t... i>(std::index_sequence<i...>)
+        {
+          return (structurally_equal(std::get<i>(a), std::get<i>(b)) and ...);
+        }(std::make_index_sequence<std::tuple_size_v<A>>());
+      }
+    }
+
+    return false;
+  }
+  else if constexpr (unevaluated<A> or unevaluated<B>)
+  {
+    return false;
+  }
+  else if constexpr (not std::same_as<detail::literal_value_t<A>, detail::literal_value_t<B>>)
+  {
+    // literals of different types may combine differently, as those of x/2 and x/2.0 do
+    return false;
+  }
+  else if constexpr (std::equality_comparable<detail::literal_value_t<A>>)
+  {
+    return detail::literal_value_t<A>(a) == detail::literal_value_t<B>(b);
+  }
+  else
+  {
+    return std::is_empty_v<A> and std::same_as<A,B>;
+  }
+}
+
+namespace detail
+{
+
+// the index of name among names, or sizeof...(names) if it is not there
+template<sl... names>
+constexpr std::size_t position_of(std::string_view name)
+{
+  constexpr std::array<std::string_view, sizeof...(names)> positions{std::string_view(names)...};
+  return std::find(positions.begin(), positions.end(), name) - positions.begin();
+}
+
+// evaluates expr with the variable named by the ith of names bound to the ith of args, a tuple
+template<sl... names, class E, class Args>
+constexpr auto evaluate_positional(const E& expr, const Args& args)
+{
+  if constexpr (is_instantiation_of_v<E,op1>)
+  {
+    return expr.f(evaluate_positional<names...>(expr.expr, args));
+  }
+  else if constexpr (is_instantiation_of_v<E,op2>)
+  {
+    return expr.f(evaluate_positional<names...>(expr.lhs, args), evaluate_positional<names...>(expr.rhs, args));
+  }
+  else if constexpr (is_instantiation_of_v<E,op3>)
+  {
+    return expr.f(evaluate_positional<names...>(expr.first, args), evaluate_positional<names...>(expr.second, args), evaluate_positional<names...>(expr.third, args));
+  }
+  else if constexpr (is_instantiation_of_v<E,std::tuple>)
+  {
+    return std::apply([&](const auto&... elements)
+    {
+      return std::make_tuple(evaluate_positional<names...>(elements, args)...);
+    },
+    expr);
+  }
+  else if constexpr (requires { E::name; })
+  {
+    constexpr std::size_t i = position_of<names...>(E::name);
+    static_assert(i < sizeof...(names), "compile: variable name not among the argument names.");
+
+    // an argument bound to an annotated variable is checked as a binding would be
+    [&]<class... Annotations>(std::tuple<Annotations...>)
+    {
+      validate<Annotations...>(std::get<i>(args));
+    }(typename E::annotations());
+
+    return std::get<i>(args);
+  }
+  else
+  {
+    return literal_value_t<E>(expr);
+  }
+}
+
+} // end detail
+
+// a compiled_expression evaluates an expression with its variables bound to positional arguments
+//
+// each variable is resolved to the position of its name among names when the compiled_expression
+// is instantiated, so calling one builds no environment and looks nothing up: with optimization,
+// it compiles to the same code as the arithmetic written by hand. it holds only the expression's
+// literals, so an expression of variables and constants compiles to a callable with no state.
+template<class E, detail::sl... names>
+class compiled_expression
+{
+  public:
+    constexpr explicit compiled_expression(const E& expr)
+      : expr_{expr}
+    {}
+
+    template<class... Args>
+      requires (sizeof...(Args) == sizeof...(names))
+    constexpr auto operator()(const Args&... args) const
+    {
+      return detail::evaluate_positional<names...>(expr_, std::tie(args...));
+    }
+
+    constexpr const E& expression() const
+    {
+      return expr_;
+    }
+
+  private:
+    E expr_;
+};
+
+// compile<"a","b",...>(expr) returns a callable whose ith argument is bound to the variable named
+// by the ith name
+template<detail::sl... names, class E>
+constexpr compiled_expression<E,names...> compile(const E& expr)
+{
+  return compiled_expression<E,names...>{expr};
+}
+
+namespace detail
+{
+
+// evaluates expr over elements [offset, offset + n) of env's columns and passes the result,
+// an operand, to k
+template<class E, class... Bindings, class K>
+void evaluate_chunk(const E& expr, const environment<Bindings...>& env, std::size_t offset, std::size_t n, K&& k)
+{
+  if constexpr (is_instantiation_of_v<E,op1>)
+  {
+    evaluate_chunk(expr.expr, env, offset, n, [&]<class A>(const operand<A>& x)
+    {
+      using R = std::invoke_result_t<decltype(expr.f), A>;
+      R result[chunk_size];
+      transform(expr.f, x, result, n);
+      k(column<R>(result));
+    });
+  }
+  else if constexpr (is_instantiation_of_v<E,op2>)
+  {
+    evaluate_chunk(expr.lhs, env, offset, n, [&]<class A>(const operand<A>& lhs)
+    {
+      evaluate_chunk(expr.rhs, env, offset, n, [&]<class B>(const operand<B>& rhs)
+      {
+        using R = std::invoke_result_t<decltype(expr.f), A, B>;
+        R result[chunk_size];
+        transform(expr.f, lhs, rhs, result, n);
+        k(column<R>(result));
+      });
+    });
+  }
+  else if constexpr (is_instantiation_of_v<E,op3>)
+  {
+    evaluate_chunk(expr.first, env, offset, n, [&]<class A>(const operand<A>& first)
+    {
+      evaluate_chunk(expr.second, env, offset, n, [&]<class B>(const operand<B>& second)
+      {
+        evaluate_chunk(expr.third, env, offset, n, [&]<class C>(const operand<C>& third)
+        {
+          using R = std::invoke_result_t<decltype(expr.f), A, B, C>;
+          R result[chunk_size];
+          transform(expr.f, first, second, third, result, n);
+          k(column<R>(result));
+        });
+      });
+    });
+  }
+  else if constexpr (unevaluated<E>)
+  {
+    // a variable is bound either to a column or to a single value
+    auto value = evaluate(expr, env);
+
+    if constexpr (is_span_v<decltype(value)>)
+    {
+      if(value.size() < offset + n) throw std::out_of_range("evaluate_batch: column is shorter than output.");
+      k(column(value.data() + offset));
+    }
+    else
+    {
+      k(broadcast(value));
+    }
+  }
+  else
+  {
+    k(broadcast(literal_value_t<E>(expr)));
+  }
+}
+
+} // end detail
+
+
+// evaluates expr once per element of out, writing each result to out
+//
+// each of env's bindings is either a std::span, whose ith element is used to compute out[i],
+// or a single value used to compute every element of out
+template<unevaluated E, class... Bindings, class R>
+void evaluate_batch(const E& expr, const environment<Bindings...>& env, std::span<R> out)
+{
+  for(std::size_t offset = 0; offset < out.size(); offset += detail::chunk_size)
+  {
+    std::size_t n = std::min(detail::chunk_size, out.size() - offset);
+
+    detail::evaluate_chunk(expr, env, offset, n, [&](const auto& result)
+    {
+      detail::copy(result, out.data() + offset, n);
+    });
+  }
+}
+
+namespace detail
+{
+
+// returns a std::tuple of std::type_identity<N> for each node N of E's tree, in preorder
+template<class E>
+constexpr auto preorder_types()
+{
+  if constexpr (is_instantiation_of_v<E,op1>)
+  {
+    return std::tuple_cat(std::tuple<std::type_identity<E>>(), preorder_types<decltype(E::expr)>());
+  }
+  else if constexpr (is_instantiation_of_v<E,op2>)
+  {
+    return std::tuple_cat(std::tuple<std::type_identity<E>>(), preorder_types<decltype(E::lhs)>(), preorder_types<decltype(E::rhs)>());
+  }
+  else if constexpr (is_instantiation_of_v<E,op3>)
+  {
+    return std::tuple_cat(std::tuple<std::type_identity<E>>(), preorder_types<decltype(E::first)>(), preorder_types<decltype(E::second)>(), preorder_types<decltype(E::third)>());
+  }
+  else
+  {
+    return std::tuple<std::type_identity<E>>();
+  }
+}
+
+// the number of nodes in E's tree
+template<class E>
+constexpr std::size_t tree_size = std::tuple_size_v<decltype(preorder_types<E>())>;
+
+// the position of each expression's root among the nodes of several expressions, where the nodes of
+// each expression follow those of the expressions before it
+template<class... Es>
+constexpr std::array<std::size_t, sizeof...(Es)> root_positions = []
+{
+  std::array<std::size_t, sizeof...(Es)> sizes{tree_size<Es>...};
+  std::array<std::size_t, sizeof...(Es)> result{};
+  for(std::size_t j = 1; j < result.size(); ++j)
+  {
+    result[j] = result[j-1] + sizes[j-1];
+  }
+  return result;
+}();
+
+// the type of the node at position i of a list of nodes
+template<class Nodes, std::size_t i>
+using node_t = typename std::tuple_element_t<i,Nodes>::type;
+
+// the positions before i of nodes whose type is the same as the type of the node at position i
+template<class Nodes, std::size_t i>
+constexpr auto earlier_positions_of_same_type()
+{
+  constexpr auto same = []<std::size_t... js>(std::index_sequence<js...>)
+  {
+    return std::array<bool,i>{std::same_as<node_t<Nodes,js>, node_t<Nodes,i>>...};
+  }(std::make_index_sequence<i>());
+
+  std::array<std::size_t, std::count(same.begin(), same.end(), true)> result{};
+  for(std::size_t j = 0, n = 0; j < i; ++j)
+  {
+    if(same[j]) result[n++] = j;
+  }
+
+  return result;
+}
+
+// true when a node after position i has the same type as the node at position i
+template<class Nodes, std::size_t i>
+constexpr bool has_later_position_of_same_type()
+{
+  return []<std::size_t... js>(std::index_sequence<js...>)
+  {
+    return (std::same_as<node_t<Nodes,i+1+js>, node_t<Nodes,i>> or ...);
+  }(std::make_index_sequence<std::tuple_size_v<Nodes> - i - 1>());
+}
+
+// true when all expressions of type E are identical: its operations' functions are empty, and its
+// leaves are variables and constants, so that it holds no value which is not part of its type
+template<class E>
+constexpr bool is_identified_by_type()
+{
+  if constexpr (is_instantiation_of_v<E,op1>)
+  {
+    return std::is_empty_v<decltype(E::f)> and is_identified_by_type<decltype(E::expr)>();
+  }
+  else if constexpr (is_instantiation_of_v<E,op2>)
+  {
+    return std::is_empty_v<decltype(E::f)> and is_identified_by_type<decltype(E::lhs)>() and is_identified_by_type<decltype(E::rhs)>();
+  }
+  else if constexpr (is_instantiation_of_v<E,op3>)
+  {
+    return std::is_empty_v<decltype(E::f)> and is_identified_by_type<decltype(E::first)>() and is_identified_by_type<decltype(E::second)>() and is_identified_by_type<decltype(E::third)>();
+  }
+  else
+  {
+    return requires { E::name; } or is_constant_v<E>;
+  }
+}
+
+// returns the node at position i of expr's tree, in preorder
+template<std::size_t i, class E>
+constexpr const auto& node_at(const E& expr)
+{
+  if constexpr (i == 0)
+  {
+    return expr;
+  }
+  else if constexpr (is_instantiation_of_v<E,op1>)
+  {
+    return node_at<i-1>(expr.expr);
+  }
+  else if constexpr (is_instantiation_of_v<E,op2>)
+  {
+    if constexpr (i-1 < tree_size<decltype(E::lhs)>) return node_at<i-1>(expr.lhs);
+    else return node_at<i-1-tree_size<decltype(E::lhs)>>(expr.rhs);
+  }
+  else
+  {
+    constexpr std::size_t second = 1 + tree_size<decltype(E::first)>;
+    constexpr std::size_t third = second + tree_size<decltype(E::second)>;
+
+    if constexpr (i < second) return node_at<i-1>(expr.first);
+    else if constexpr (i < third) return node_at<i-second>(expr.second);
+    else return node_at<i-third>(expr.third);
+  }
+}
+
+// returns the node at position i among the nodes of several expressions
+template<std::size_t i, class... Es>
+constexpr const auto& node_among(const std::tuple<Es...>& exprs)
+{
+  constexpr auto roots = root_positions<Es...>;
+  constexpr std::size_t j = std::count_if(roots.begin() + 1, roots.end(), [](std::size_t root) { return root <= i; });
+
+  return node_at<i - roots[j]>(std::get<j>(exprs));
+}
+
+// the first position of a node identical to the node at position i of exprs, which is i itself
+// when there is none
+//
+// nodes which are identified by their type need no comparison, so only those which contain
+// literals or stateful functions are compared, once, when a common_subexpressions is made
+template<class Nodes, std::size_t i, class... Es, std::size_t n>
+constexpr std::size_t find_leader(const std::tuple<Es...>& exprs, const std::array<std::size_t,n>& leaders)
+{
+  constexpr auto candidates = earlier_positions_of_same_type<Nodes,i>();
+
+  if constexpr (candidates.size() == 0 or not is_operation_v<node_t<Nodes,i>>)
+  {
+    return i;
+  }
+  else if constexpr (is_identified_by_type<node_t<Nodes,i>>())
+  {
+    return candidates[0];
+  }
+  else
+  {
+    return [&]<std::size_t... cs>(std::index_sequence<cs...>)
+    {
+      std::size_t result = i;
+
+      // candidates are in order, so the first identical one is the first identical node
+      ((leaders[candidates[cs]] == candidates[cs] and structurally_equal(node_among<candidates[cs]>(exprs), node_among<i>(exprs)) and (result = candidates[cs], true)) or ...);
+
+      return result;
+    }(std::make_index_sequence<candidates.size()>());
+  }
+}
+
+// the values computed during a shared evaluation
+template<class Env, class... Nodes>
+struct shared_values
+{
+  std::tuple<std::optional<decltype(evaluate(std::declval<typename Nodes::type>(), std::declval<Env>()))>...> values;
+
+  constexpr shared_values(const Env&, std::tuple<Nodes...>)
+  {}
+};
+
+// evaluates expr, the node at position i, reusing the value of its leader when it has one
+template<std::size_t i, class Nodes, class E, class Env, class Values, std::size_t n>
+constexpr auto evaluate_shared(const E& expr, const Env& env, Values& values, const std::array<std::size_t,n>& leaders)
+{
+  if constexpr (is_operation_v<E>)
+  {
+    using value_type = decltype(evaluate(expr, env));
+
+    constexpr auto candidates = earlier_positions_of_same_type<Nodes,i>();
+
+    if constexpr (candidates.size() > 0 and is_identified_by_type<E>())
+    {
+      // the leader is the first node of this type, whatever the values bound
+      return value_type(*std::get<candidates[0]>(values.values));
+    }
+    else if constexpr (candidates.size() > 0)
+    {
+      if(leaders[i] != i)
+      {
+        const value_type* found = nullptr;
+
+        [&]<std::size_t... cs>(std::index_sequence<cs...>)
+        {
+          ((leaders[i] == candidates[cs] ? (found = &*std::get<candidates[cs]>(values.values)) : nullptr), ...);
+        }(std::make_index_sequence<candidates.size()>());
+
+        return *found;
+      }
+    }
+
+    value_type result = [&]
+    {
+      if constexpr (is_instantiation_of_v<E,op1>)
+      {
+        return expr.f(evaluate_shared<i+1,Nodes>(expr.expr, env, values, leaders));
+      }
+      else if constexpr (is_instantiation_of_v<E,op2>)
+      {
+        // evaluate lhs before rhs, because leaders precede the positions which share them
+        auto lhs = evaluate_shared<i+1,Nodes>(expr.lhs, env, values, leaders);
+        auto rhs = evaluate_shared<i+1+tree_size<decltype(E::lhs)>,Nodes>(expr.rhs, env, values, leaders);
+        return expr.f(lhs, rhs);
+      }
+      else
+      {
+        constexpr std::size_t second = i+1+tree_size<decltype(E::first)>;
+        auto a = evaluate_shared<i+1,Nodes>(expr.first, env, values, leaders);
+        auto b = evaluate_shared<second,Nodes>(expr.second, env, values, leaders);
+        auto c = evaluate_shared<second+tree_size<decltype(E::second)>,Nodes>(expr.third, env, values, leaders);
+        return expr.f(a, b, c);
+      }
+    }();
+
+    if constexpr (has_later_position_of_same_type<Nodes,i>())
+    {
+      std::get<i>(values.values) = result;
+    }
+
+    return result;
+  }
+  else
+  {
+    // looking up a variable in an environment is already free
+    return evaluate(expr, env);
+  }
+}
+
+} // end detail
+
+
+// common_subexpressions wraps a tuple of expressions so that evaluating it evaluates each
+// subexpression which occurs more than once, whether within one expression or across several,
+// only once
+//
+// identical subexpressions are detected by their type. subexpressions of the same type which
+// contain literals are compared by value once, when the common_subexpressions is made, so that
+// evaluation compares nothing
+template<class... Es>
+class common_subexpressions
+{
+  public:
+    constexpr common_subexpressions(const std::tuple<Es...>& exprs)
+      : exprs_{exprs}
+    {
+      [&]<std::size_t... is>(std::index_sequence<is...>)
+      {
+        // in order, because each leader is found among the leaders before it
+        ((leaders_[is] = detail::find_leader<node_types,is>(exprs_, leaders_)), ...);
+      }(std::make_index_sequence<num_nodes>());
+    }
+
+    constexpr common_subexpressions(const Es&... exprs)
+      : common_subexpressions{std::tuple<Es...>{exprs...}}
+    {}
+
+    constexpr const std::tuple<Es...>& expressions() const
+    {
+      return exprs_;
+    }
+
+    template<class... Bindings>
+    friend constexpr auto evaluate(const common_subexpressions& self, const environment<Bindings...>& env)
+    {
+      detail::shared_values values(env, node_types());
+
+      return [&]<std::size_t... is>(std::index_sequence<is...>)
+      {
+        constexpr auto roots = detail::root_positions<Es...>;
+
+        // braced initialization evaluates the expressions in order
+        return std::tuple<decltype(evaluate(std::declval<Es>(), env))...>{detail::evaluate_shared<roots[is],node_types>(std::get<is>(self.exprs_), env, values, self.leaders_)...};
+      }(std::index_sequence_for<Es...>());
+    }
+
+  private:
+    using node_types = decltype(std::tuple_cat(detail::preorder_types<Es>()...));
+    constexpr static std::size_t num_nodes = std::tuple_size_v<node_types>;
+
+    std::tuple<Es...> exprs_;
+    std::array<std::size_t, num_nodes> leaders_{};
+};
+
+namespace detail
+{
+
+// true when E's tree contains the variable named name
+template<class E>
+constexpr bool depends_on(std::string_view name)
+{
+  if constexpr (is_instantiation_of_v<E,op1>)
+  {
+    return depends_on<decltype(E::expr)>(name);
+  }
+  else if constexpr (is_instantiation_of_v<E,op2>)
+  {
+    return depends_on<decltype(E::lhs)>(name) or depends_on<decltype(E::rhs)>(name);
+  }
+  else if constexpr (is_instantiation_of_v<E,op3>)
+  {
+    return depends_on<decltype(E::first)>(name) or depends_on<decltype(E::second)>(name) or depends_on<decltype(E::third)>(name);
+  }
+  else if constexpr (unevaluated<E>)
+  {
+    return E::name == name;
+  }
+  else
+  {
+    return false;
+  }
+}
+
+// the positions of nodes whose trees contain the variable named name
+template<class Nodes, sl name>
+constexpr auto dependent_positions()
+{
+  constexpr auto depends = []<std::size_t... is>(std::index_sequence<is...>)
+  {
+    return std::array<bool, sizeof...(is)>{depends_on<node_t<Nodes,is>>(name)...};
+  }(std::make_index_sequence<std::tuple_size_v<Nodes>>());
+
+  std::array<std::size_t, std::count(depends.begin(), depends.end(), true)> result{};
+  for(std::size_t j = 0, n = 0; j < depends.size(); ++j)
+  {
+    if(depends[j]) result[n++] = j;
+  }
+
+  return result;
+}
+
+// a tuple of a std::optional value for each of a list of nodes
+template<class Env, class Nodes>
+struct node_values;
+
+template<class Env, class... Nodes>
+struct node_values<Env, std::tuple<Nodes...>>
+{
+  using type = std::tuple<std::optional<decltype(evaluate(std::declval<typename Nodes::type>(), std::declval<Env>()))>...>;
+};
+
+} // end detail
+
+
+// an evaluation_session evaluates a tuple of expressions repeatedly as the bindings of its
+// environment change, remembering the value of each subexpression between evaluations
+//
+// which variables each subexpression depends on is known from its type, so changing a binding with
+// set forgets exactly the values of the subexpressions which contain it. the next evaluation
+// recomputes those and reuses the rest.
+template<class Env, class... Es>
+class evaluation_session
+{
+  public:
+    constexpr evaluation_session(const Env& env, const std::tuple<Es...>& exprs)
+      : env_{env},
+        exprs_{exprs}
+    {}
+
+    constexpr evaluation_session(const Env& env, const Es&... exprs)
+      : evaluation_session{env, std::tuple<Es...>{exprs...}}
+    {}
+
+    constexpr const Env& env() const
+    {
+      return env_;
+    }
+
+    constexpr const std::tuple<Es...>& expressions() const
+    {
+      return exprs_;
+    }
+
+    // binds name to value, forgetting the value of each subexpression which depends on name
+    template<detail::sl name, class T>
+    constexpr void set(const T& value)
+    {
+      env_.template assign<name>(value);
+
+      constexpr auto dependents = detail::dependent_positions<node_types,name>();
+
+      [&]<std::size_t... is>(std::index_sequence<is...>)
+      {
+        (std::get<dependents[is]>(values_).reset(), ...);
+      }(std::make_index_sequence<dependents.size()>());
+    }
+
+    // the number of times an evaluation reused the remembered value of a subexpression
+    constexpr std::size_t num_reused() const
+    {
+      return num_reused_;
+    }
+
+    // the number of times an evaluation computed the value of a subexpression
+    constexpr std::size_t num_recomputed() const
+    {
+      return num_recomputed_;
+    }
+
+    friend constexpr auto evaluate(evaluation_session& self)
+    {
+      return [&]<std::size_t... is>(std::index_sequence<is...>)
+      {
+        constexpr auto roots = detail::root_positions<Es...>;
+
+        // braced initialization evaluates the expressions in order
+        return std::tuple<decltype(evaluate(std::declval<Es>(), self.env_))...>{self.template evaluate_node<roots[is]>(std::get<is>(self.exprs_))...};
+      }(std::index_sequence_for<Es...>());
+    }
+
+  private:
+    using node_types = decltype(std::tuple_cat(detail::preorder_types<Es>()...));
+
+    // evaluates expr, the node at position i
+    template<std::size_t i, class E>
+    constexpr auto evaluate_node(const E& expr)
+    {
+      if constexpr (detail::is_operation_v<E>)
+      {
+        auto& value = std::get<i>(values_);
+
+        if(value)
+        {
+          ++num_reused_;
+        }
+        else
+        {
+          if constexpr (detail::is_instantiation_of_v<E,op1>)
+          {
+            value = expr.f(evaluate_node<i+1>(expr.expr));
+          }
+          else if constexpr (detail::is_instantiation_of_v<E,op2>)
+          {
+            auto lhs = evaluate_node<i+1>(expr.lhs);
+            auto rhs = evaluate_node<i+1+detail::tree_size<decltype(E::lhs)>>(expr.rhs);
+            value = expr.f(lhs, rhs);
+          }
+          else
+          {
+            constexpr std::size_t second = i+1+detail::tree_size<decltype(E::first)>;
+            auto a = evaluate_node<i+1>(expr.first);
+            auto b = evaluate_node<second>(expr.second);
+            auto c = evaluate_node<second+detail::tree_size<decltype(E::second)>>(expr.third);
+            value = expr.f(a, b, c);
+          }
+
+          ++num_recomputed_;
+        }
+
+        return *value;
+      }
+      else
+      {
+        // looking up a variable in an environment is already free
+        return evaluate(expr, env_);
+      }
+    }
+
+    Env env_;
+    std::tuple<Es...> exprs_;
+    typename detail::node_values<Env,node_types>::type values_;
+    std::size_t num_reused_ = 0;
+    std::size_t num_recomputed_ = 0;
+};
+
+
+// an instrumentation policy is not_instrumented or instrumented, from profile.hpp
+template<class P>
+concept instrumentation_policy = requires { { P::enabled } -> std::convertible_to<bool>; };
+
+namespace detail
+{
+
+// the label of a node in a profile
+template<class E>
+constexpr std::string_view profile_label()
+{
+  if constexpr (is_operation_v<E>) return operator_text<decltype(E::f)>();
+  else return E::name;
+}
+
+// evaluates expr, the node at position i of the expression whose structural hash is expression,
+// recording the calls and cycles of each of its operations and variables in buffer
+template<std::size_t i, class E, class... Bindings>
+auto evaluate_instrumented(const E& expr, const environment<Bindings...>& env, profile_buffer& buffer, std::uint64_t expression)
+{
+  if constexpr (is_operation_v<E> or requires { E::name; })
+  {
+    std::uint64_t start = timestamp();
+
+    auto result = [&]
+    {
+      if constexpr (is_instantiation_of_v<E,op1>)
+      {
+        return expr.f(evaluate_instrumented<i+1>(expr.expr, env, buffer, expression));
+      }
+      else if constexpr (is_instantiation_of_v<E,op2>)
+      {
+        constexpr std::size_t rhs = i + 1 + tree_size<decltype(E::lhs)>;
+        auto l = evaluate_instrumented<i+1>(expr.lhs, env, buffer, expression);
+        auto r = evaluate_instrumented<rhs>(expr.rhs, env, buffer, expression);
+        return expr.f(l, r);
+      }
+      else if constexpr (is_instantiation_of_v<E,op3>)
+      {
+        constexpr std::size_t second = i + 1 + tree_size<decltype(E::first)>;
+        constexpr std::size_t third = second + tree_size<decltype(E::second)>;
+        auto a = evaluate_instrumented<i+1>(expr.first, env, buffer, expression);
+        auto b = evaluate_instrumented<second>(expr.second, env, buffer, expression);
+        auto c = evaluate_instrumented<third>(expr.third, env, buffer, expression);
+        return expr.f(a, b, c);
+      }
+      else
+      {
+        return evaluate(expr, env);
+      }
+    }();
+
+    buffer.record(expression, i, profile_label<E>(), timestamp() - start);
+    return result;
+  }
+  else
+  {
+    // literals cost nothing to evaluate, so they are not recorded
+    return evaluate(expr, env);
+  }
+}
+
+} // end detail
+
+
+// evaluates expr in env as policy directs
+//
+// with not_instrumented, this is evaluate(expr, env), and costs nothing more. with instrumented, each
+// operation and variable of expr records its calls and the cycles spent evaluating it, including its
+// operands, in the profile named by the policy, keyed by expr's structural hash. the elements of a
+// tuple are recorded as separate expressions. because names are resolved when a program is compiled,
+// a variable.hpp expression never records a missing binding or a binding of the wrong type.
+template<class E, class... Bindings, instrumentation_policy P>
+constexpr auto evaluate(const E& expr, const environment<Bindings...>& env, const P& policy)
+{
+  if constexpr (not P::enabled)
+  {
+    return evaluate(expr, env);
+  }
+  else if constexpr (detail::is_instantiation_of_v<E,std::tuple>)
+  {
+    return std::apply([&](const auto&... elements)
+    {
+      // braced initialization evaluates the elements in order
+      return std::tuple<decltype(evaluate(elements, env))...>{evaluate(elements, env, policy)...};
+    },
+    expr);
+  }
+  else
+  {
+    return detail::evaluate_instrumented<0>(expr, env, policy.target->local(), structural_hash(expr));
+  }
+}
+
+#if defined(__cpp_user_defined_literals)
+
+// user-defined literal operator allows variable written as literals, For example,
+//
+//     auto var = "block_size"_v;
+//
+// var has type variable<"block_size",int>.
+template<detail::sl name>
+constexpr variable<name> operator""_v() noexcept
+{
+  return {};
+}
+
+namespace detail
+{
+
+struct integer_literal
+{
+  unsigned long long value;
+  bool decimal;
+  bool valid;
+  bool overflow;
+};
+
+// parses the characters of an integer literal, which may be decimal, or hexadecimal, binary, or
+// octal with the prefix 0x, 0b, or 0
+template<char... digits>
+constexpr integer_literal parse_integer_literal()
+{
+  constexpr char text[] = {digits...};
+  std::size_t i = 0;
+  unsigned base = 10;
+
+  if(sizeof(text) > 1 and text[0] == '0')
+  {
+    if(text[1] == 'x' or text[1] == 'X')
+    {
+      base = 16;
+      i = 2;
+    }
+    else if(text[1] == 'b' or text[1] == 'B')
+    {
+      base = 2;
+      i = 2;
+    }
+    else
+    {
+      base = 8;
+      i = 1;
+    }
+  }
+
+  integer_literal result{0, base == 10, i < sizeof(text), false};
+
+  for(; i < sizeof(text); ++i)
+  {
+    char c = text[i];
+    if(c == '\'') continue;
+
+    unsigned digit = 'a' <= c and c <= 'f' ? c - 'a' + 10 :
+                     'A' <= c and c <= 'F' ? c - 'A' + 10 :
+                     '0' <= c and c <= '9' ? c - '0' :
+                     base;
+
+    if(digit >= base) result.valid = false;
+
+    result.overflow = result.overflow
+      or __builtin_mul_overflow(result.value, base, &result.value)
+      or __builtin_add_overflow(result.value, digit, &result.value);
+  }
+
+  return result;
+}
+
+} // end detail
+
+
+// user-defined literal operator allows constants written as integer literals, For example,
+//
+//     auto one = 1_c;
+//
+// one has type constant<1>. Like an integer literal, the constant's type is the first of int,
+// long, long long, and unsigned long long which can represent its value, and may also be
+// unsigned int or unsigned long when it is not decimal.
+template<char... digits>
+constexpr auto operator""_c() noexcept
+{
+  constexpr detail::integer_literal literal = detail::parse_integer_literal<digits...>();
+  static_assert(literal.valid, "_c: invalid digit in integer literal.");
+  static_assert(not literal.overflow, "_c: integer literal is too large for unsigned long long.");
+
+  constexpr unsigned long long value = literal.value;
+
+  if constexpr (value <= std::numeric_limits<int>::max())
+  {
+    return constant<int(value)>{};
+  }
+  else if constexpr (not literal.decimal and value <= std::numeric_limits<unsigned int>::max())
+  {
+    return constant<(unsigned int)value>{};
+  }
+  else if constexpr (value <= std::numeric_limits<long>::max())
+  {
+    return constant<long(value)>{};
+  }
+  else if constexpr (not literal.decimal and value <= std::numeric_limits<unsigned long>::max())
+  {
+    return constant<(unsigned long)value>{};
+  }
+  else if constexpr (value <= std::numeric_limits<long long>::max())
+  {
+    return constant<(long long)value>{};
+  }
+  else
+  {
+    return constant<value>{};
+  }
+}
+
+#endif // __cpp_user_defined_literals
+
+#if __has_include(<fmt/format.h>)
+
+#include <fmt/format.h>
+
+#if defined(__circle_lang__)
+template<auto len, detail::sl<len> name>
+struct fmt::formatter<variable<name>>
+{
+  template<class ParseContext>
+  constexpr auto parse(ParseContext& ctx)
+  {
+    return ctx.begin();
+  }
+
+  template<class FormatContext>
+  auto format(const variable<name>&, FormatContext& ctx)
+  {
+    return fmt::format_to(ctx.out(), "{}", name);
+  }
+};
+#else
+template<detail::sl name, class T, class... Annotations>
+struct fmt::formatter<variable<name,T,Annotations...>>
+{
+  template<class ParseContext>
+  constexpr auto parse(ParseContext& ctx)
+  {
+    return ctx.begin();
+  }
+
+  template<class FormatContext>
+  auto format(const variable<name,T,Annotations...>& var, FormatContext& ctx)
+  {
+    return fmt::format_to(ctx.out(), "{}", var.name);
+  }
+};
+#endif
+
+template<auto v>
+struct fmt::formatter<constant<v>> : fmt::formatter<decltype(v)>
+{
+  template<class FormatContext>
+  auto format(const constant<v>&, FormatContext& ctx)
+  {
+    return fmt::formatter<decltype(v)>::format(v, ctx);
+  }
+};
+
+namespace detail
+{
+
+
+// a literal whose text is only known when the expression is formatted
+template<class E>
+constexpr bool is_runtime_literal_v = not is_operation_v<E> and not requires { E::name; } and not (is_constant_v<E> and std::integral<literal_value_t<E>>);
+
+// an operation written as a call of the function its operator names, such as ceil_div(n, block_size)
+template<class E>
+constexpr bool is_function_call_v = is_operation_v<E> and requires { decltype(E::f)::function_name; };
+
+// an operation written with an infix or prefix operator
+template<class E>
+constexpr bool is_infix_v = is_operation_v<E> and not is_function_call_v<E>;
+
+// appends the text of E to b, with b.hole() in place of each runtime literal
+//
+// operations which are operands of an operator are parenthesized
+template<class E, class Builder>
+constexpr void build_text(Builder& b)
+{
+  if constexpr (is_function_call_v<E>)
+  {
+    b.append(operator_text<decltype(E::f)>());
+    b.append("(");
+
+    if constexpr (is_instantiation_of_v<E,op1>)
+    {
+      build_text<decltype(E::expr)>(b);
+    }
+    else if constexpr (is_instantiation_of_v<E,op2>)
     {
-      op = '+';
+      build_text<decltype(E::lhs)>(b);
+      b.append(", ");
+      build_text<decltype(E::rhs)>(b);
     }
-    else if constexpr (std::same_as<F,std::minus<>>)
+    else
+    {
+      build_text<decltype(E::first)>(b);
+      b.append(", ");
+      build_text<decltype(E::second)>(b);
+      b.append(", ");
+      build_text<decltype(E::third)>(b);
+    }
+
+    b.append(")");
+  }
+  else if constexpr (is_instantiation_of_v<E,op1>)
+  {
+    using operand_type = decltype(E::expr);
+
+    b.append(operator_text<decltype(E::f)>());
+    if constexpr (is_infix_v<operand_type>) b.append("(");
+    build_text<operand_type>(b);
+    if constexpr (is_infix_v<operand_type>) b.append(")");
+  }
+  else if constexpr (is_instantiation_of_v<E,op2>)
+  {
+    using lhs_type = decltype(E::lhs);
+    using rhs_type = decltype(E::rhs);
+
+    if constexpr (is_infix_v<lhs_type>) b.append("(");
+    build_text<lhs_type>(b);
+    if constexpr (is_infix_v<lhs_type>) b.append(")");
+
+    b.append(operator_text<decltype(E::f)>());
+
+    if constexpr (is_infix_v<rhs_type>) b.append("(");
+    build_text<rhs_type>(b);
+    if constexpr (is_infix_v<rhs_type>) b.append(")");
+  }
+  else if constexpr (requires { E::name; })
+  {
+    b.append(E::name);
+  }
+  else if constexpr (not is_runtime_literal_v<E>)
+  {
+    // the digits of an integral constant
+    if constexpr (std::same_as<literal_value_t<E>,bool>)
     {
-      op = '-';
+      b.append(E::value ? "true" : "false");
     }
-    else if constexpr (std::same_as<F,std::multiplies<>>)
+    else
     {
-      op = '*';
+      using unsigned_type = std::make_unsigned_t<literal_value_t<E>>;
+
+      bool negative = false;
+      if constexpr (std::is_signed_v<literal_value_t<E>>) negative = E::value < 0;
+
+      unsigned_type magnitude = negative ? unsigned_type(0) - unsigned_type(E::value) : unsigned_type(E::value);
+
+      char digits[std::numeric_limits<unsigned_type>::digits10 + 2] = {};
+      std::size_t i = sizeof(digits);
+      do
+      {
+        digits[--i] = char('0' + magnitude % 10);
+        magnitude /= 10;
+      }
+      while(magnitude != 0);
+
+      if(negative) digits[--i] = '-';
+      b.append(std::string_view(digits + i, sizeof(digits) - i));
     }
-    else if constexpr (std::same_as<F,std::divides<>>)
+  }
+  else
+  {
+    b.hole();
+  }
+}
+
+// the text of E's tree, less its runtime literals: num_holes + 1 pieces, between which the
+// literals are written in preorder
+template<std::size_t size, std::size_t num_holes_>
+struct text_skeleton
+{
+  constexpr static std::size_t num_holes = num_holes_;
+
+  char text[size + 1] = {};
+  std::size_t ends[num_holes + 1] = {};
+
+  constexpr std::string_view piece(std::size_t i) const
+  {
+    std::size_t begin = i == 0 ? 0 : ends[i-1];
+    return {text + begin, ends[i] - begin};
+  }
+};
+
+template<class E>
+constexpr auto skeleton_of = []
+{
+  struct measure
+  {
+    std::size_t size = 0;
+    std::size_t num_holes = 0;
+
+    constexpr void append(std::string_view s) { size += s.size(); }
+    constexpr void hole() { ++num_holes; }
+  };
+
+  constexpr measure m = []
+  {
+    measure result;
+    build_text<E>(result);
+    return result;
+  }();
+
+  using skeleton_type = text_skeleton<m.size, m.num_holes>;
+
+  struct fill
+  {
+    skeleton_type result;
+    std::size_t size = 0;
+    std::size_t num_holes = 0;
+
+    constexpr void append(std::string_view s)
     {
-      op = '/';
+      for(char c : s)
+      {
+        result.text[size++] = c;
+      }
     }
-    else if constexpr (std::same_as<F,std::modulus<>>)
+
+    constexpr void hole()
     {
-      op = '%';
+      result.ends[num_holes++] = size;
     }
+  };
+
+  fill f;
+  build_text<E>(f);
+  f.result.ends[m.num_holes] = f.size;
+  return f.result;
+}();
+
+// calls f with each runtime literal of expr, in preorder
+template<class E, class F>
+constexpr void for_each_runtime_literal(const E& expr, F&& f)
+{
+  if constexpr (is_instantiation_of_v<E,op1>)
+  {
+    for_each_runtime_literal(expr.expr, f);
+  }
+  else if constexpr (is_instantiation_of_v<E,op2>)
+  {
+    for_each_runtime_literal(expr.lhs, f);
+    for_each_runtime_literal(expr.rhs, f);
+  }
+  else if constexpr (is_instantiation_of_v<E,op3>)
+  {
+    for_each_runtime_literal(expr.first, f);
+    for_each_runtime_literal(expr.second, f);
+    for_each_runtime_literal(expr.third, f);
+  }
+  else if constexpr (is_runtime_literal_v<E>)
+  {
+    f(expr);
+  }
+}
+
+// writes the text of expr to out, copying the pieces of its skeleton and formatting its literals
+template<class E, class OutputIt>
+OutputIt format_text(const E& expr, OutputIt out)
+{
+  constexpr const auto& skeleton = skeleton_of<E>;
+
+  out = std::copy_n(skeleton.piece(0).data(), skeleton.piece(0).size(), out);
+
+  if constexpr (skeleton.num_holes > 0)
+  {
+    std::size_t i = 0;
+    for_each_runtime_literal(expr, [&](const auto& literal)
+    {
+      out = fmt::format_to(out, "{}", literal);
+
+      std::string_view piece = skeleton.piece(++i);
+      out = std::copy_n(piece.data(), piece.size(), out);
+    });
+  }
+
+  return out;
+}
+
+} // end detail
+
+// the text of an expression without runtime literals, such as (block_size+1_c)*tile, which is
+// known at compile time
+template<class E>
+  requires (detail::skeleton_of<E>.num_holes == 0)
+constexpr std::string_view static_text = detail::skeleton_of<E>.piece(0);
+
+// writes the text of expr to buffer, as formatting expr would, and returns the text written
+//
+// formatting an operation copies the pieces of its text, which are built at compile time, and
+// formats only its runtime literals between them. nothing is allocated.
+//
+// throws std::length_error if buffer is too small
+template<class E>
+std::string_view render_to(const E& expr, std::span<char> buffer)
+{
+  auto result = fmt::format_to_n(buffer.data(), buffer.size(), "{}", expr);
+  if(result.size > buffer.size()) throw std::length_error("render_to: buffer is too small.");
+  return {buffer.data(), result.size};
+}
+
+template<unevaluated E, std::invocable<evaluated_t<E>> F>
+struct fmt::formatter<op1<E,F>>
+{
+  template<class ParseContext>
+  constexpr auto parse(ParseContext& ctx)
+  {
+    return ctx.begin();
+  }
+
+  template<class FormatContext>
+  auto format(const op1<E,F>& expr, FormatContext& ctx)
+  {
+    return ::detail::format_text(expr, ctx.out());
+  }
+};
+
+template<class L, class R, std::invocable<evaluated_t<L>, evaluated_t<R>> F>
+struct fmt::formatter<op2<L,R,F>>
+{
+  template<class ParseContext>
+  constexpr auto parse(ParseContext& ctx)
+  {
+    return ctx.begin();
+  }
 
-    constexpr bool lhs_needs_parens = ::detail::is_instantiation_of_v<L,op1> or ::detail::is_instantiation_of_v<L,op2>;
-    constexpr bool rhs_needs_parens = ::detail::is_instantiation_of_v<R,op1> or ::detail::is_instantiation_of_v<R,op2>;
+  template<class FormatContext>
+  auto format(const op2<L,R,F>& expr, FormatContext& ctx)
+  {
+    return ::detail::format_text(expr, ctx.out());
+  }
+};
 
-    constexpr auto format_string = 
-      (lhs_needs_parens and rhs_needs_parens)         ? "({}){}({})" :
-      (lhs_needs_parens and not rhs_needs_parens)     ? "({}){}{}"   :
-      (not lhs_needs_parens and rhs_needs_parens)     ? "{}{}({})"
-                                                      : "{}{}{}"
-    ;
+template<class A, class B, class C, std::invocable<evaluated_t<A>, evaluated_t<B>, evaluated_t<C>> F>
+struct fmt::formatter<op3<A,B,C,F>>
+{
+  template<class ParseContext>
+  constexpr auto parse(ParseContext& ctx)
+  {
+    return ctx.begin();
+  }
 
-    return fmt::format_to(ctx.out(), format_string, expr.lhs, op, expr.rhs);
+  template<class FormatContext>
+  auto format(const op3<A,B,C,F>& expr, FormatContext& ctx)
+  {
+    return ::detail::format_text(expr, ctx.out());
   }
 };
 